@@ -0,0 +1,443 @@
+/*
+ * Benchmark of the calculator, it measures every stage of the calculator with the same workloads every time
+ * so the results of two builds can be compared to catch the regressions.
+ *
+ * For every workload and stage it reports:
+ *  - ns/char: time to parse or compile per character of the expressions
+ *  - ns/node: time to evaluate per token of the expressions (per token and row in the batch engine)
+ *  - allocs/expr: heap allocations per compiled or evaluated expression
+ *  - peak RSS: the maximum resident memory of the process so far, it never decreases, so the workloads go from the
+ *    smallest to the largest
+ */
+
+#include "engine.hpp"
+#include "calculator.h"
+
+#include<chrono>
+#include<random>
+#include<cstdlib>
+#include<sys/resource.h>
+
+using namespace calculator::engine;
+
+// Allocations
+
+std::atomic<size_t> allocationCount{ 0 };
+
+void* operator new(size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+
+	if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+// Not inlined, GCC warns about the free of memory it thinks comes from new when it sees both
+__attribute__((noinline)) void releaseMemory(void* memory) {
+	std::free(memory);
+}
+
+void operator delete(void* memory) noexcept {
+	releaseMemory(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+	releaseMemory(memory);
+}
+
+size_t getAllocationCount() {
+	return allocationCount.load(std::memory_order_relaxed);
+}
+
+// In KiB
+long getPeakMemory() {
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// Workloads
+
+struct Workload {
+	std::string name;
+	std::vector<std::string> expressions;
+	size_t evaluations; // Evaluations of every expression in the evaluation stages
+	Precision precision = Precision::STRICT;
+};
+
+std::string formatNumber(double value) {
+	std::string text;
+	appendNumber(text, value);
+	return text;
+}
+
+// x+1.5+x+2.5+... a long left leaning chain
+Workload flatSum(size_t terms) {
+	std::string expression = "x";
+	for (size_t i = 1; i < terms; i++) {
+		expression += i % 2 == 0 ? "+x" : "+" + formatNumber(i + 0.5);
+	}
+
+	return { "flat sum", { expression }, 20 };
+}
+
+// (x+(x*1.5-(x+(...)))) a deep right leaning chain inside parentheses
+Workload nestedParentheses(size_t depth) {
+	std::string expression;
+	for (size_t i = 0; i < depth; i++) {
+		expression += i % 2 == 0 ? "(x+" : "(x*1.5-";
+	}
+	expression += "x";
+	expression.append(depth, ')');
+
+	return { "nested parentheses", { expression }, 100 };
+}
+
+// Polynomials with integer and real powers like 1.5*x^1-2.5*x^2+...+x^0.5
+Workload polynomials(size_t count, size_t degree) {
+	Workload workload{ "polynomials", {}, 200 };
+
+	for (size_t i = 0; i < count; i++) {
+		std::string expression;
+		for (size_t power = 1; power <= degree; power++) {
+			if (power > 1) {
+				expression += power % 2 == 0 ? "-" : "+";
+			}
+			expression += formatNumber(power + i * 0.25) + "*x^" + std::to_string(power);
+		}
+		expression += "+x^0.5+(x+1)^2.5";
+
+		workload.expressions.push_back(expression);
+	}
+
+	return workload;
+}
+
+// The same few subexpressions repeated many times like (x^2+1)*1.5+(x^2+1)^0.5*(x*2.5-1)+..., the generated formulas
+// are like this
+Workload repeatedSubexpressions(size_t terms) {
+	const char* subexpressions[] = { "(x^2+1)", "(x*2.5-1)", "(x^0.5+x)", "((x^2+1)/(x*2.5-1))" };
+
+	std::string expression;
+	for (size_t i = 0; i < terms; i++) {
+		if (i > 0) {
+			expression += i % 3 == 0 ? "-" : "+";
+		}
+		expression += std::string(subexpressions[i % 4]) + "*" + subexpressions[(i / 4) % 4];
+	}
+
+	return { "repeated subtrees", { expression }, 1000 };
+}
+
+// Piecewise models like if(x-3.5, min(x, 2.5)*abs(x-3), (x+1)^0.5*x^2.5+...), the expensive branch is only taken
+// by some of the values of x
+Workload piecewise(size_t count) {
+	Workload workload{ "piecewise", {}, 1000 };
+
+	for (size_t i = 0; i < count; i++) {
+		std::string expensive;
+		for (size_t term = 1; term <= 8; term++) {
+			expensive += (term > 1 ? "+" : "") + std::string("(x+") + formatNumber(term + i * 0.25) + ")^0.5*x^" + formatNumber(term + 0.5);
+		}
+
+		std::string threshold = formatNumber(1.25 + (i % 4) * 0.25);
+		workload.expressions.push_back("if(max(x-" + threshold + ", 0), " + expensive + ", min(x, 2.5)*abs(x-3))");
+	}
+
+	return workload;
+}
+
+// Signals like sin(x*1.5)*exp(-x/4)+log(x+2.5)*cos(x*0.5)+..., with the C library functions or the fast ones
+Workload elementary(size_t count, Precision precision) {
+	Workload workload{ precision == Precision::FAST ? "elementary fast" : "elementary", {}, 1000, precision };
+
+	for (size_t i = 0; i < count; i++) {
+		std::string expression;
+		for (size_t term = 1; term <= 4; term++) {
+			std::string scale = formatNumber(term * 0.5 + i * 0.25);
+			expression += (term > 1 ? "+" : "") + std::string("sin(x*") + scale + ")*exp(-x/" + scale + ")+log(x+" + scale + ")*cos(x*" + scale + ")";
+		}
+		workload.expressions.push_back(expression);
+	}
+
+	return workload;
+}
+
+// Small random expressions like the lines of a batch input, the seed is fixed so they are always the same
+Workload shortExpressions(size_t count) {
+	std::mt19937 random(12345);
+	Workload workload{ "short expressions", {}, 100 };
+
+	auto operand = [&random] {
+		return random() % 3 == 0 ? std::string("x") : formatNumber(random() % 1000 / 8.0 + 1);
+	};
+
+	const char operators[] = { '+', '-', '*', '/', '^' };
+	for (size_t i = 0; i < count; i++) {
+		std::string expression = operand();
+		size_t operations = 1 + random() % 6;
+
+		for (size_t j = 0; j < operations; j++) {
+			char operation = operators[random() % (random() % 8 == 0 ? 5 : 4)];
+
+			if (random() % 4 == 0) {
+				expression += operation + ("(" + operand() + "+" + operand() + ")");
+			}
+			else {
+				expression += operation + operand();
+			}
+		}
+
+		workload.expressions.push_back(expression);
+	}
+
+	return workload;
+}
+
+// Measurement
+
+volatile double sink; // Keeps the results so the evaluations aren't removed
+
+using Clock = std::chrono::steady_clock;
+
+// Runs the stage until it takes enough time to be stable and returns the fastest run in nanoseconds
+template<typename Stage>
+double measure(Stage stage) {
+	constexpr auto MINIMUM_TIME = std::chrono::milliseconds(200);
+	constexpr int MINIMUM_RUNS = 3;
+
+	double fastest = std::numeric_limits<double>::infinity();
+	auto start = Clock::now();
+	for (int runs = 0; runs < MINIMUM_RUNS || Clock::now() - start < MINIMUM_TIME; runs++) {
+		auto runStart = Clock::now();
+		stage();
+		fastest = std::min(fastest, std::chrono::duration<double, std::nano>(Clock::now() - runStart).count());
+	}
+
+	return fastest;
+}
+
+// Allocations of a single run of the stage
+template<typename Stage>
+size_t countAllocations(Stage stage) {
+	size_t before = getAllocationCount();
+	stage();
+	return getAllocationCount() - before;
+}
+
+void printHeader() {
+	std::printf("%-20s %-10s %10s %10s %12s %16s\n", "workload", "stage", "ns/char", "ns/node", "allocs/expr", "peak RSS (KiB)");
+}
+
+// The values below zero aren't measured for that stage
+void printResult(const std::string& workload, const char* stage, double nsPerChar, double nsPerNode, double allocations) {
+	auto column = [](double value) {
+		char text[32];
+		if (value < 0) {
+			std::snprintf(text, sizeof(text), "-");
+		}
+		else {
+			std::snprintf(text, sizeof(text), "%.2f", value);
+		}
+		return std::string(text);
+	};
+
+	std::printf("%-20s %-10s %10s %10s %12s %16ld\n", workload.c_str(), stage, column(nsPerChar).c_str(), column(nsPerNode).c_str(), column(allocations).c_str(), getPeakMemory());
+	std::fflush(stdout);
+}
+
+void run(const Workload& workload, ThreadPool& pool) {
+	const std::vector<std::string> variables = { "x" };
+	CompileOptions options;
+	options.precision = workload.precision;
+	const size_t expressionCount = workload.expressions.size();
+
+	size_t characters = 0;
+	for (const std::string& expression : workload.expressions) {
+		characters += expression.size();
+	}
+
+	// Parse only, into an arena as the compiled expressions do
+	auto parse = [&] {
+		for (const std::string& expression : workload.expressions) {
+			TokenArena arena;
+			VariableTable table{ variables };
+			TokenPtr root = parseToken(expression, &arena, &table);
+			sink = root->type == TokenType::NUMBER;
+		}
+	};
+	double parseTime = measure(parse);
+	printResult(workload.name, "parse", parseTime / characters, -1, double(countAllocations(parse)) / expressionCount);
+
+	// Parse, optimize and compile to bytecode
+	auto compile = [&] {
+		for (const std::string& expression : workload.expressions) {
+			CompiledExpression compiled = compileExpression(expression, variables, options);
+			sink = compiled.program.stackSize;
+		}
+	};
+	double compileTime = measure(compile);
+	printResult(workload.name, "compile", compileTime / characters, -1, double(countAllocations(compile)) / expressionCount);
+
+	std::vector<CompiledExpression> compiled;
+	size_t nodes = 0;
+	for (const std::string& expression : workload.expressions) {
+		compiled.push_back(compileExpression(expression, variables, options));
+		nodes += compiled.back().program.size();
+	}
+
+	// The compiled expressions only keep their program, so the trees are built again for the tree engine. The programs
+	// share the repeated subtrees and the trees don't, so each engine is measured by its own count of nodes
+	TokenArena arena;
+	std::vector<TokenPtr> trees;
+	size_t treeNodes = 0;
+	for (const std::string& expression : workload.expressions) {
+		VariableTable table{ variables };
+		trees.push_back(parseToken(expression, &arena, &table));
+		optimizeExpression(trees.back(), &arena);
+		treeNodes += countTokens(*trees.back());
+	}
+
+	const double evaluations = double(workload.evaluations) * expressionCount;
+
+	// The evaluation stages change the value of x every time, so nothing can be computed only once
+	auto resolve = [&] {
+		for (size_t i = 0; i < workload.evaluations; i++) {
+			double x = 1 + i * 1e-3;
+			for (const TokenPtr& tree : trees) {
+				sink = tree->resolve(&x);
+			}
+		}
+	};
+	double resolveTime = measure(resolve);
+	printResult(workload.name, "resolve", -1, resolveTime / workload.evaluations / treeNodes, countAllocations(resolve) / evaluations);
+
+	auto bytecode = [&] {
+		for (size_t i = 0; i < workload.evaluations; i++) {
+			double x = 1 + i * 1e-3;
+			for (const CompiledExpression& expression : compiled) {
+				sink = executeProgram(expression.program, &x);
+			}
+		}
+	};
+	double bytecodeTime = measure(bytecode);
+	printResult(workload.name, "bytecode", -1, bytecodeTime / workload.evaluations / nodes, countAllocations(bytecode) / evaluations);
+
+	// The same expressions through the C API of the library, which has its own copy of the engine
+	std::vector<calculator::Expression> handles;
+	for (const std::string& expression : workload.expressions) {
+		handles.emplace_back(expression, variables, workload.precision == Precision::FAST ? CALCULATOR_FAST_PRECISION : CALCULATOR_DEFAULT);
+	}
+
+	auto library = [&] {
+		for (size_t i = 0; i < workload.evaluations; i++) {
+			double x = 1 + i * 1e-3;
+			for (const calculator::Expression& handle : handles) {
+				sink = handle.evaluate(&x);
+			}
+		}
+	};
+	double libraryTime = measure(library);
+	printResult(workload.name, "library", -1, libraryTime / workload.evaluations / nodes, countAllocations(library) / evaluations);
+
+	// The native code of the programs the JIT can compile, the rest are left out of this stage
+	std::vector<std::unique_ptr<NativeCode>> natives;
+	size_t nativeNodes = 0;
+	for (const CompiledExpression& expression : compiled) {
+		if (auto code = NativeCompiler::compile(expression.program.view())) {
+			natives.push_back(std::move(code));
+			nativeNodes += expression.program.size();
+		}
+	}
+
+	if (!natives.empty()) {
+		const double nativeEvaluations = double(workload.evaluations) * natives.size();
+
+		auto native = [&] {
+			for (size_t i = 0; i < workload.evaluations; i++) {
+				double x = 1 + i * 1e-3;
+				for (const auto& code : natives) {
+					sink = code->getFunction()(&x);
+				}
+			}
+		};
+		double nativeTime = measure(native);
+		printResult(workload.name, "native", -1, nativeTime / workload.evaluations / nativeNodes, countAllocations(native) / nativeEvaluations);
+	}
+
+	// The batch engine evaluates the rows of x at once, the evaluations are rows here
+	std::vector<double> column(workload.evaluations * 16);
+	for (size_t i = 0; i < column.size(); i++) {
+		column[i] = 1 + i * 1e-3;
+	}
+	std::vector<double> out(column.size());
+	const double* columns[] = { column.data() };
+
+	auto batch = [&] {
+		for (const CompiledExpression& expression : compiled) {
+			expression.evaluateBatch(columns, out.data(), column.size());
+			sink = out[0];
+		}
+	};
+	double batchTime = measure(batch);
+	printResult(workload.name, "batch", -1, batchTime / column.size() / nodes, double(countAllocations(batch)) / expressionCount);
+
+	// Only the trees big enough to be split in tasks
+	if (nodes / expressionCount >= ParallelEvaluator::DEFAULT_THRESHOLD) {
+		std::vector<ParallelEvaluator> evaluators;
+		for (const CompiledExpression& expression : compiled) {
+			evaluators.emplace_back(expression.program, pool);
+		}
+
+		auto parallel = [&] {
+			for (size_t i = 0; i < workload.evaluations; i++) {
+				double x = 1 + i * 1e-3;
+				for (const ParallelEvaluator& evaluator : evaluators) {
+					sink = evaluator.evaluate(&x);
+				}
+			}
+		};
+		double parallelTime = measure(parallel);
+		printResult(workload.name, "parallel", -1, parallelTime / workload.evaluations / nodes, countAllocations(parallel) / evaluations);
+	}
+
+	// The value and the derivative by x in both modes of the gradients
+	for (DifferentiationMode mode : { DifferentiationMode::FORWARD, DifferentiationMode::REVERSE }) {
+		std::vector<GradientEvaluator> evaluators;
+		for (const CompiledExpression& expression : compiled) {
+			evaluators.emplace_back(expression, mode);
+		}
+
+		auto gradient = [&] {
+			for (size_t i = 0; i < workload.evaluations; i++) {
+				double x = 1 + i * 1e-3;
+				double derivative;
+				for (GradientEvaluator& evaluator : evaluators) {
+					sink = evaluator.evaluate(&x, &derivative) + derivative;
+				}
+			}
+		};
+		double gradientTime = measure(gradient);
+		const char* stage = mode == DifferentiationMode::FORWARD ? "forward" : "reverse";
+		printResult(workload.name, stage, -1, gradientTime / workload.evaluations / nodes, countAllocations(gradient) / evaluations);
+	}
+}
+
+int main() {
+	ThreadPool pool(std::max(std::thread::hardware_concurrency(), 1u));
+
+	std::printf("SIMD width: %zu doubles, threads: %zu\n\n", SimdDouble::WIDTH, pool.getThreadCount());
+	printHeader();
+
+	run(shortExpressions(10000), pool);
+	run(polynomials(16, 64), pool);
+	run(repeatedSubexpressions(1000), pool);
+	run(piecewise(64), pool);
+	run(elementary(64, Precision::STRICT), pool);
+	run(elementary(64, Precision::FAST), pool);
+	run(nestedParentheses(10000), pool);
+	run(flatSum(200000), pool);
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * The calculator library, the API of calculator.h over the engines. The handles are the compiled expressions of
+ * the engines, and the exceptions of the engines, which are only thrown when the memory runs out, stop here.
+ */
+
+#define CALCULATOR_BUILDING_LIBRARY
+#include "calculator.h"
+// The engine has internal linkage here, so what the library doesn't use of it warns as unused
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include "engine.hpp"
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+struct CalculatorExpression {
+	CompiledExpression compiled;
+};
+
+static void setCalculatorError(CalculatorError* error, size_t position, std::string_view message) {
+	if (error == nullptr) {
+		return;
+	}
+
+	size_t length = std::min(message.size(), sizeof(error->message) - 1);
+	std::memcpy(error->message, message.data(), length);
+	error->message[length] = '\0';
+	error->position = position;
+}
+
+extern "C" {
+
+uint32_t calculatorGetVersion(void) {
+	return CALCULATOR_API_VERSION;
+}
+
+CalculatorExpression* calculatorCompile(const char* text, size_t length, const char* const* variables, size_t variableCount,
+	uint32_t flags, CalculatorError* error) {
+	std::string_view expression(text, text == nullptr ? 0 : length);
+
+	CompileOptions options;
+	options.precision = (flags & CALCULATOR_FAST_PRECISION) ? Precision::FAST : Precision::STRICT;
+	options.allowNewVariables = !(flags & CALCULATOR_NO_NEW_VARIABLES);
+	options.optimize = !(flags & CALCULATOR_NO_OPTIMIZE);
+	if (flags & CALCULATOR_NO_JIT) {
+		options.jitThreshold = 0;
+	}
+
+	try {
+		std::vector<std::string> names(variables, variables + variableCount);
+		auto result = std::make_unique<CalculatorExpression>();
+
+		CompileError compileError = tryCompileExpression(expression, names, result->compiled, options);
+		if (compileError) {
+			setCalculatorError(error, compileError.offset, compileError.getMessage(expression));
+			return nullptr;
+		}
+		return result.release();
+	}
+	catch (const std::exception& exception) {
+		setCalculatorError(error, 0, exception.what());
+		return nullptr;
+	}
+}
+
+size_t calculatorGetVariableCount(const CalculatorExpression* expression) {
+	return expression->compiled.getVariableCount();
+}
+
+const char* calculatorGetVariableName(const CalculatorExpression* expression, size_t slot) {
+	const std::vector<std::string>& names = expression->compiled.variables.names;
+	return slot < names.size() ? names[slot].c_str() : nullptr;
+}
+
+// NaN when the memory runs out
+double calculatorEvaluate(const CalculatorExpression* expression, const double* bindings) {
+	try {
+		return expression->compiled.evaluate(bindings);
+	}
+	catch (const std::exception&) {
+		return std::numeric_limits<double>::quiet_NaN();
+	}
+}
+
+void calculatorEvaluateBatch(const CalculatorExpression* expression, const double* const* columns, double* out, size_t count) {
+	try {
+		expression->compiled.evaluateBatch(columns, out, count);
+	}
+	catch (const std::exception&) {
+		std::fill_n(out, count, std::numeric_limits<double>::quiet_NaN());
+	}
+}
+
+void calculatorFree(CalculatorExpression* expression) {
+	delete expression;
+}
+
+}
@@ -0,0 +1,149 @@
+/*
+ * Stable API of the calculator library, to compile and evaluate expressions inside another program without the
+ * text round trip of the command line. It is plain C so any language and compiler can call it, the expressions are
+ * opaque handles and nothing of the engines is visible, so a new version of the library doesn't break the programs
+ * built with an older one. The C++ programs also get the Expression class at the end, which frees its handle.
+ *
+ * Every function can be called from any thread at the same time, also with the same expression, except freeing an
+ * expression while another thread uses it. No function throws.
+ */
+
+#ifndef CALCULATOR_H
+#define CALCULATOR_H
+
+#include<stddef.h>
+#include<stdint.h>
+
+#if defined(CALCULATOR_SHARED) && defined(_WIN32)
+#ifdef CALCULATOR_BUILDING_LIBRARY
+#define CALCULATOR_API __declspec(dllexport)
+#else
+#define CALCULATOR_API __declspec(dllimport)
+#endif
+#elif defined(CALCULATOR_SHARED) && defined(__GNUC__)
+#define CALCULATOR_API __attribute__((visibility("default")))
+#else
+#define CALCULATOR_API
+#endif
+
+// Version of this API, it only grows when functions or flags are added
+#define CALCULATOR_API_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct CalculatorExpression CalculatorExpression;
+
+// Flags of calculatorCompile, they can be combined
+enum {
+	CALCULATOR_DEFAULT = 0,
+	CALCULATOR_FAST_PRECISION = 1, // sin, cos, exp and log use the fast approximations instead of the C library
+	CALCULATOR_NO_NEW_VARIABLES = 2, // Only the given variables can be used, any other name is an error
+	CALCULATOR_NO_OPTIMIZE = 4, // The constants aren't folded and the identical subexpressions aren't shared
+	CALCULATOR_NO_JIT = 8, // Always evaluated by the bytecode, never compiled to native code
+};
+
+// Why an expression couldn't be compiled, the position is the offset in bytes in the text of the expression
+typedef struct CalculatorError {
+	size_t position;
+	char message[256]; // Ends with a '\0', it is cut if it doesn't fit
+} CalculatorError;
+
+// Version of the library the program runs with, CALCULATOR_API_VERSION of the header it was built with
+CALCULATOR_API uint32_t calculatorGetVersion(void);
+
+// Compiles the length bytes of the text, which don't need to end with a '\0'. The variables are the names of the
+// first slots of the bindings, in order, and any other name of the text that isn't a constant becomes a variable
+// after them unless the flags have CALCULATOR_NO_NEW_VARIABLES. Returns NULL and fills the error, if it isn't NULL,
+// when the expression isn't valid
+CALCULATOR_API CalculatorExpression* calculatorCompile(const char* text, size_t length, const char* const* variables, size_t variableCount,
+	uint32_t flags, CalculatorError* error);
+
+// Number of variables of the expression, the given ones and then the new ones. The expression must not be NULL
+CALCULATOR_API size_t calculatorGetVariableCount(const CalculatorExpression* expression);
+
+// Name of the variable of a slot, it stays valid until the expression is freed, NULL if there isn't that slot. The
+// expression must not be NULL
+CALCULATOR_API const char* calculatorGetVariableName(const CalculatorExpression* expression, size_t slot);
+
+// The bindings hold one value for each variable, in slot order, they can be NULL if the expression has no variables.
+// The expression must not be NULL, it isn't checked
+CALCULATOR_API double calculatorEvaluate(const CalculatorExpression* expression, const double* bindings);
+
+// Evaluates count rows at once, columns[slot] holds the count values of the variable of that slot and out gets
+// the count results. Much faster than evaluating the rows one at a time. The expression must not be NULL
+CALCULATOR_API void calculatorEvaluateBatch(const CalculatorExpression* expression, const double* const* columns, double* out, size_t count);
+
+// Frees the expression, NULL is ignored
+CALCULATOR_API void calculatorFree(CalculatorExpression* expression);
+
+#ifdef __cplusplus
+}
+
+#include<string>
+#include<string_view>
+#include<stdexcept>
+#include<utility>
+#include<vector>
+
+namespace calculator {
+
+	// Owns a compiled expression, the constructor throws std::invalid_argument with the message of the error
+	class Expression {
+	public:
+		explicit Expression(std::string_view text, const std::vector<std::string>& variables = {}, uint32_t flags = CALCULATOR_DEFAULT) {
+			std::vector<const char*> names;
+			for (const std::string& variable : variables) {
+				names.push_back(variable.c_str());
+			}
+
+			CalculatorError error;
+			expression = calculatorCompile(text.data(), text.size(), names.data(), names.size(), flags, &error);
+			if (expression == nullptr) {
+				throw std::invalid_argument(error.message);
+			}
+		}
+
+		Expression(const Expression&) = delete;
+		Expression& operator=(const Expression&) = delete;
+
+		Expression(Expression&& other) noexcept : expression(std::exchange(other.expression, nullptr)) {}
+
+		Expression& operator=(Expression&& other) noexcept {
+			std::swap(expression, other.expression);
+			return *this;
+		}
+
+		~Expression() {
+			calculatorFree(expression);
+		}
+
+		double evaluate(const double* bindings = nullptr) const {
+			return calculatorEvaluate(expression, bindings);
+		}
+
+		void evaluateBatch(const double* const* columns, double* out, size_t count) const {
+			calculatorEvaluateBatch(expression, columns, out, count);
+		}
+
+		size_t getVariableCount() const {
+			return calculatorGetVariableCount(expression);
+		}
+
+		const char* getVariableName(size_t slot) const {
+			return calculatorGetVariableName(expression, slot);
+		}
+
+		CalculatorExpression* get() const {
+			return expression;
+		}
+
+	private:
+		CalculatorExpression* expression = nullptr;
+	};
+
+}
+#endif
+
+#endif
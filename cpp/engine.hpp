@@ -0,0 +1,6663 @@
+/*
+ * The whole calculator without its command line: the parser, the tokens, the optimizer and every engine.
+ * The calculator, the benchmark and the library are single translation units that include it once, so the
+ * compiler sees all of the code of the hot paths at once. Programs that embed the calculator use the stable
+ * API of calculator.h instead, the library doesn't export anything of this file.
+ */
+
+#pragma once
+
+#include<iostream>
+#include<string>
+#include<string_view>
+#include<memory>
+#include<stdexcept>
+#include<cctype>
+#include<cmath>
+#include<iomanip>
+#include<limits>
+#include<vector>
+#include<cstdint>
+#include<algorithm>
+#include<new>
+#include<utility>
+#include<list>
+#include<unordered_map>
+#include<unordered_set>
+#include<cstdio>
+#include<cstring>
+#include<charconv>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<atomic>
+#include<deque>
+#include<functional>
+#include<array>
+#include<chrono>
+#include<iterator>
+#include<cstdlib>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CALCULATOR_HAS_MMAP
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
+#endif
+
+// The native code generator emits x86-64 code for the System V calling convention, the rest of targets use the bytecode
+#if defined(CALCULATOR_HAS_MMAP) && defined(__x86_64__) && !defined(_WIN32)
+#define CALCULATOR_HAS_JIT
+#endif
+
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include<immintrin.h>
+#elif defined(__ARM_NEON)
+#include<arm_neon.h>
+#endif
+
+// The engine is calculator::engine in the programs that compile it in. The library gives all of it internal linkage
+// instead, so the functions of calculator.h are the only symbols it exports and it can be linked into those programs
+#ifdef CALCULATOR_BUILDING_LIBRARY
+namespace {
+#else
+namespace calculator::engine {
+#endif
+
+// Operations
+
+enum class Operation {
+	NONE = 0,
+	SUM,
+	MIN,
+	MUL,
+	DIV,
+	POW,
+	NEG, // Unary minus, only uses the a member of the OperationToken
+
+	// Specialized powers created by the optimizer when the exponent is a constant
+	POWI, // Integer exponent, b is always a NumberToken
+	SQRT, // x^0.5, unary
+	CBRT, // x^(1/3), unary
+
+	// Functions, written as calls like min(a, b)
+	MINIMUM,
+	MAXIMUM,
+	ABS, // Unary
+	IF, // if(a, b, c) is b when a isn't 0 and c otherwise, only the branch taken is evaluated
+	SIN, // Unary, the elementary functions are lowered to the C library ones or to the fast ones
+	COS,
+	EXP,
+	LOG,
+};
+
+// The same results as the minsd and maxsd instructions, when any of them is NaN the result is the second one
+constexpr double minimumOf(double a, double b) {
+	return a < b ? a : b;
+}
+
+constexpr double maximumOf(double a, double b) {
+	return a > b ? a : b;
+}
+
+// The functions of the C library, or their fast approximations
+constexpr bool isElementary(Operation operation) {
+	return operation == Operation::SIN || operation == Operation::COS || operation == Operation::EXP || operation == Operation::LOG;
+}
+
+// NaN is true, as it is for the comparisons with 0 of the native code
+constexpr bool isTrue(double condition) {
+	return condition != 0;
+}
+
+constexpr Operation getOperationFromChar(char c) {
+	switch (c) {
+	case '+':
+		return Operation::SUM;
+	case '-':
+		return Operation::MIN;
+	case '*':
+		return Operation::MUL;
+	case '/':
+		return Operation::DIV;
+	case '^':
+		return Operation::POW;
+	}
+	return Operation::NONE;
+}
+
+constexpr int MIN_PRIORITY = 1;
+constexpr int MAX_PRIORITY = 3;
+
+constexpr int getPriority(Operation operation) {
+	switch (operation) {
+	case Operation::SUM:
+	case Operation::MIN:
+		return 1;
+	case Operation::MUL:
+	case Operation::DIV:
+		return 2;
+	case Operation::POW:
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+// Statistics
+
+// Counters and latency histograms of the hot paths, reported by --stats. They are only recorded once they are enabled,
+// and building with CALCULATOR_STATS=0 removes them completely
+#ifndef CALCULATOR_STATS
+#define CALCULATOR_STATS 1
+#endif
+
+constexpr bool STATISTICS_COMPILED = CALCULATOR_STATS != 0;
+
+bool statisticsEnabled = false; // Only set before any thread starts
+
+enum class Counter {
+	COMPILATIONS = 0,
+	COMPILE_ERRORS,
+	TOKENS_CREATED,
+	ELIMINATED_NODES,
+	RESOLVE_CALLS,
+	EVALUATIONS,
+	BATCH_ROWS,
+	CACHE_HITS,
+	CACHE_MISSES,
+	NATIVE_COMPILATIONS,
+	SERVER_REQUESTS,
+	COUNT
+};
+
+constexpr const char* COUNTER_NAMES[] = {
+	"Compilations",
+	"Compile errors",
+	"Tokens created",
+	"Eliminated nodes",
+	"Resolve calls",
+	"Evaluations",
+	"Batch rows",
+	"Cache hits",
+	"Cache misses",
+	"Native compiles",
+	"Server requests",
+};
+
+enum class Timer {
+	COMPILE = 0, // The whole compilation, parse, optimize and bytecode
+	EVALUATE, // One evaluation of a compiled expression
+	LINE, // One line of the batch mode, from the cache lookup to the result
+	REQUEST, // One request of the server, from its frame to its reply
+	COUNT
+};
+
+constexpr const char* TIMER_NAMES[] = {
+	"Compile",
+	"Evaluate",
+	"Batch line",
+	"Request",
+};
+
+// Histogram of nanoseconds with 16 buckets for every power of two, so the percentiles are within a 6% of the real ones
+class LatencyHistogram {
+public:
+	void record(uint64_t nanoseconds) {
+		buckets[getBucket(nanoseconds)]++;
+		count++;
+		total += nanoseconds;
+		maximum = std::max(maximum, nanoseconds);
+	}
+
+	void merge(const LatencyHistogram& other) {
+		for (size_t i = 0; i < BUCKET_COUNT; i++) {
+			buckets[i] += other.buckets[i];
+		}
+		count += other.count;
+		total += other.total;
+		maximum = std::max(maximum, other.maximum);
+	}
+
+	// The upper bound of the bucket that has the percentile, between 0 and 1
+	uint64_t getPercentile(double percentile) const {
+		uint64_t target = static_cast<uint64_t>(std::ceil(percentile * count));
+		uint64_t seen = 0;
+
+		for (size_t i = 0; i < BUCKET_COUNT; i++) {
+			seen += buckets[i];
+			if (seen >= std::max<uint64_t>(target, 1)) {
+				return std::min(getBucketEnd(i), maximum);
+			}
+		}
+		return maximum;
+	}
+
+	uint64_t getCount() const {
+		return count;
+	}
+
+	double getMean() const {
+		return count == 0 ? 0 : double(total) / count;
+	}
+
+	uint64_t getMaximum() const {
+		return maximum;
+	}
+
+private:
+	static constexpr size_t SUB_BUCKETS = 16;
+	static constexpr size_t BUCKET_COUNT = 61 * SUB_BUCKETS;
+
+	std::array<uint64_t, BUCKET_COUNT> buckets{};
+	uint64_t count = 0, total = 0, maximum = 0;
+
+	// The values below 16 have their own bucket, the rest are split by their highest bit and the 4 bits after it
+	static size_t getBucket(uint64_t value) {
+		if (value < SUB_BUCKETS) {
+			return value;
+		}
+
+		int shift = 0; // Makes the value between 16 and 31
+		while ((value >> shift) >= SUB_BUCKETS * 2) {
+			shift++;
+		}
+		return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+	}
+
+	static uint64_t getBucketEnd(size_t bucket) {
+		if (bucket < SUB_BUCKETS) {
+			return bucket;
+		}
+
+		int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+		uint64_t start = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+		return start + (uint64_t(1) << shift) - 1;
+	}
+};
+
+// Every thread records in its own statistics so the hot paths don't share any cache line, they are added up at the end
+struct ThreadStatistics {
+	std::array<uint64_t, static_cast<size_t>(Counter::COUNT)> counters{};
+	std::array<LatencyHistogram, static_cast<size_t>(Timer::COUNT)> timers;
+	size_t maxParseDepth = 0; // Largest stack of pending operators and parentheses of the parser
+};
+
+// The statistics of the threads are kept after the threads end, so the report has the work of all of them
+struct StatisticsRegistry {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ThreadStatistics>> threads;
+
+	static StatisticsRegistry& get() {
+		static StatisticsRegistry registry;
+		return registry;
+	}
+};
+
+ThreadStatistics& getThreadStatistics() {
+	thread_local ThreadStatistics* statistics = [] {
+		StatisticsRegistry& registry = StatisticsRegistry::get();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+
+		registry.threads.push_back(std::make_unique<ThreadStatistics>());
+		return registry.threads.back().get();
+	}();
+	return *statistics;
+}
+
+inline void countEvent(Counter counter, uint64_t amount = 1) {
+	if constexpr (STATISTICS_COMPILED) {
+		if (statisticsEnabled) {
+			getThreadStatistics().counters[static_cast<size_t>(counter)] += amount;
+		}
+	}
+}
+
+inline void recordParseDepth(size_t depth) {
+	if constexpr (STATISTICS_COMPILED) {
+		if (statisticsEnabled) {
+			ThreadStatistics& statistics = getThreadStatistics();
+			statistics.maxParseDepth = std::max(statistics.maxParseDepth, depth);
+		}
+	}
+}
+
+// Records the time from its creation to its destruction in the histogram of the timer
+class ScopedTimer {
+public:
+	explicit ScopedTimer(Timer timer) {
+		if constexpr (STATISTICS_COMPILED) {
+			if (statisticsEnabled) {
+				histogram = &getThreadStatistics().timers[static_cast<size_t>(timer)];
+				start = std::chrono::steady_clock::now();
+			}
+		}
+		else {
+			(void) timer;
+		}
+	}
+
+	~ScopedTimer() {
+		if constexpr (STATISTICS_COMPILED) {
+			if (histogram != nullptr) {
+				auto elapsed = std::chrono::steady_clock::now() - start;
+				histogram->record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+			}
+		}
+	}
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	LatencyHistogram* histogram = nullptr;
+	std::chrono::steady_clock::time_point start;
+};
+
+// Adds up the statistics of all the threads, only call it once the threads that record are done
+void printStatistics(FILE* output) {
+	StatisticsRegistry& registry = StatisticsRegistry::get();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	ThreadStatistics total;
+	for (const auto& thread : registry.threads) {
+		for (size_t i = 0; i < total.counters.size(); i++) {
+			total.counters[i] += thread->counters[i];
+		}
+		for (size_t i = 0; i < total.timers.size(); i++) {
+			total.timers[i].merge(thread->timers[i]);
+		}
+		total.maxParseDepth = std::max(total.maxParseDepth, thread->maxParseDepth);
+	}
+
+	std::fprintf(output, "Statistics of %zu threads:\n", registry.threads.size());
+	for (size_t i = 0; i < total.counters.size(); i++) {
+		std::fprintf(output, " %-16s %llu\n", COUNTER_NAMES[i], static_cast<unsigned long long>(total.counters[i]));
+	}
+	std::fprintf(output, " %-16s %zu\n", "Max parse depth", total.maxParseDepth);
+
+	std::fprintf(output, "Latency (ns)       count       mean        p50        p99       p999        max\n");
+	for (size_t i = 0; i < total.timers.size(); i++) {
+		const LatencyHistogram& histogram = total.timers[i];
+		std::fprintf(output, " %-12s %10llu %10.0f %10llu %10llu %10llu %10llu\n", TIMER_NAMES[i],
+			static_cast<unsigned long long>(histogram.getCount()), histogram.getMean(),
+			static_cast<unsigned long long>(histogram.getPercentile(0.5)),
+			static_cast<unsigned long long>(histogram.getPercentile(0.99)),
+			static_cast<unsigned long long>(histogram.getPercentile(0.999)),
+			static_cast<unsigned long long>(histogram.getMaximum()));
+	}
+	std::fflush(output);
+}
+
+// Memory
+
+// Bump allocator that owns all the tokens of one compiled expression, the tokens are placed one after the other
+// in a few large blocks and they are all released at once when the arena is destroyed without visiting the tree
+class TokenArena {
+public:
+	static constexpr size_t INITIAL_BLOCK_SIZE = 4 * 1024;
+	static constexpr size_t MAX_BLOCK_SIZE = 1024 * 1024;
+
+	TokenArena() = default;
+	TokenArena(const TokenArena&) = delete;
+	TokenArena& operator=(const TokenArena&) = delete;
+	TokenArena(TokenArena&&) = default;
+	TokenArena& operator=(TokenArena&&) = default;
+
+	void* allocate(size_t size, size_t alignment) {
+		uintptr_t address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+
+		if (cursor == nullptr || address + size > reinterpret_cast<uintptr_t>(end)) {
+			addBlock(size + alignment);
+			address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+		}
+
+		cursor = reinterpret_cast<char*>(address + size);
+		return reinterpret_cast<void*>(address);
+	}
+
+	// The destructors of the objects created in the arena are never called, so they must not own any other resource
+	template<typename T, typename... Args>
+	T* create(Args&&... args) {
+		return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	size_t getBlockCount() const {
+		return blocks.size();
+	}
+
+	// Releases everything but keeps the last block, the largest one, to reuse it without allocating again
+	void reset() {
+		if (blocks.empty()) {
+			return;
+		}
+
+		blocks.erase(blocks.begin(), blocks.end() - 1);
+		cursor = blocks.back().get();
+	}
+
+private:
+	std::vector<std::unique_ptr<char[]>> blocks;
+	char* cursor = nullptr;
+	char* end = nullptr;
+	size_t nextBlockSize = INITIAL_BLOCK_SIZE;
+
+	void addBlock(size_t minimumSize) {
+		size_t size = std::max(nextBlockSize, minimumSize);
+		nextBlockSize = std::min(nextBlockSize * 2, MAX_BLOCK_SIZE);
+
+		blocks.push_back(std::unique_ptr<char[]>(new char[size])); // Not value initialized, the tokens are constructed on it
+		cursor = blocks.back().get();
+		end = cursor + size;
+	}
+};
+
+// Powers
+
+// Largest integer exponent resolved by repeated multiplication with FAST precision, bigger ones accumulate too much
+// rounding error
+constexpr int MAX_INTEGER_EXPONENT = 64;
+
+// Exponentiation by squaring, takes log2(exponent) multiplications instead of a call to std::pow
+constexpr double integerPower(double base, int exponent) {
+	unsigned int n = exponent < 0 ? -static_cast<unsigned int>(exponent) : exponent;
+	double result = 1;
+
+	while (n != 0) {
+		if (n & 1) {
+			result *= base;
+		}
+		base *= base;
+		n >>= 1;
+	}
+
+	return exponent < 0 ? 1 / result : result;
+}
+
+// Elementary functions
+
+// Every engine calls the C library for sin, cos, exp and log unless the expression is compiled with FAST precision,
+// then they run the polynomial approximations below. They are only basic arithmetic and bit operations on vectors,
+// so the batch engine runs them on whole blocks, and the rest of engines run them on one lane of the same vector,
+// so all of them get the same bits whatever the compiler fuses into multiply-adds.
+// Largest error measured against the long double functions of the C library over millions of arguments:
+//   sin, cos  1.5 ulp for |x| < 1000, 2.4 ulp up to FAST_TRIGONOMETRIC_LIMIT ~ 1.6e6, beyond it they call the C library
+//   exp       1.2 ulp, also for the subnormal results
+//   log       0.9 ulp, also for the subnormal arguments
+// The special values give the same results as the C library: NaN, inf, 0 and -0, and the negative numbers of log.
+// With AVX and wider vectors the batch engine runs them 4-5 times faster than the C library, one lane at a time
+// they are about as fast or slower
+enum class Precision : uint8_t {
+	STRICT,
+	FAST,
+};
+
+// If x^n with a constant n is computed by integerPower. Every multiplication of it rounds, and the reciprocal of the
+// negative exponents loses the subnormal results: 1e5^-64 is 0 instead of about 1e-320. So STRICT only takes x^-1,
+// x^0, x^1 and x^2, which round once at most so they are the correctly rounded power, and FAST all the exponents up
+// to MAX_INTEGER_EXPONENT
+constexpr bool isIntegerPower(double exponent, Precision precision) {
+	if (precision == Precision::STRICT) {
+		return exponent == -1 || exponent == 0 || exponent == 1 || exponent == 2;
+	}
+	// Only cast once it fits in an int, the cast of a larger exponent or NaN isn't defined
+	return exponent >= -MAX_INTEGER_EXPONENT && exponent <= MAX_INTEGER_EXPONENT && exponent == static_cast<int>(exponent);
+}
+
+inline uint64_t toBits(double value) {
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+inline double fromBits(uint64_t bits) {
+	double value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Widest vector of doubles available for the target the program is compiled for. Besides the arithmetic it has the
+// bit operations of the fast functions, the masks of the comparisons have all the bits set where they are true
+#if defined(__AVX512F__)
+struct SimdDouble {
+	static constexpr size_t WIDTH = 8;
+	__m512d value;
+
+	static SimdDouble load(const double* p) { return { _mm512_loadu_pd(p) }; }
+	static SimdDouble broadcast(double value) { return { _mm512_set1_pd(value) }; }
+	void store(double* p) const { _mm512_storeu_pd(p, value); }
+	double first() const { return _mm512_cvtsd_f64(value); }
+
+	friend SimdDouble operator+(SimdDouble a, SimdDouble b) { return { _mm512_add_pd(a.value, b.value) }; }
+	friend SimdDouble operator-(SimdDouble a, SimdDouble b) { return { _mm512_sub_pd(a.value, b.value) }; }
+	friend SimdDouble operator*(SimdDouble a, SimdDouble b) { return { _mm512_mul_pd(a.value, b.value) }; }
+	friend SimdDouble operator/(SimdDouble a, SimdDouble b) { return { _mm512_div_pd(a.value, b.value) }; }
+	friend SimdDouble operator-(SimdDouble a) { return { _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a.value), _mm512_castpd_si512(_mm512_set1_pd(-0.0)))) }; }
+	friend SimdDouble sqrt(SimdDouble a) { return { _mm512_sqrt_pd(a.value) }; }
+
+	friend SimdDouble minimumOf(SimdDouble a, SimdDouble b) { return { _mm512_min_pd(a.value, b.value) }; }
+	friend SimdDouble maximumOf(SimdDouble a, SimdDouble b) { return { _mm512_max_pd(a.value, b.value) }; }
+	friend SimdDouble andBits(SimdDouble a, SimdDouble b) { return { _mm512_castsi512_pd(_mm512_and_si512(_mm512_castpd_si512(a.value), _mm512_castpd_si512(b.value))) }; }
+	friend SimdDouble orBits(SimdDouble a, SimdDouble b) { return { _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(a.value), _mm512_castpd_si512(b.value))) }; }
+	friend SimdDouble xorBits(SimdDouble a, SimdDouble b) { return { _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a.value), _mm512_castpd_si512(b.value))) }; }
+	friend SimdDouble shiftLeft(SimdDouble a, int bits) { return { _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_castpd_si512(a.value), bits)) }; }
+	friend SimdDouble shiftRight(SimdDouble a, int bits) { return { _mm512_castsi512_pd(_mm512_srli_epi64(_mm512_castpd_si512(a.value), bits)) }; }
+	friend SimdDouble lessMask(SimdDouble a, SimdDouble b) { return { _mm512_castsi512_pd(_mm512_maskz_set1_epi64(_mm512_cmp_pd_mask(a.value, b.value, _CMP_LT_OQ), -1)) }; }
+	friend SimdDouble equalMask(SimdDouble a, SimdDouble b) { return { _mm512_castsi512_pd(_mm512_maskz_set1_epi64(_mm512_cmp_pd_mask(a.value, b.value, _CMP_EQ_OQ), -1)) }; }
+	friend SimdDouble blend(SimdDouble mask, SimdDouble a, SimdDouble b) { return orBits(andBits(mask, a), { _mm512_castsi512_pd(_mm512_andnot_si512(_mm512_castpd_si512(mask.value), _mm512_castpd_si512(b.value))) }); }
+};
+#elif defined(__AVX__)
+struct SimdDouble {
+	static constexpr size_t WIDTH = 4;
+	__m256d value;
+
+	static SimdDouble load(const double* p) { return { _mm256_loadu_pd(p) }; }
+	static SimdDouble broadcast(double value) { return { _mm256_set1_pd(value) }; }
+	void store(double* p) const { _mm256_storeu_pd(p, value); }
+	double first() const { return _mm256_cvtsd_f64(value); }
+
+	friend SimdDouble operator+(SimdDouble a, SimdDouble b) { return { _mm256_add_pd(a.value, b.value) }; }
+	friend SimdDouble operator-(SimdDouble a, SimdDouble b) { return { _mm256_sub_pd(a.value, b.value) }; }
+	friend SimdDouble operator*(SimdDouble a, SimdDouble b) { return { _mm256_mul_pd(a.value, b.value) }; }
+	friend SimdDouble operator/(SimdDouble a, SimdDouble b) { return { _mm256_div_pd(a.value, b.value) }; }
+	friend SimdDouble operator-(SimdDouble a) { return { _mm256_xor_pd(a.value, _mm256_set1_pd(-0.0)) }; }
+	friend SimdDouble sqrt(SimdDouble a) { return { _mm256_sqrt_pd(a.value) }; }
+
+	friend SimdDouble minimumOf(SimdDouble a, SimdDouble b) { return { _mm256_min_pd(a.value, b.value) }; }
+	friend SimdDouble maximumOf(SimdDouble a, SimdDouble b) { return { _mm256_max_pd(a.value, b.value) }; }
+	friend SimdDouble andBits(SimdDouble a, SimdDouble b) { return { _mm256_and_pd(a.value, b.value) }; }
+	friend SimdDouble orBits(SimdDouble a, SimdDouble b) { return { _mm256_or_pd(a.value, b.value) }; }
+	friend SimdDouble xorBits(SimdDouble a, SimdDouble b) { return { _mm256_xor_pd(a.value, b.value) }; }
+#if defined(__AVX2__)
+	friend SimdDouble shiftLeft(SimdDouble a, int bits) { return { _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_castpd_si256(a.value), bits)) }; }
+	friend SimdDouble shiftRight(SimdDouble a, int bits) { return { _mm256_castsi256_pd(_mm256_srli_epi64(_mm256_castpd_si256(a.value), bits)) }; }
+#else
+	// AVX has no integer shifts of 256 bits, each half is shifted on its own
+	friend SimdDouble shiftLeft(SimdDouble a, int bits) {
+		__m128i low = _mm_slli_epi64(_mm_castpd_si128(_mm256_castpd256_pd128(a.value)), bits);
+		__m128i high = _mm_slli_epi64(_mm_castpd_si128(_mm256_extractf128_pd(a.value, 1)), bits);
+		return { _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_castsi128_pd(low)), _mm_castsi128_pd(high), 1) };
+	}
+	friend SimdDouble shiftRight(SimdDouble a, int bits) {
+		__m128i low = _mm_srli_epi64(_mm_castpd_si128(_mm256_castpd256_pd128(a.value)), bits);
+		__m128i high = _mm_srli_epi64(_mm_castpd_si128(_mm256_extractf128_pd(a.value, 1)), bits);
+		return { _mm256_insertf128_pd(_mm256_castpd128_pd256(_mm_castsi128_pd(low)), _mm_castsi128_pd(high), 1) };
+	}
+#endif
+	friend SimdDouble lessMask(SimdDouble a, SimdDouble b) { return { _mm256_cmp_pd(a.value, b.value, _CMP_LT_OQ) }; }
+	friend SimdDouble equalMask(SimdDouble a, SimdDouble b) { return { _mm256_cmp_pd(a.value, b.value, _CMP_EQ_OQ) }; }
+	friend SimdDouble blend(SimdDouble mask, SimdDouble a, SimdDouble b) { return { _mm256_blendv_pd(b.value, a.value, mask.value) }; }
+};
+#elif defined(__SSE2__) || defined(_M_X64)
+struct SimdDouble {
+	static constexpr size_t WIDTH = 2;
+	__m128d value;
+
+	static SimdDouble load(const double* p) { return { _mm_loadu_pd(p) }; }
+	static SimdDouble broadcast(double value) { return { _mm_set1_pd(value) }; }
+	void store(double* p) const { _mm_storeu_pd(p, value); }
+	double first() const { return _mm_cvtsd_f64(value); }
+
+	friend SimdDouble operator+(SimdDouble a, SimdDouble b) { return { _mm_add_pd(a.value, b.value) }; }
+	friend SimdDouble operator-(SimdDouble a, SimdDouble b) { return { _mm_sub_pd(a.value, b.value) }; }
+	friend SimdDouble operator*(SimdDouble a, SimdDouble b) { return { _mm_mul_pd(a.value, b.value) }; }
+	friend SimdDouble operator/(SimdDouble a, SimdDouble b) { return { _mm_div_pd(a.value, b.value) }; }
+	friend SimdDouble operator-(SimdDouble a) { return { _mm_xor_pd(a.value, _mm_set1_pd(-0.0)) }; }
+	friend SimdDouble sqrt(SimdDouble a) { return { _mm_sqrt_pd(a.value) }; }
+
+	friend SimdDouble minimumOf(SimdDouble a, SimdDouble b) { return { _mm_min_pd(a.value, b.value) }; }
+	friend SimdDouble maximumOf(SimdDouble a, SimdDouble b) { return { _mm_max_pd(a.value, b.value) }; }
+	friend SimdDouble andBits(SimdDouble a, SimdDouble b) { return { _mm_and_pd(a.value, b.value) }; }
+	friend SimdDouble orBits(SimdDouble a, SimdDouble b) { return { _mm_or_pd(a.value, b.value) }; }
+	friend SimdDouble xorBits(SimdDouble a, SimdDouble b) { return { _mm_xor_pd(a.value, b.value) }; }
+	friend SimdDouble shiftLeft(SimdDouble a, int bits) { return { _mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(a.value), bits)) }; }
+	friend SimdDouble shiftRight(SimdDouble a, int bits) { return { _mm_castsi128_pd(_mm_srli_epi64(_mm_castpd_si128(a.value), bits)) }; }
+	friend SimdDouble lessMask(SimdDouble a, SimdDouble b) { return { _mm_cmplt_pd(a.value, b.value) }; }
+	friend SimdDouble equalMask(SimdDouble a, SimdDouble b) { return { _mm_cmpeq_pd(a.value, b.value) }; }
+	friend SimdDouble blend(SimdDouble mask, SimdDouble a, SimdDouble b) { return { _mm_or_pd(_mm_and_pd(mask.value, a.value), _mm_andnot_pd(mask.value, b.value)) }; }
+};
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+struct SimdDouble {
+	static constexpr size_t WIDTH = 2;
+	float64x2_t value;
+
+	static SimdDouble load(const double* p) { return { vld1q_f64(p) }; }
+	static SimdDouble broadcast(double value) { return { vdupq_n_f64(value) }; }
+	void store(double* p) const { vst1q_f64(p, value); }
+	double first() const { return vgetq_lane_f64(value, 0); }
+
+	friend SimdDouble operator+(SimdDouble a, SimdDouble b) { return { vaddq_f64(a.value, b.value) }; }
+	friend SimdDouble operator-(SimdDouble a, SimdDouble b) { return { vsubq_f64(a.value, b.value) }; }
+	friend SimdDouble operator*(SimdDouble a, SimdDouble b) { return { vmulq_f64(a.value, b.value) }; }
+	friend SimdDouble operator/(SimdDouble a, SimdDouble b) { return { vdivq_f64(a.value, b.value) }; }
+	friend SimdDouble operator-(SimdDouble a) { return { vnegq_f64(a.value) }; }
+	friend SimdDouble sqrt(SimdDouble a) { return { vsqrtq_f64(a.value) }; }
+
+	// vminq_f64 and vmaxq_f64 return NaN when any of them is NaN, these return the second one as the x86 instructions
+	friend SimdDouble minimumOf(SimdDouble a, SimdDouble b) { return { vbslq_f64(vcltq_f64(a.value, b.value), a.value, b.value) }; }
+	friend SimdDouble maximumOf(SimdDouble a, SimdDouble b) { return { vbslq_f64(vcgtq_f64(a.value, b.value), a.value, b.value) }; }
+	friend SimdDouble andBits(SimdDouble a, SimdDouble b) { return { vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(a.value), vreinterpretq_u64_f64(b.value))) }; }
+	friend SimdDouble orBits(SimdDouble a, SimdDouble b) { return { vreinterpretq_f64_u64(vorrq_u64(vreinterpretq_u64_f64(a.value), vreinterpretq_u64_f64(b.value))) }; }
+	friend SimdDouble xorBits(SimdDouble a, SimdDouble b) { return { vreinterpretq_f64_u64(veorq_u64(vreinterpretq_u64_f64(a.value), vreinterpretq_u64_f64(b.value))) }; }
+	friend SimdDouble shiftLeft(SimdDouble a, int bits) { return { vreinterpretq_f64_u64(vshlq_u64(vreinterpretq_u64_f64(a.value), vdupq_n_s64(bits))) }; }
+	friend SimdDouble shiftRight(SimdDouble a, int bits) { return { vreinterpretq_f64_u64(vshlq_u64(vreinterpretq_u64_f64(a.value), vdupq_n_s64(-bits))) }; }
+	friend SimdDouble lessMask(SimdDouble a, SimdDouble b) { return { vreinterpretq_f64_u64(vcltq_f64(a.value, b.value)) }; }
+	friend SimdDouble equalMask(SimdDouble a, SimdDouble b) { return { vreinterpretq_f64_u64(vceqq_f64(a.value, b.value)) }; }
+	friend SimdDouble blend(SimdDouble mask, SimdDouble a, SimdDouble b) { return { vbslq_f64(vreinterpretq_u64_f64(mask.value), a.value, b.value) }; }
+};
+#else
+struct SimdDouble {
+	static constexpr size_t WIDTH = 1;
+	double value;
+
+	static SimdDouble load(const double* p) { return { *p }; }
+	static SimdDouble broadcast(double value) { return { value }; }
+	void store(double* p) const { *p = value; }
+	double first() const { return value; }
+
+	friend SimdDouble operator+(SimdDouble a, SimdDouble b) { return { a.value + b.value }; }
+	friend SimdDouble operator-(SimdDouble a, SimdDouble b) { return { a.value - b.value }; }
+	friend SimdDouble operator*(SimdDouble a, SimdDouble b) { return { a.value * b.value }; }
+	friend SimdDouble operator/(SimdDouble a, SimdDouble b) { return { a.value / b.value }; }
+	friend SimdDouble operator-(SimdDouble a) { return { -a.value }; }
+	friend SimdDouble sqrt(SimdDouble a) { return { std::sqrt(a.value) }; }
+
+	friend SimdDouble minimumOf(SimdDouble a, SimdDouble b) { return { minimumOf(a.value, b.value) }; }
+	friend SimdDouble maximumOf(SimdDouble a, SimdDouble b) { return { maximumOf(a.value, b.value) }; }
+	friend SimdDouble andBits(SimdDouble a, SimdDouble b) { return { fromBits(toBits(a.value) & toBits(b.value)) }; }
+	friend SimdDouble orBits(SimdDouble a, SimdDouble b) { return { fromBits(toBits(a.value) | toBits(b.value)) }; }
+	friend SimdDouble xorBits(SimdDouble a, SimdDouble b) { return { fromBits(toBits(a.value) ^ toBits(b.value)) }; }
+	friend SimdDouble shiftLeft(SimdDouble a, int bits) { return { fromBits(toBits(a.value) << bits) }; }
+	friend SimdDouble shiftRight(SimdDouble a, int bits) { return { fromBits(toBits(a.value) >> bits) }; }
+	friend SimdDouble lessMask(SimdDouble a, SimdDouble b) { return { fromBits(a.value < b.value ? ~uint64_t(0) : 0) }; }
+	friend SimdDouble equalMask(SimdDouble a, SimdDouble b) { return { fromBits(a.value == b.value ? ~uint64_t(0) : 0) }; }
+	friend SimdDouble blend(SimdDouble mask, SimdDouble a, SimdDouble b) { return toBits(mask.value) != 0 ? a : b; }
+};
+#endif
+
+// Adding it rounds to an integer, which is left in the low bits of the mantissa of the sum
+constexpr double ROUNDING = 0x1.8p52;
+constexpr double LN2_HIGH = 6.93147180369123816490e-01; // Only the high 32 bits are set, so its products by the exponents are exact
+constexpr double LN2_LOW = 1.90821492927058770002e-10;
+constexpr double FAST_TRIGONOMETRIC_LIMIT = 0x1p20 * 1.57079632679489661923;
+
+// 2^n for an integer n with a normal result
+SimdDouble powerOfTwo(SimdDouble n) {
+	return shiftLeft(n + SimdDouble::broadcast(ROUNDING + 1023), 52);
+}
+
+// x = k ln2 + r with |r| <= ln2/2, e^r by its Taylor polynomial and 2^k as two powers of two, so the results that
+// overflow or are subnormal are only rounded by the last product
+inline SimdDouble fastExp(SimdDouble x) {
+	x = minimumOf(SimdDouble::broadcast(710), maximumOf(SimdDouble::broadcast(-746), x)); // Still 0 and inf, and NaN stays NaN
+	SimdDouble k = (x * SimdDouble::broadcast(1 / 0.69314718055994530942) + SimdDouble::broadcast(ROUNDING)) - SimdDouble::broadcast(ROUNDING);
+	SimdDouble r = (x - k * SimdDouble::broadcast(LN2_HIGH)) - k * SimdDouble::broadcast(LN2_LOW);
+
+	SimdDouble p = SimdDouble::broadcast(1.0 / 6227020800);
+	p = p * r + SimdDouble::broadcast(1.0 / 479001600);
+	p = p * r + SimdDouble::broadcast(1.0 / 39916800);
+	p = p * r + SimdDouble::broadcast(1.0 / 3628800);
+	p = p * r + SimdDouble::broadcast(1.0 / 362880);
+	p = p * r + SimdDouble::broadcast(1.0 / 40320);
+	p = p * r + SimdDouble::broadcast(1.0 / 5040);
+	p = p * r + SimdDouble::broadcast(1.0 / 720);
+	p = p * r + SimdDouble::broadcast(1.0 / 120);
+	p = p * r + SimdDouble::broadcast(1.0 / 24);
+	p = p * r + SimdDouble::broadcast(1.0 / 6);
+	p = p * r + SimdDouble::broadcast(0.5);
+	p = p * r + SimdDouble::broadcast(1);
+	p = p * r + SimdDouble::broadcast(1);
+
+	SimdDouble half = (k * SimdDouble::broadcast(0.5) + SimdDouble::broadcast(ROUNDING)) - SimdDouble::broadcast(ROUNDING);
+	return p * powerOfTwo(half) * powerOfTwo(k - half);
+}
+
+// x = m 2^e with sqrt(2)/2 <= m < sqrt(2), log(m) as the series of atanh(s) with s = (m - 1) / (m + 1). The
+// coefficients are the minimax ones of fdlibm
+inline SimdDouble fastLog(SimdDouble x) {
+	SimdDouble input = x;
+
+	// The subnormals are scaled into normal numbers first
+	SimdDouble subnormal = lessMask(x, SimdDouble::broadcast(std::numeric_limits<double>::min()));
+	x = blend(subnormal, x * SimdDouble::broadcast(0x1p54), x);
+
+	SimdDouble exponent = orBits(shiftRight(x, 52), SimdDouble::broadcast(0x1p52)) - blend(subnormal, SimdDouble::broadcast(0x1p52 + 1023 + 54), SimdDouble::broadcast(0x1p52 + 1023));
+	SimdDouble m = orBits(andBits(x, SimdDouble::broadcast(fromBits(0x000FFFFFFFFFFFFF))), SimdDouble::broadcast(1));
+
+	SimdDouble large = lessMask(SimdDouble::broadcast(1.41421356237309504880), m);
+	m = blend(large, m * SimdDouble::broadcast(0.5), m);
+	exponent = exponent + andBits(large, SimdDouble::broadcast(1));
+
+	SimdDouble f = m - SimdDouble::broadcast(1);
+	SimdDouble s = f / (SimdDouble::broadcast(2) + f);
+	SimdDouble z = s * s;
+	SimdDouble r = SimdDouble::broadcast(1.479819860511658591e-01);
+	r = r * z + SimdDouble::broadcast(1.531383769920937332e-01);
+	r = r * z + SimdDouble::broadcast(1.818357216161805012e-01);
+	r = r * z + SimdDouble::broadcast(2.222219843214978396e-01);
+	r = r * z + SimdDouble::broadcast(2.857142874366239149e-01);
+	r = r * z + SimdDouble::broadcast(3.999999999940941908e-01);
+	r = r * z + SimdDouble::broadcast(6.666666666666735130e-01);
+	r = r * z;
+
+	SimdDouble halfSquare = SimdDouble::broadcast(0.5) * f * f;
+	SimdDouble result = exponent * SimdDouble::broadcast(LN2_HIGH) - ((halfSquare - (s * (halfSquare + r) + exponent * SimdDouble::broadcast(LN2_LOW))) - f);
+
+	const double infinity = std::numeric_limits<double>::infinity();
+	result = blend(lessMask(input, SimdDouble::broadcast(0)), SimdDouble::broadcast(std::numeric_limits<double>::quiet_NaN()), result);
+	result = blend(equalMask(input, SimdDouble::broadcast(0)), SimdDouble::broadcast(-infinity), result);
+	result = blend(equalMask(input, SimdDouble::broadcast(infinity)), input, result);
+	return blend(equalMask(input, input), result, input);
+}
+
+// x = r + k pi/2 with |r| <= pi/4, the three parts of pi/2 have products by k that are exact for |k| < 2^20. The
+// quadrant k picks sin(r) or cos(r) and their sign, the cosine is the sine of the next quadrant. The coefficients
+// are the minimax ones of fdlibm
+template<bool Cosine>
+inline SimdDouble fastSinCos(SimdDouble x) {
+	SimdDouble quadrant = x * SimdDouble::broadcast(0.63661977236758134308) + SimdDouble::broadcast(ROUNDING); // k is in the low bits of the mantissa
+	SimdDouble k = quadrant - SimdDouble::broadcast(ROUNDING);
+	SimdDouble r = ((x - k * SimdDouble::broadcast(1.57079632673412561417e+00)) - k * SimdDouble::broadcast(6.07710050630396597660e-11)) - k * SimdDouble::broadcast(2.02226624879595063154e-21);
+	if constexpr (Cosine) {
+		quadrant = quadrant + SimdDouble::broadcast(1);
+	}
+
+	SimdDouble z = r * r;
+	SimdDouble sine = SimdDouble::broadcast(1.58969099521155010221e-10);
+	sine = sine * z + SimdDouble::broadcast(-2.50507602534068634195e-08);
+	sine = sine * z + SimdDouble::broadcast(2.75573137070700676789e-06);
+	sine = sine * z + SimdDouble::broadcast(-1.98412698298579493134e-04);
+	sine = sine * z + SimdDouble::broadcast(8.33333333332248946124e-03);
+	sine = sine * z + SimdDouble::broadcast(-1.66666666666666324348e-01);
+	sine = orBits(r + r * z * sine, andBits(r, SimdDouble::broadcast(-0.0))); // Keeps the sign of -0, sin(r) has the sign of r
+
+	SimdDouble cosine = SimdDouble::broadcast(-1.13596475577881948265e-11);
+	cosine = cosine * z + SimdDouble::broadcast(2.08757232129817482790e-09);
+	cosine = cosine * z + SimdDouble::broadcast(-2.75573143513906633035e-07);
+	cosine = cosine * z + SimdDouble::broadcast(2.48015872894767294178e-05);
+	cosine = cosine * z + SimdDouble::broadcast(-1.38888888888741095749e-03);
+	cosine = cosine * z + SimdDouble::broadcast(4.16666666666666019037e-02);
+	SimdDouble halfSquare = SimdDouble::broadcast(0.5) * z;
+	SimdDouble w = SimdDouble::broadcast(1) - halfSquare;
+	cosine = w + (((SimdDouble::broadcast(1) - w) - halfSquare) + z * z * cosine);
+
+	// The bit 0 of the quadrant swaps them and the bit 1 is the sign
+	SimdDouble even = equalMask(andBits(shiftLeft(quadrant, 52), SimdDouble::broadcast(std::numeric_limits<double>::min())), SimdDouble::broadcast(0));
+	SimdDouble sign = andBits(shiftLeft(quadrant, 62), SimdDouble::broadcast(-0.0));
+	return xorBits(blend(even, sine, cosine), sign);
+}
+
+// The scalar versions, the arguments of sin and cos beyond the limit, inf and NaN use the C library
+inline double fastSin(double x) {
+	return std::fabs(x) < FAST_TRIGONOMETRIC_LIMIT ? fastSinCos<false>(SimdDouble::broadcast(x)).first() : std::sin(x);
+}
+
+inline double fastCos(double x) {
+	return std::fabs(x) < FAST_TRIGONOMETRIC_LIMIT ? fastSinCos<true>(SimdDouble::broadcast(x)).first() : std::cos(x);
+}
+
+inline double fastExp(double x) {
+	return fastExp(SimdDouble::broadcast(x)).first();
+}
+
+inline double fastLog(double x) {
+	return fastLog(SimdDouble::broadcast(x)).first();
+}
+
+// Tokens
+
+enum class TokenType {
+	NUMBER = 0,
+	VARIABLE,
+	OPERATION,
+};
+
+struct Token {
+	const TokenType type; // Lets the compiler passes walk the tree without virtual calls
+	bool inArena = false; // The memory of the token is owned by a TokenArena
+
+	Token(TokenType type) : type(type) {}
+
+	// Pure virtual function, resolving doesn't modify the tree so it can be evaluated many times
+	// The bindings are the values of the variables indexed by their slot, they can be null if there are no variables
+	virtual double resolve(const double* bindings = nullptr) const = 0;
+	virtual ~Token() {} // Virtual destructor
+};
+
+// Deletes the tokens allocated in the heap and leaves the ones owned by an arena for the arena
+struct TokenDeleter {
+	void operator()(Token* token) const {
+		if (!token->inArena) {
+			delete token;
+		}
+	}
+};
+
+using TokenPtr = std::unique_ptr<Token, TokenDeleter>;
+
+// Creates the tokens in the arena if there is one, or in the heap otherwise
+struct TokenFactory {
+	TokenArena* arena = nullptr;
+
+	template<typename T, typename... Args>
+	TokenPtr create(Args&&... args) {
+		countEvent(Counter::TOKENS_CREATED);
+
+		if (arena == nullptr) {
+			return TokenPtr(new T(std::forward<Args>(args)...));
+		}
+
+		T* token = arena->create<T>(std::forward<Args>(args)...);
+		token->inArena = true;
+		return TokenPtr(token);
+	}
+};
+
+struct NumberToken : Token {
+
+	double value;
+
+	NumberToken(double value) : Token(TokenType::NUMBER) {
+		this->value = value;
+	}
+
+	double resolve(const double*) const override {
+		return value;
+	}
+
+};
+
+struct VariableToken : Token {
+
+	size_t slot; // Index of the value of the variable in the bindings
+
+	VariableToken(size_t slot) : Token(TokenType::VARIABLE) {
+		this->slot = slot;
+	}
+
+	double resolve(const double* bindings) const override {
+		return bindings[slot];
+	}
+
+};
+
+// The value of b is ignored by the unary operations. IF chooses between its branches, so it isn't applied here
+double applyOperation(Operation operation, double aValue, double bValue) {
+	switch (operation) {
+	case Operation::SUM:
+		return aValue + bValue;
+	case Operation::MIN:
+		return aValue - bValue;
+	case Operation::MUL:
+		return aValue * bValue;
+	case Operation::DIV:
+		return aValue / bValue;
+	case Operation::POW:
+		return std::pow(aValue, bValue);
+	case Operation::NEG:
+		return -aValue;
+	case Operation::POWI:
+		return integerPower(aValue, static_cast<int>(bValue));
+	case Operation::SQRT:
+		return std::sqrt(aValue);
+	case Operation::CBRT:
+		return std::cbrt(aValue);
+	case Operation::MINIMUM:
+		return minimumOf(aValue, bValue);
+	case Operation::MAXIMUM:
+		return maximumOf(aValue, bValue);
+	case Operation::ABS:
+		return std::fabs(aValue);
+	case Operation::SIN:
+		return std::sin(aValue);
+	case Operation::COS:
+		return std::cos(aValue);
+	case Operation::EXP:
+		return std::exp(aValue);
+	case Operation::LOG:
+		return std::log(aValue);
+	default:
+		return 0;
+	}
+}
+
+struct OperationToken : Token {
+	Operation operation;
+
+	TokenPtr a, b; // b is null for the unary operations
+	TokenPtr c; // Only for IF, the else branch
+
+	OperationToken(Operation operation, TokenPtr a, TokenPtr b, TokenPtr c)
+		: Token(TokenType::OPERATION), operation(operation), a(std::move(a)), b(std::move(b)), c(std::move(c)) {}
+
+	OperationToken(Operation operation, TokenPtr a, TokenPtr b)
+		: Token(TokenType::OPERATION), operation(operation), a(std::move(a)), b(std::move(b)) {}
+
+	OperationToken(Operation operation, TokenPtr a)
+		: Token(TokenType::OPERATION), operation(operation), a(std::move(a)) {}
+
+	// The children are released one by one instead of recursively, so a very deep tree doesn't overflow the stack
+	~OperationToken() override {
+		std::vector<TokenPtr> pending;
+		takeChildren(*this, pending);
+
+		while (!pending.empty()) {
+			TokenPtr token = std::move(pending.back());
+			pending.pop_back();
+
+			if (token->type == TokenType::OPERATION && !token->inArena) {
+				takeChildren(static_cast<OperationToken&>(*token), pending);
+			}
+		}
+	}
+
+	double resolve(const double* bindings) const override;
+
+private:
+	static void takeChildren(OperationToken& token, std::vector<TokenPtr>& pending) {
+		if (token.a && token.a->type == TokenType::OPERATION) {
+			pending.push_back(std::move(token.a));
+		}
+		if (token.b && token.b->type == TokenType::OPERATION) {
+			pending.push_back(std::move(token.b));
+		}
+		if (token.c && token.c->type == TokenType::OPERATION) {
+			pending.push_back(std::move(token.c));
+		}
+	}
+};
+
+// Evaluates the tree in post order with explicit stacks instead of recursive calls, so the depth of the tree is only
+// limited by the memory. The stacks are reused by the thread between calls. The condition of an IF is evaluated
+// first and then only the branch it takes
+double resolveToken(const Token& root, const double* bindings) {
+	countEvent(Counter::RESOLVE_CALLS);
+
+	thread_local std::vector<std::pair<const Token*, bool>> pending; // The flag is set once the children are pushed
+	thread_local std::vector<double> values;
+
+	pending.clear();
+	values.clear();
+	pending.emplace_back(&root, false);
+
+	while (!pending.empty()) {
+		auto [token, expanded] = pending.back();
+		pending.pop_back();
+
+		switch (token->type) {
+		case TokenType::NUMBER:
+			values.push_back(static_cast<const NumberToken*>(token)->value);
+			break;
+		case TokenType::VARIABLE:
+			values.push_back(bindings[static_cast<const VariableToken*>(token)->slot]);
+			break;
+		case TokenType::OPERATION: {
+			const OperationToken* operation = static_cast<const OperationToken*>(token);
+
+			if (operation->operation == Operation::IF) {
+				if (!expanded) {
+					pending.emplace_back(token, true);
+					pending.emplace_back(operation->a.get(), false);
+				}
+				else {
+					// The value of the branch takes the place of the condition
+					bool condition = isTrue(values.back());
+					values.pop_back();
+					pending.emplace_back(condition ? operation->b.get() : operation->c.get(), false);
+				}
+				break;
+			}
+
+			if (!expanded) {
+				pending.emplace_back(token, true);
+				if (operation->b) {
+					pending.emplace_back(operation->b.get(), false);
+				}
+				pending.emplace_back(operation->a.get(), false);
+				break;
+			}
+
+			double bValue = 0;
+			if (operation->b) {
+				bValue = values.back();
+				values.pop_back();
+			}
+
+			values.back() = applyOperation(operation->operation, values.back(), bValue);
+			break;
+		}
+		}
+	}
+
+	return values.back();
+}
+
+double OperationToken::resolve(const double* bindings) const {
+	return resolveToken(*this, bindings);
+}
+
+// Parser
+
+constexpr double PI = 3.14159265358979323846;
+constexpr double E = 2.71828182845904523536;
+
+struct Constant {
+	std::string_view name;
+	double value;
+	std::string_view text; // Value written with all its digits for the help
+};
+
+// New constants are added to this table, they are looked up by comparing the length and the first character before the name
+constexpr Constant CONSTANTS[] = {
+	{ "pi", PI, "3.14159265358979323846" },
+	{ "e", E, "2.71828182845904523536" },
+};
+
+constexpr bool getConstant(std::string_view name, double& value) {
+	for (const Constant& constant : CONSTANTS) {
+		if (constant.name.size() == name.size() && constant.name[0] == name[0] && constant.name == name) {
+			value = constant.value;
+			return true;
+		}
+	}
+	return false;
+}
+
+struct Function {
+	std::string_view name;
+	Operation operation;
+	size_t arguments;
+	std::string_view description; // For the help
+};
+
+// A name is only a function when a '(' follows it, so the functions don't take these names from the variables
+constexpr Function FUNCTIONS[] = {
+	{ "min", Operation::MINIMUM, 2, "min(a, b)    smaller of a and b" },
+	{ "max", Operation::MAXIMUM, 2, "max(a, b)    larger of a and b" },
+	{ "abs", Operation::ABS, 1, "abs(a)       absolute value of a" },
+	{ "if", Operation::IF, 3, "if(c, a, b)  a when c isn't 0 and b otherwise, only the one taken is evaluated" },
+	{ "sqrt", Operation::SQRT, 1, "sqrt(a)      square root of a" },
+	{ "sin", Operation::SIN, 1, "sin(a)       sine of a in radians" },
+	{ "cos", Operation::COS, 1, "cos(a)       cosine of a in radians" },
+	{ "exp", Operation::EXP, 1, "exp(a)       e raised to a" },
+	{ "log", Operation::LOG, 1, "log(a)       natural logarithm of a" },
+};
+
+constexpr const Function* getFunction(std::string_view name) {
+	for (const Function& function : FUNCTIONS) {
+		if (function.name == name) {
+			return &function;
+		}
+	}
+	return nullptr;
+}
+
+// Parses a number literal straight from the expression without copying it, independent from the locale and without
+// throwing. Returns false if the literal isn't a valid number or it doesn't fit in a double
+bool parseNumber(std::string_view token, double& value) {
+	const char* end = token.data() + token.size();
+	auto result = std::from_chars(token.data(), end, value, std::chars_format::general);
+
+	return result.ec == std::errc() && result.ptr == end;
+}
+
+// The shortest text that parses back to the same double, so 0.1+0.2 is 0.30000000000000004 and 0.1 is 0.1
+void appendNumber(std::string& text, double value) {
+	char characters[32];
+	auto result = std::to_chars(characters, characters + sizeof(characters), value);
+	text.append(characters, result.ptr - characters);
+}
+
+// Names of the variables of an expression, the position of each name is the slot of its value in the bindings
+struct VariableTable {
+	std::vector<std::string> names;
+
+	static constexpr size_t NOT_FOUND = static_cast<size_t>(-1);
+
+	size_t find(std::string_view name) const {
+		for (size_t slot = 0; slot < names.size(); slot++) {
+			if (names[slot] == name) {
+				return slot;
+			}
+		}
+		return NOT_FOUND;
+	}
+
+	size_t getOrAdd(std::string_view name) {
+		size_t slot = find(name);
+		if (slot == NOT_FOUND) {
+			slot = names.size();
+			names.emplace_back(name);
+		}
+		return slot;
+	}
+
+	size_t size() const {
+		return names.size();
+	}
+};
+
+// Lexer
+
+enum class LexemeType {
+	END = 0,
+	NUMBER,
+	IDENTIFIER,
+	OPERATOR,
+	LEFT_PARENTHESIS,
+	RIGHT_PARENTHESIS,
+	COMMA,
+	UNKNOWN,
+};
+
+struct Lexeme {
+	LexemeType type = LexemeType::END;
+	std::string_view text;
+	size_t offset = 0;
+	Operation operation = Operation::NONE; // Only set for operators
+};
+
+// The same characters as std::isspace in the C locale, which isn't constexpr
+constexpr bool isSpace(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+constexpr bool isDigit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+constexpr bool isIdentifierStart(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+constexpr bool isIdentifierPart(char c) {
+	return isIdentifierStart(c) || isDigit(c);
+}
+
+// The lexer walks the expression only once, every lexeme is a view into the original expression.
+// It is constexpr so the compile time expressions go through the same lexer
+struct Lexer {
+	std::string_view expression;
+	size_t position = 0;
+
+	constexpr Lexer(std::string_view expression) : expression(expression) {}
+
+	constexpr Lexeme next() {
+		while (position < expression.size() && isSpace(expression[position])) {
+			position++;
+		}
+
+		Lexeme lexeme;
+		lexeme.offset = position;
+
+		if (position >= expression.size()) {
+			lexeme.type = LexemeType::END;
+			return lexeme;
+		}
+
+		size_t start = position;
+		char character = expression[position];
+
+		if (isDigit(character) || character == '.') {
+			lexeme.type = LexemeType::NUMBER;
+			position = scanNumber(position);
+		}
+		else if (isIdentifierStart(character)) {
+			lexeme.type = LexemeType::IDENTIFIER;
+			while (position < expression.size() && isIdentifierPart(expression[position])) {
+				position++;
+			}
+		}
+		else if (character == '(') {
+			lexeme.type = LexemeType::LEFT_PARENTHESIS;
+			position++;
+		}
+		else if (character == ')') {
+			lexeme.type = LexemeType::RIGHT_PARENTHESIS;
+			position++;
+		}
+		else if (character == ',') {
+			lexeme.type = LexemeType::COMMA;
+			position++;
+		}
+		else if ((lexeme.operation = getOperationFromChar(character)) != Operation::NONE) {
+			lexeme.type = LexemeType::OPERATOR;
+			position++;
+		}
+		else {
+			lexeme.type = LexemeType::UNKNOWN;
+			position++;
+		}
+
+		lexeme.text = expression.substr(start, position - start);
+		return lexeme;
+	}
+
+private:
+	// Scans digits with an optional fraction and exponent, the e of the exponent is only taken
+	// if a digit follows it so "2*e" still reads the constant
+	constexpr size_t scanNumber(size_t i) const {
+		while (i < expression.size() && isDigit(expression[i])) {
+			i++;
+		}
+
+		if (i < expression.size() && expression[i] == '.') {
+			i++;
+			while (i < expression.size() && isDigit(expression[i])) {
+				i++;
+			}
+		}
+
+		if (i < expression.size() && (expression[i] == 'e' || expression[i] == 'E')) {
+			size_t j = i + 1;
+			if (j < expression.size() && (expression[j] == '+' || expression[j] == '-')) {
+				j++;
+			}
+			if (j < expression.size() && isDigit(expression[j])) {
+				i = j;
+				while (i < expression.size() && isDigit(expression[i])) {
+					i++;
+				}
+			}
+		}
+
+		return i;
+	}
+};
+
+// Parser
+
+// Errors
+
+enum class ErrorCode {
+	NONE = 0,
+	UNEXPECTED_TOKEN,
+	UNEXPECTED_END,
+	UNEXPECTED_PARENTHESIS, // A closing parenthesis without an opening one
+	MISSING_PARENTHESIS, // An opening parenthesis that is never closed
+	INVALID_NUMBER,
+	UNKNOWN_IDENTIFIER,
+	UNKNOWN_FUNCTION,
+	ARGUMENT_COUNT, // A function called with another number of arguments than it takes
+};
+
+constexpr const char* getErrorDescription(ErrorCode code) {
+	switch (code) {
+	case ErrorCode::NONE:
+		return "No error";
+	case ErrorCode::UNEXPECTED_TOKEN:
+		return "Unexpected";
+	case ErrorCode::UNEXPECTED_END:
+		return "Unexpected end of the expression";
+	case ErrorCode::UNEXPECTED_PARENTHESIS:
+		return "Unexpected ')'";
+	case ErrorCode::MISSING_PARENTHESIS:
+		return "Missing closing parenthesis for the one opened";
+	case ErrorCode::INVALID_NUMBER:
+		return "Invalid number";
+	case ErrorCode::UNKNOWN_IDENTIFIER:
+		return "Unknown identifier";
+	case ErrorCode::UNKNOWN_FUNCTION:
+		return "Unknown function";
+	case ErrorCode::ARGUMENT_COUNT:
+		return "Wrong number of arguments for";
+	}
+	return "Unknown error";
+}
+
+// Reason why an expression couldn't be compiled, the offset and length are in bytes of the text of the expression
+struct CompileError {
+	ErrorCode code = ErrorCode::NONE;
+	size_t offset = 0;
+	size_t length = 0; // Length of the text that caused the error, 0 if there is no text like at the end
+
+	explicit operator bool() const {
+		return code != ErrorCode::NONE;
+	}
+
+	// The expression must be the one that was compiled, the text of the error is quoted from it
+	std::string getMessage(std::string_view expression) const {
+		std::string message = getErrorDescription(code);
+
+		bool quoted = code == ErrorCode::UNEXPECTED_TOKEN || code == ErrorCode::INVALID_NUMBER || code == ErrorCode::UNKNOWN_IDENTIFIER
+			|| code == ErrorCode::UNKNOWN_FUNCTION || code == ErrorCode::ARGUMENT_COUNT;
+
+		if (quoted && offset < expression.size()) {
+			message += " '";
+			message += expression.substr(offset, length);
+			message += "'";
+		}
+
+		return message + " at position " + std::to_string(offset);
+	}
+};
+
+// Shunting yard parser, the pending operators and operands are kept in explicit stacks, so the nesting of the
+// expression is only limited by the memory. Each lexeme is visited once so the tree is built in linear time.
+// The builder makes the nodes and reports the errors: Parser makes the tokens of parseToken, StaticBuilder the nodes
+// of parseStaticExpression, so both go through this same grammar, which is constexpr for the latter. A builder has:
+// - Operand, the type of a node, and Stack<T>, the stack the operands and the pending operators are kept in
+// - number and identifier, the node of an operand lexeme, and reduce, the node of an operation on its operands, the
+//   b and c ones are empty when it has less of them
+// - fail, which reports an error, and failed, whether it has one, the parse stops at the first one
+// - reuseGroup and closeGroup, the groups of the incremental parser, and its checkpoints: checkpoint is called at
+//   every operator once the ones it closes are reduced and stops the parse when it returns true, reduced gets the
+//   node of every operator reduced with its place in the stack, and extend gives the lexer more text when it reaches
+//   the end of the part it sees
+template<typename Builder>
+struct ShuntingYard {
+	using Operand = typename Builder::Operand;
+
+	struct PendingOperator {
+		Operation operation; // NONE for an open parenthesis
+		int priority;
+		size_t offset;
+		const Function* function = nullptr; // Set when the parenthesis opens the arguments of a call
+		size_t start = offset; // Where the group starts, the name of the function for a call
+		size_t arguments = 1; // Of a call, the commas seen plus one
+	};
+
+	Builder& builder;
+	Lexer lexer;
+	Lexeme current;
+	typename Builder::template Stack<Operand> operands;
+	typename Builder::template Stack<PendingOperator> operators;
+	size_t maxDepth = 0; // Largest size of the operators stack, the nesting the parser had to keep
+	bool expectOperand = true;
+	bool stopped = false; // By the builder at a checkpoint, the operand returned is empty
+
+	constexpr ShuntingYard(Builder& builder, std::string_view expression) : builder(builder), lexer(expression) {
+		advance();
+	}
+
+	constexpr void advance() {
+		current = lexer.next();
+		while (current.type == LexemeType::END && builder.extend(lexer)) {
+			current = lexer.next();
+		}
+	}
+
+	// Continues after a checkpoint, the stacks must already hold its state, the operator at the offset comes next
+	constexpr void resume(size_t offset) {
+		lexer.position = offset;
+		advance();
+		expectOperand = false;
+	}
+
+	// The root of the expression, or an empty operand after an error
+	constexpr Operand parse() {
+		while (true) {
+			if (expectOperand) {
+				if (current.type == LexemeType::OPERATOR && current.operation == Operation::MIN) {
+					// The minus sign binds weaker than the power so -2^2 = -(2^2)
+					pushOperator({ Operation::NEG, MAX_PRIORITY, current.offset });
+					advance();
+				}
+				else if ((current.type == LexemeType::LEFT_PARENTHESIS || current.type == LexemeType::IDENTIFIER) && reuseGroup()) {
+					expectOperand = false;
+				}
+				else if (current.type == LexemeType::LEFT_PARENTHESIS) {
+					// The parenthesized expression is kept as a subtree, so it is never resolved while parsing
+					pushOperator({ Operation::NONE, 0, current.offset });
+					advance();
+				}
+				else if (current.type == LexemeType::IDENTIFIER && isCall()) {
+					const Function* function = getFunction(current.text);
+					if (function == nullptr) {
+						fail(ErrorCode::UNKNOWN_FUNCTION);
+						return Operand{};
+					}
+
+					// The arguments are parsed as parenthesized expressions separated by the commas
+					size_t start = current.offset;
+					advance();
+					pushOperator({ Operation::NONE, 0, current.offset, function, start });
+					advance();
+				}
+				else {
+					Operand operand = parseOperand();
+					if (builder.failed()) {
+						return Operand{};
+					}
+
+					operands.push_back(std::move(operand));
+					expectOperand = false;
+				}
+				continue;
+			}
+
+			switch (current.type) {
+			case LexemeType::OPERATOR: {
+				Operation operation = current.operation;
+				int priority = getPriority(operation);
+
+				// Power is right associative (2^3^2 = 2^9), the rest of the operations are left associative
+				bool leftAssociative = operation != Operation::POW;
+
+				while (!operators.empty() && operators.back().operation != Operation::NONE
+					&& (operators.back().priority > priority || (leftAssociative && operators.back().priority == priority))) {
+					reduce();
+				}
+
+				if (builder.checkpoint(*this)) {
+					stopped = true;
+					return Operand{};
+				}
+
+				pushOperator({ operation, priority, current.offset });
+				advance();
+				expectOperand = true;
+				break;
+			}
+			case LexemeType::RIGHT_PARENTHESIS:
+				while (!operators.empty() && operators.back().operation != Operation::NONE) {
+					reduce();
+				}
+
+				if (operators.empty()) {
+					fail(ErrorCode::UNEXPECTED_PARENTHESIS);
+					return Operand{};
+				}
+
+				if (operators.back().function != nullptr && !reduceCall()) {
+					return Operand{};
+				}
+
+				builder.closeGroup(operators.back().start, lexer.position, operands.back());
+				operators.pop_back();
+				advance();
+				break;
+			case LexemeType::COMMA:
+				while (!operators.empty() && operators.back().operation != Operation::NONE) {
+					reduce();
+				}
+
+				if (operators.empty() || operators.back().function == nullptr) {
+					fail(ErrorCode::UNEXPECTED_TOKEN);
+					return Operand{};
+				}
+
+				operators.back().arguments++;
+				advance();
+				expectOperand = true;
+				break;
+			case LexemeType::END:
+				while (!operators.empty()) {
+					if (operators.back().operation == Operation::NONE) {
+						builder.fail(ErrorCode::MISSING_PARENTHESIS, operators.back().offset, 1);
+						return Operand{};
+					}
+					reduce();
+				}
+				return std::move(operands.back());
+			default:
+				fail(ErrorCode::UNEXPECTED_TOKEN);
+				return Operand{};
+			}
+		}
+	}
+
+	// Takes the tree of the group that starts at the current lexeme when there is one and jumps over its text
+	constexpr bool reuseGroup() {
+		Operand group{};
+		size_t end = 0;
+		if (!builder.reuseGroup(current.offset, group, end)) {
+			return false;
+		}
+
+		operands.push_back(std::move(group));
+		lexer.position = end;
+		advance();
+		return true;
+	}
+
+	// An identifier followed by '(', the lexer is copied so it can look ahead without moving
+	constexpr bool isCall() const {
+		Lexer ahead = lexer;
+		return ahead.next().type == LexemeType::LEFT_PARENTHESIS;
+	}
+
+	// The closing parenthesis of a call, its arguments are the operands on the top of the stack
+	constexpr bool reduceCall() {
+		const PendingOperator& call = operators.back();
+		if (call.arguments != call.function->arguments) {
+			builder.fail(ErrorCode::ARGUMENT_COUNT, call.start, call.function->name.size());
+			return false;
+		}
+
+		Operand arguments[3] = {};
+		for (size_t i = call.arguments; i > 0; i--) {
+			arguments[i - 1] = std::move(operands.back());
+			operands.pop_back();
+		}
+
+		operands.push_back(builder.reduce(call.function->operation, std::move(arguments[0]), std::move(arguments[1]), std::move(arguments[2])));
+		return true;
+	}
+
+	constexpr void pushOperator(const PendingOperator& pending) {
+		operators.push_back(pending);
+		maxDepth = std::max(maxDepth, operators.size());
+	}
+
+	// Applies the operator on the top of the stack to the operands on the top of the stack
+	constexpr void reduce() {
+		Operation operation = operators.back().operation;
+		operators.pop_back();
+
+		Operand b = std::move(operands.back());
+		operands.pop_back();
+
+		if (operation == Operation::NEG) {
+			operands.push_back(builder.reduce(operation, std::move(b), Operand{}, Operand{}));
+		}
+		else {
+			Operand a = std::move(operands.back());
+			operands.pop_back();
+
+			operands.push_back(builder.reduce(operation, std::move(a), std::move(b), Operand{}));
+		}
+
+		builder.reduced(operators.size(), operands.back());
+	}
+
+	constexpr Operand parseOperand() {
+		switch (current.type) {
+		case LexemeType::NUMBER: {
+			Operand operand = builder.number(current);
+			advance();
+			return operand;
+		}
+		case LexemeType::IDENTIFIER: {
+			Operand operand = builder.identifier(current);
+			advance();
+			return operand;
+		}
+		case LexemeType::END:
+			fail(ErrorCode::UNEXPECTED_END);
+			return Operand{};
+		default:
+			fail(ErrorCode::UNEXPECTED_TOKEN);
+			return Operand{};
+		}
+	}
+
+	constexpr void fail(ErrorCode code) {
+		builder.fail(code, current.offset, current.text.size());
+	}
+};
+
+// The builder of the tokens of parseToken
+struct Parser {
+	using Operand = TokenPtr;
+
+	template<typename T>
+	using Stack = std::vector<T>;
+
+	std::string_view expression;
+	TokenFactory factory;
+	VariableTable* variables; // Without a table only the constants can be used as identifiers
+	bool allowNewVariables; // When false only the names already in the table are variables
+
+	size_t maxDepth = 0; // Of the last parse
+	CompileError error; // Set by the first error, the parser stops there
+
+	Parser(std::string_view expression, TokenArena* arena = nullptr, VariableTable* variables = nullptr, bool allowNewVariables = true)
+		: expression(expression), variables(variables), allowNewVariables(allowNewVariables) {
+		factory.arena = arena;
+	}
+
+	TokenPtr parse() {
+		ShuntingYard<Parser> yard(*this, expression);
+		yard.operands.reserve(16);
+		yard.operators.reserve(16);
+
+		TokenPtr root = yard.parse();
+		maxDepth = yard.maxDepth;
+		return root;
+	}
+
+	TokenPtr number(const Lexeme& lexeme) {
+		double value;
+		if (!parseNumber(lexeme.text, value)) {
+			fail(ErrorCode::INVALID_NUMBER, lexeme.offset, lexeme.text.size());
+			return nullptr;
+		}
+		return factory.create<NumberToken>(value);
+	}
+
+	TokenPtr identifier(const Lexeme& lexeme) {
+		double value;
+		if (getConstant(lexeme.text, value)) {
+			return factory.create<NumberToken>(value);
+		}
+
+		size_t slot = variables ? variables->find(lexeme.text) : VariableTable::NOT_FOUND;
+		if (slot == VariableTable::NOT_FOUND) {
+			if (variables == nullptr || !allowNewVariables) {
+				fail(ErrorCode::UNKNOWN_IDENTIFIER, lexeme.offset, lexeme.text.size());
+				return nullptr;
+			}
+			slot = variables->getOrAdd(lexeme.text);
+		}
+
+		// The name is resolved to its slot now so evaluating the variable is only an index in the bindings
+		return factory.create<VariableToken>(slot);
+	}
+
+	TokenPtr reduce(Operation operation, TokenPtr a, TokenPtr b, TokenPtr c) {
+		return factory.create<OperationToken>(operation, std::move(a), std::move(b), std::move(c));
+	}
+
+	bool failed() const {
+		return static_cast<bool>(error);
+	}
+
+	void fail(ErrorCode code, size_t offset, size_t length) {
+		if (!error) {
+			error = { code, offset, length };
+		}
+	}
+
+	bool reuseGroup(size_t, TokenPtr&, size_t&) {
+		return false;
+	}
+
+	void closeGroup(size_t, size_t, const TokenPtr&) {}
+
+	template<typename Yard>
+	bool checkpoint(Yard&) {
+		return false;
+	}
+
+	void reduced(size_t, const TokenPtr&) {}
+
+	bool extend(Lexer&) {
+		return false;
+	}
+};
+
+// Returns null and sets the error if the expression is invalid, without an error to set it throws std::invalid_argument
+TokenPtr parseToken(std::string_view expression, TokenArena* arena = nullptr, VariableTable* variables = nullptr, bool allowNewVariables = true, CompileError* error = nullptr) {
+	Parser parser(expression, arena, variables, allowNewVariables);
+	TokenPtr token = parser.parse();
+	recordParseDepth(parser.maxDepth);
+
+	if (parser.error) {
+		if (error == nullptr) {
+			throw std::invalid_argument(parser.error.getMessage(expression));
+		}
+		*error = parser.error;
+	}
+
+	return token;
+}
+
+std::unique_ptr<Token> compileExpression(std::string expression) {
+	// The lexer skips the spaces, so the expression is parsed without copying it
+	return std::unique_ptr<Token>(parseToken(expression).release());
+}
+
+// Compiles the expression with all its tokens in the arena, the returned token is freed with the arena
+Token* compileExpression(std::string_view expression, TokenArena& arena) {
+	return parseToken(expression, &arena).release();
+}
+
+// Optimizer
+
+size_t countTokens(const Token& root) {
+	std::vector<const Token*> pending;
+	pending.push_back(&root);
+
+	size_t count = 0;
+	while (!pending.empty()) {
+		const Token* token = pending.back();
+		pending.pop_back();
+		count++;
+
+		if (token->type == TokenType::OPERATION) {
+			const OperationToken* operation = static_cast<const OperationToken*>(token);
+			pending.push_back(operation->a.get());
+			if (operation->b) {
+				pending.push_back(operation->b.get());
+			}
+			if (operation->c) {
+				pending.push_back(operation->c.get());
+			}
+		}
+	}
+	return count;
+}
+
+bool isNumber(const TokenPtr& token, double value) {
+	return token->type == TokenType::NUMBER && static_cast<const NumberToken&>(*token).value == value;
+}
+
+// Replaces the token with one of its children, the child is moved out before the token is released
+void replaceWithChild(TokenPtr& token, TokenPtr& child) {
+	TokenPtr replacement = std::move(child);
+	token = std::move(replacement);
+}
+
+// Chooses a cheaper operation than std::pow for a constant exponent, the tree keeps the same shape
+// STRICT only takes the integer powers that are exact, see isIntegerPower. The roots are only taken with FAST, as
+// their results aren't the ones of std::pow: sqrt(-0) is -0 and sqrt(-inf) is NaN where the power is 0 and inf, the
+// cube root is real for negative bases where the power is NaN, and it is the exact cube root while 1.0 / 3 isn't
+// exactly a third, so it is a few ulp away for the rest
+void specializePower(OperationToken& operation, Precision precision) {
+	double exponent = static_cast<const NumberToken&>(*operation.b).value;
+
+	if (isIntegerPower(exponent, precision)) {
+		operation.operation = Operation::POWI;
+	}
+	else if (precision == Precision::STRICT) {
+		return;
+	}
+	else if (exponent == 0.5) {
+		operation.operation = Operation::SQRT;
+		operation.b.reset();
+	}
+	else if (exponent == 1.0 / 3) {
+		operation.operation = Operation::CBRT;
+		operation.b.reset();
+	}
+}
+
+// Folds the constant subtrees into numbers and applies the identities that keep the result exact:
+// x*1, 1*x, x/1, x-0, x^1, x^0, 1^x, --x and x^2 = x*x when x is a variable
+// The rest of the powers with a constant exponent are specialized for the precision, and an IF with a constant
+// condition is the branch it takes
+// The children of the token must be already optimized, returns the number of tokens removed from the tree
+size_t optimizeToken(TokenPtr& token, TokenFactory& factory, Precision precision = Precision::STRICT) {
+	if (token->type != TokenType::OPERATION) {
+		return 0;
+	}
+
+	OperationToken& operation = static_cast<OperationToken&>(*token);
+	size_t eliminated = 0;
+
+	if (operation.operation == Operation::IF) {
+		if (operation.a->type == TokenType::NUMBER) {
+			TokenPtr& taken = isTrue(static_cast<const NumberToken&>(*operation.a).value) ? operation.b : operation.c;
+			eliminated = countTokens(*token) - countTokens(*taken);
+			replaceWithChild(token, taken);
+		}
+		return eliminated;
+	}
+
+	bool constant = operation.a->type == TokenType::NUMBER && (!operation.b || operation.b->type == TokenType::NUMBER);
+	if (constant) {
+		eliminated += operation.b ? 2 : 1;
+		double aValue = static_cast<const NumberToken&>(*operation.a).value;
+		double bValue = operation.b ? static_cast<const NumberToken&>(*operation.b).value : 0;
+		token = factory.create<NumberToken>(applyOperation(operation.operation, aValue, bValue));
+		return eliminated;
+	}
+
+	TokenPtr& a = operation.a;
+	TokenPtr& b = operation.b;
+
+	switch (operation.operation) {
+	case Operation::MIN:
+		// x - 0 is x, but x - -0 is x + 0, which is 0 and not -0 for x = -0, as x + 0 is left as it is
+		if (isNumber(b, 0) && !std::signbit(static_cast<const NumberToken&>(*b).value)) {
+			replaceWithChild(token, a);
+			return eliminated + 2;
+		}
+		break;
+	case Operation::MUL:
+		if (isNumber(b, 1)) {
+			replaceWithChild(token, a);
+			return eliminated + 2;
+		}
+		if (isNumber(a, 1)) {
+			replaceWithChild(token, b);
+			return eliminated + 2;
+		}
+		break;
+	case Operation::DIV:
+		if (isNumber(b, 1)) {
+			replaceWithChild(token, a);
+			return eliminated + 2;
+		}
+		break;
+	case Operation::POW:
+		if (isNumber(b, 1)) {
+			replaceWithChild(token, a);
+			return eliminated + 2;
+		}
+		if (isNumber(b, 0) || isNumber(a, 1)) { // std::pow(x, 0) and std::pow(1, x) are 1 for any x, even NaN
+			eliminated += countTokens(*token) - 1;
+			token = factory.create<NumberToken>(1);
+			return eliminated;
+		}
+		if (isNumber(b, 2) && a->type == TokenType::VARIABLE) {
+			size_t slot = static_cast<const VariableToken&>(*a).slot;
+			token = factory.create<OperationToken>(Operation::MUL, std::move(a), factory.create<VariableToken>(slot));
+			return eliminated;
+		}
+		if (b->type == TokenType::NUMBER) {
+			specializePower(operation, precision);
+		}
+		break;
+	case Operation::NEG:
+		if (a->type == TokenType::OPERATION && static_cast<const OperationToken&>(*a).operation == Operation::NEG) {
+			replaceWithChild(token, static_cast<OperationToken&>(*a).a);
+			return eliminated + 2;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return eliminated;
+}
+
+// Optimizes the tree in place, the new tokens are created in the arena if there is one
+// The tokens are optimized in post order so the children are always simplified before their parent
+size_t optimizeExpression(TokenPtr& root, TokenArena* arena = nullptr, Precision precision = Precision::STRICT) {
+	TokenFactory factory;
+	factory.arena = arena;
+
+	// The pointers to the owners of the tokens stay valid because a parent is only replaced after its children
+	// The lists are reused by the thread between calls
+	thread_local std::vector<TokenPtr*> order;
+	thread_local std::vector<TokenPtr*> pending;
+	order.clear();
+	pending.clear();
+	pending.push_back(&root);
+
+	while (!pending.empty()) {
+		TokenPtr* token = pending.back();
+		pending.pop_back();
+		order.push_back(token);
+
+		if ((*token)->type == TokenType::OPERATION) {
+			OperationToken& operation = static_cast<OperationToken&>(**token);
+			pending.push_back(&operation.a);
+			if (operation.b) {
+				pending.push_back(&operation.b);
+			}
+			if (operation.c) {
+				pending.push_back(&operation.c);
+			}
+		}
+	}
+
+	// The reversed preorder visits every token after all the tokens of its subtree
+	size_t eliminated = 0;
+	for (auto it = order.rbegin(); it != order.rend(); ++it) {
+		eliminated += optimizeToken(**it, factory, precision);
+	}
+	return eliminated;
+}
+
+// Bytecode
+
+// The tree is lowered to a flat postfix program that runs on a stack machine, this avoids the virtual
+// calls and the pointer chasing of resolving the tree when the same expression is evaluated many times.
+// The program is a structure of arrays with one entry per node in evaluation order, so a node takes 9 bytes
+// instead of the 40 of a token and the whole expression is a few contiguous arrays.
+// The identical subtrees are only evaluated once: the first one saves its value in a temporary and the others
+// recall it, so the program is the DAG of the expression instead of its tree.
+// An IF with cheap branches is a SELECT that evaluates both of them and picks one without a branch. Otherwise it is
+// lazy, the branches are ranges of the program that are skipped:
+//   condition, BRANCH, then branch, JUMP, else branch, JOIN
+// BRANCH pops the condition and jumps to the else branch when it is 0, JUMP goes over the else branch and JOIN
+// is where both meet, the value of the branch taken is on the stack. Each branch is a subtree of its own, what is
+// shared inside of a branch is only shared there, so a branch never recalls a value saved by another one
+
+enum class OpCode : uint8_t {
+	PUSH = 0, // Pushes the constant of the operand index
+	LOAD, // Pushes the binding of the operand slot
+	SUM,
+	MIN,
+	MUL,
+	DIV,
+	POW,
+	NEG,
+	POWI, // The b operand is the integer exponent
+	SQRT,
+	CBRT,
+	SAVE, // Copies the top of the stack to the temporary of the b operand, the value stays on the stack
+	RECALL, // Pushes the temporary of the operand index
+	MINIMUM,
+	MAXIMUM,
+	ABS,
+	SELECT, // Pops the condition a, the then value and the else value b and pushes the one taken, the then branch ends where the else one starts
+	BRANCH, // Pops the condition a and jumps to the node b when it is 0
+	JUMP, // Ends the then branch a and jumps to the JOIN b
+	JOIN, // Ends the IF of the BRANCH a, b is the end of the else branch
+	SIN, // The elementary functions of the C library
+	COS,
+	EXP,
+	LOG,
+	FAST_SIN, // The approximations of the FAST precision
+	FAST_COS,
+	FAST_EXP,
+	FAST_LOG,
+};
+
+bool isBinary(OpCode opcode) {
+	return (opcode >= OpCode::SUM && opcode <= OpCode::POW) || opcode == OpCode::MINIMUM || opcode == OpCode::MAXIMUM;
+}
+
+// The nodes without children
+bool isLeaf(OpCode opcode) {
+	return opcode == OpCode::PUSH || opcode == OpCode::LOAD || opcode == OpCode::RECALL;
+}
+
+bool isElementary(OpCode opcode) {
+	return opcode >= OpCode::SIN && opcode <= OpCode::FAST_LOG;
+}
+
+// The nodes of the lazy IF, they change the order the program runs in
+bool isControl(OpCode opcode) {
+	return opcode == OpCode::BRANCH || opcode == OpCode::JUMP || opcode == OpCode::JOIN;
+}
+
+// Arrays of a program owned by someone else, the engines run on views so they can run the programs stored
+// anywhere, like the ones of a mapped file
+struct ProgramView {
+	const OpCode* opcodes = nullptr;
+	const uint32_t* a = nullptr;
+	const uint32_t* b = nullptr;
+	const double* constants = nullptr;
+	size_t nodeCount = 0;
+	size_t constantCount = 0;
+	size_t stackSize = 0;
+	size_t temporaryCount = 0;
+
+	size_t size() const {
+		return nodeCount;
+	}
+};
+
+// The children of a node always go before it, so the program can run on a stack without looking at them,
+// but every node also has the index of its children for the engines that keep the value of every node
+struct Program {
+	std::vector<OpCode> opcodes;
+	std::vector<uint32_t> a; // First child of the operations, constant index of PUSH, slot of LOAD and temporary of RECALL
+	std::vector<uint32_t> b; // Second child of the binary operations, exponent of POWI and temporary of SAVE, 0 for the rest
+	std::vector<double> constants;
+	size_t stackSize = 0; // Maximum number of values on the stack while executing
+	size_t temporaryCount = 0; // Values saved at the same time, a temporary is reused once its value isn't recalled anymore
+
+	size_t size() const {
+		return opcodes.size();
+	}
+
+	// Returns the index of the new node
+	uint32_t addNode(OpCode opcode, uint32_t aOperand, uint32_t bOperand = 0) {
+		opcodes.push_back(opcode);
+		a.push_back(aOperand);
+		b.push_back(bOperand);
+		return static_cast<uint32_t>(opcodes.size() - 1);
+	}
+
+	ProgramView view() const {
+		return { opcodes.data(), a.data(), b.data(), constants.data(), opcodes.size(), constants.size(), stackSize, temporaryCount };
+	}
+};
+
+constexpr OpCode getOpCode(Operation operation, Precision precision = Precision::STRICT) {
+	bool fast = precision == Precision::FAST;
+
+	switch (operation) {
+	case Operation::SUM:
+		return OpCode::SUM;
+	case Operation::MIN:
+		return OpCode::MIN;
+	case Operation::MUL:
+		return OpCode::MUL;
+	case Operation::DIV:
+		return OpCode::DIV;
+	case Operation::POW:
+		return OpCode::POW;
+	case Operation::NEG:
+		return OpCode::NEG;
+	case Operation::POWI:
+		return OpCode::POWI;
+	case Operation::SQRT:
+		return OpCode::SQRT;
+	case Operation::CBRT:
+		return OpCode::CBRT;
+	case Operation::MINIMUM:
+		return OpCode::MINIMUM;
+	case Operation::MAXIMUM:
+		return OpCode::MAXIMUM;
+	case Operation::ABS:
+		return OpCode::ABS;
+	case Operation::SIN:
+		return fast ? OpCode::FAST_SIN : OpCode::SIN;
+	case Operation::COS:
+		return fast ? OpCode::FAST_COS : OpCode::COS;
+	case Operation::EXP:
+		return fast ? OpCode::FAST_EXP : OpCode::EXP;
+	case Operation::LOG:
+		return fast ? OpCode::FAST_LOG : OpCode::LOG;
+	default:
+		throw std::invalid_argument("Operation without opcode");
+	}
+}
+
+// Result of an operation node, the b value is ignored by the unary ones. The leaves, POWI and the IF nodes carry
+// operands instead of values, so they are handled by the engines themselves
+double applyOpCode(OpCode opcode, double aValue, double bValue) {
+	switch (opcode) {
+	case OpCode::SUM:
+		return aValue + bValue;
+	case OpCode::MIN:
+		return aValue - bValue;
+	case OpCode::MUL:
+		return aValue * bValue;
+	case OpCode::DIV:
+		return aValue / bValue;
+	case OpCode::POW:
+		return std::pow(aValue, bValue);
+	case OpCode::NEG:
+		return -aValue;
+	case OpCode::SQRT:
+		return std::sqrt(aValue);
+	case OpCode::CBRT:
+		return std::cbrt(aValue);
+	case OpCode::MINIMUM:
+		return minimumOf(aValue, bValue);
+	case OpCode::MAXIMUM:
+		return maximumOf(aValue, bValue);
+	case OpCode::ABS:
+		return std::fabs(aValue);
+	case OpCode::SIN:
+		return std::sin(aValue);
+	case OpCode::COS:
+		return std::cos(aValue);
+	case OpCode::EXP:
+		return std::exp(aValue);
+	case OpCode::LOG:
+		return std::log(aValue);
+	case OpCode::FAST_SIN:
+		return fastSin(aValue);
+	case OpCode::FAST_COS:
+		return fastCos(aValue);
+	case OpCode::FAST_EXP:
+		return fastExp(aValue);
+	case OpCode::FAST_LOG:
+		return fastLog(aValue);
+	default:
+		return 0;
+	}
+}
+
+// Merges the identical subtrees of an expression into one node, so the expression becomes a DAG. The children
+// of every node go before it and the nodes are looked up by their content in an open addressing table
+class SubexpressionTable {
+public:
+	struct Node {
+		OpCode opcode;
+		uint32_t a, b; // As in the program, but the children are nodes of the table
+		double value; // Constant of PUSH
+		uint32_t c = 0; // Else branch of an IF, which is a SELECT or a JOIN here with the then branch in b
+		uint32_t scope = 0; // Branch of a lazy IF the node is in, the nodes of different branches aren't merged
+	};
+
+	std::vector<Node> nodes;
+
+	// Only the used entries are cleared, so a huge expression doesn't make the next ones slower
+	void clear() {
+		for (size_t i : used) {
+			table[i] = 0;
+		}
+		nodes.clear();
+		used.clear();
+	}
+
+	// Returns the node with the same content if there is one, otherwise adds it. Without sharing it is always added
+	uint32_t add(const Node& node, bool share) {
+		if (!share) {
+			nodes.push_back(node);
+			return static_cast<uint32_t>(nodes.size() - 1);
+		}
+
+		if (2 * (nodes.size() + 1) > table.size()) {
+			grow();
+		}
+
+		size_t mask = table.size() - 1;
+		for (size_t i = hash(node) & mask;; i = (i + 1) & mask) {
+			if (table[i] == 0) {
+				nodes.push_back(node);
+				table[i] = static_cast<uint32_t>(nodes.size());
+				used.push_back(i);
+				return table[i] - 1;
+			}
+			if (equal(nodes[table[i] - 1], node)) {
+				return table[i] - 1;
+			}
+		}
+	}
+
+private:
+	std::vector<uint32_t> table; // Index + 1 of the nodes, 0 is an empty entry
+	std::vector<size_t> used; // Entries of the table that aren't empty
+
+	static uint64_t getBits(double value) {
+		uint64_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	// The constants are compared by their bits, so -0 and 0 are different and the same NaN is merged
+	static bool equal(const Node& x, const Node& y) {
+		return x.opcode == y.opcode && x.a == y.a && x.b == y.b && getBits(x.value) == getBits(y.value) && x.c == y.c && x.scope == y.scope;
+	}
+
+	static size_t hash(const Node& node) {
+		uint64_t h = getBits(node.value) ^ (uint64_t(node.a) << 32 | node.b) * 0x9E3779B97F4A7C15ull;
+		h ^= (uint64_t(node.c) << 32 | node.scope) * 0xC2B2AE3D27D4EB4Full;
+		h ^= static_cast<uint64_t>(node.opcode);
+		h *= 0xFF51AFD7ED558CCDull;
+		return static_cast<size_t>(h ^ (h >> 32));
+	}
+
+	void grow() {
+		table.assign(std::max<size_t>(64, 2 * table.size()), 0);
+
+		size_t mask = table.size() - 1;
+		used.clear();
+
+		for (size_t node = 0; node < nodes.size(); node++) {
+			size_t i = hash(nodes[node]) & mask;
+			while (table[i] != 0) {
+				i = (i + 1) & mask;
+			}
+			table[i] = static_cast<uint32_t>(node + 1);
+			used.push_back(i);
+		}
+	}
+};
+
+// Largest branches of an IF evaluated both by a SELECT, the calls and the nested IFs are never cheap
+constexpr size_t CHEAP_BRANCH_TOKENS = 8;
+
+bool isCheapBranch(const Token& root) {
+	const Token* pending[CHEAP_BRANCH_TOKENS + 1];
+	size_t pendingCount = 0, count = 0;
+	pending[pendingCount++] = &root;
+
+	while (pendingCount > 0) {
+		const Token* token = pending[--pendingCount];
+		if (++count > CHEAP_BRANCH_TOKENS) {
+			return false;
+		}
+
+		if (token->type == TokenType::OPERATION) {
+			const OperationToken* operation = static_cast<const OperationToken*>(token);
+			if (operation->operation == Operation::POW || operation->operation == Operation::CBRT || operation->operation == Operation::IF
+				|| isElementary(operation->operation)) {
+				return false;
+			}
+
+			// POWI keeps its exponent in the instruction
+			if (operation->b && operation->operation != Operation::POWI) {
+				pending[pendingCount++] = operation->b.get();
+			}
+			pending[pendingCount++] = operation->a.get();
+		}
+	}
+	return true;
+}
+
+// Emits the tree in postfix order with explicit stacks and tracks the stack depth needed to evaluate it.
+// The tree is first merged into a DAG, then a node with several parents is emitted the first time that it is
+// reached followed by a SAVE, and it is a RECALL the rest of times. The leaves are cheaper to emit again than
+// to recall, so only their constants are shared. Without sharing every token is emitted as it is.
+// The elementary functions become the opcodes of the precision
+Program compileProgram(const Token& root, bool shareSubexpressions = true, Precision precision = Precision::STRICT) {
+	constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+	// The nodes are emitted in a program reused between calls and then copied with their exact size,
+	// so every array of the result is allocated once and it doesn't waste memory in the cache
+	thread_local Program program;
+	program.opcodes.clear();
+	program.a.clear();
+	program.b.clear();
+	program.constants.clear();
+	program.stackSize = 0;
+	program.temporaryCount = 0;
+
+	struct PendingToken {
+		const Token* token;
+		bool expanded; // Set once the children are pushed
+		uint32_t scope;
+	};
+
+	// Everything below is reused between calls
+	thread_local SubexpressionTable dag;
+	thread_local std::vector<PendingToken> pending;
+	thread_local std::vector<uint32_t> nodes; // Nodes that don't have a parent yet
+	dag.clear();
+	pending.clear();
+	nodes.clear();
+	pending.push_back({ &root, false, 0 });
+	uint32_t scopeCount = 1;
+
+	while (!pending.empty()) {
+		auto [token, expanded, scope] = pending.back();
+		pending.pop_back();
+
+		// The leaves are emitted again wherever they are used, so they are the same node in every branch
+		if (token->type == TokenType::NUMBER) {
+			nodes.push_back(dag.add({ OpCode::PUSH, 0, 0, static_cast<const NumberToken*>(token)->value }, shareSubexpressions));
+			continue;
+		}
+
+		if (token->type == TokenType::VARIABLE) {
+			uint32_t slot = static_cast<uint32_t>(static_cast<const VariableToken*>(token)->slot);
+			nodes.push_back(dag.add({ OpCode::LOAD, slot, 0, 0 }, shareSubexpressions));
+			continue;
+		}
+
+		const OperationToken* operation = static_cast<const OperationToken*>(token);
+
+		if (operation->operation == Operation::IF) {
+			bool select = isCheapBranch(*operation->b) && isCheapBranch(*operation->c);
+
+			if (!expanded) {
+				pending.push_back({ token, true, scope });
+				pending.push_back({ operation->c.get(), false, select ? scope : scopeCount++ });
+				pending.push_back({ operation->b.get(), false, select ? scope : scopeCount++ });
+				pending.push_back({ operation->a.get(), false, scope });
+				continue;
+			}
+
+			uint32_t c = nodes.back();
+			nodes.pop_back();
+			uint32_t b = nodes.back();
+			nodes.pop_back();
+			nodes.back() = dag.add({ select ? OpCode::SELECT : OpCode::JOIN, nodes.back(), b, 0, c, scope }, shareSubexpressions);
+			continue;
+		}
+
+		// The exponent of an integer power is part of the instruction instead of a value on the stack
+		bool binary = operation->b && operation->operation != Operation::POWI;
+
+		if (!expanded) {
+			pending.push_back({ token, true, scope });
+			if (binary) {
+				pending.push_back({ operation->b.get(), false, scope });
+			}
+			pending.push_back({ operation->a.get(), false, scope });
+			continue;
+		}
+
+		uint32_t bOperand = 0;
+		if (operation->operation == Operation::POWI) {
+			int exponent = static_cast<int>(static_cast<const NumberToken&>(*operation->b).value);
+			bOperand = static_cast<uint32_t>(exponent);
+		}
+		else if (binary) {
+			bOperand = nodes.back(); // Two values are replaced with the result
+			nodes.pop_back();
+		}
+
+		nodes.back() = dag.add({ getOpCode(operation->operation, precision), nodes.back(), bOperand, 0, 0, scope }, shareSubexpressions);
+	}
+
+	uint32_t rootNode = nodes.back();
+
+	// Every parent of a node is emitted once, so a node is reached as many times as it has parents
+	thread_local std::vector<uint32_t> parents, emitted, freeTemporaries;
+	parents.assign(dag.nodes.size(), 0);
+	emitted.assign(dag.nodes.size(), NONE); // Constant index of the PUSH nodes and temporary of the saved nodes
+	freeTemporaries.clear();
+
+	parents[rootNode]++;
+	for (const SubexpressionTable::Node& node : dag.nodes) {
+		if (!isLeaf(node.opcode)) {
+			parents[node.a]++;
+		}
+		if (isBinary(node.opcode) || node.opcode == OpCode::SELECT || node.opcode == OpCode::JOIN) {
+			parents[node.b]++;
+		}
+		if (node.opcode == OpCode::SELECT || node.opcode == OpCode::JOIN) {
+			parents[node.c]++;
+		}
+	}
+
+	// The phase is the number of children already emitted, the BRANCH and JUMP of the lazy IFs being emitted are
+	// on their own stack until their targets are known
+	thread_local std::vector<std::pair<uint32_t, uint8_t>> pendingNodes;
+	thread_local std::vector<uint32_t> jumps;
+	pendingNodes.clear();
+	jumps.clear();
+	nodes.clear(); // Now the index of the instructions that don't have a parent yet, it is the stack
+	pendingNodes.emplace_back(rootNode, 0);
+
+	while (!pendingNodes.empty()) {
+		auto [index, phase] = pendingNodes.back();
+		pendingNodes.pop_back();
+		const SubexpressionTable::Node& node = dag.nodes[index];
+
+		if (node.opcode == OpCode::PUSH) {
+			if (emitted[index] == NONE) {
+				emitted[index] = static_cast<uint32_t>(program.constants.size());
+				program.constants.push_back(node.value);
+			}
+			nodes.push_back(program.addNode(OpCode::PUSH, emitted[index]));
+		}
+		else if (node.opcode == OpCode::LOAD) {
+			nodes.push_back(program.addNode(OpCode::LOAD, node.a));
+		}
+		else if (emitted[index] != NONE) {
+			nodes.push_back(program.addNode(OpCode::RECALL, emitted[index]));
+
+			// The last parent frees the temporary for the next saved node
+			if (--parents[index] == 1) {
+				freeTemporaries.push_back(emitted[index]);
+			}
+		}
+		else if (node.opcode == OpCode::JOIN && phase < 3) {
+			pendingNodes.emplace_back(index, phase + 1);
+
+			if (phase == 0) {
+				pendingNodes.emplace_back(node.a, 0);
+			}
+			else if (phase == 1) {
+				uint32_t condition = nodes.back();
+				nodes.pop_back();
+				jumps.push_back(program.addNode(OpCode::BRANCH, condition));
+				pendingNodes.emplace_back(node.b, 0);
+			}
+			else {
+				uint32_t then = nodes.back();
+				nodes.pop_back();
+				uint32_t jump = program.addNode(OpCode::JUMP, then);
+				program.b[jumps.back()] = jump + 1;
+				jumps.push_back(jump);
+				pendingNodes.emplace_back(node.c, 0);
+			}
+			continue;
+		}
+		else if (phase == 0) {
+			pendingNodes.emplace_back(index, 1);
+			if (node.opcode == OpCode::SELECT) {
+				pendingNodes.emplace_back(node.c, 0);
+			}
+			if (isBinary(node.opcode) || node.opcode == OpCode::SELECT) {
+				pendingNodes.emplace_back(node.b, 0);
+			}
+			pendingNodes.emplace_back(node.a, 0);
+			continue;
+		}
+		else {
+			if (node.opcode == OpCode::JOIN) {
+				uint32_t jump = jumps.back();
+				jumps.pop_back();
+				uint32_t branch = jumps.back();
+				jumps.pop_back();
+
+				program.b[jump] = static_cast<uint32_t>(program.size());
+				nodes.back() = program.addNode(OpCode::JOIN, branch, nodes.back());
+			}
+			else if (node.opcode == OpCode::SELECT) {
+				uint32_t elseNode = nodes.back();
+				nodes.pop_back();
+				nodes.pop_back(); // The then branch ends right before the else one
+				nodes.back() = program.addNode(OpCode::SELECT, nodes.back(), elseNode);
+			}
+			else {
+				uint32_t bOperand = node.b;
+				if (isBinary(node.opcode)) {
+					bOperand = nodes.back();
+					nodes.pop_back();
+				}
+
+				nodes.back() = program.addNode(node.opcode, nodes.back(), bOperand);
+			}
+
+			if (parents[index] > 1) {
+				uint32_t temporary = static_cast<uint32_t>(program.temporaryCount);
+				if (freeTemporaries.empty()) {
+					program.temporaryCount++;
+				}
+				else {
+					temporary = freeTemporaries.back();
+					freeTemporaries.pop_back();
+				}
+
+				emitted[index] = temporary;
+				nodes.back() = program.addNode(OpCode::SAVE, nodes.back(), temporary);
+			}
+			continue;
+		}
+
+		program.stackSize = std::max(program.stackSize, nodes.size());
+	}
+
+	return program; // Copied, the copy only allocates the size of the arrays
+}
+
+double executeProgram(const ProgramView& program, const double* bindings = nullptr) {
+	constexpr size_t INLINE_STACK_SIZE = 64;
+
+	// The temporaries go after the stack
+	double inlineStack[INLINE_STACK_SIZE];
+	std::unique_ptr<double[]> heapStack;
+
+	double* stack = inlineStack;
+	if (program.stackSize + program.temporaryCount > INLINE_STACK_SIZE) {
+		heapStack = std::make_unique<double[]>(program.stackSize + program.temporaryCount);
+		stack = heapStack.get();
+	}
+	double* temporaries = stack + program.stackSize;
+
+	const OpCode* opcodes = program.opcodes;
+	const uint32_t* a = program.a;
+	const uint32_t* b = program.b;
+	const double* constants = program.constants;
+	double* top = stack; // Points to the next free position of the stack
+
+	for (size_t i = 0, size = program.size(); i < size; i++) {
+		switch (opcodes[i]) {
+		case OpCode::PUSH:
+			*top++ = constants[a[i]];
+			break;
+		case OpCode::LOAD:
+			*top++ = bindings[a[i]];
+			break;
+		case OpCode::SUM:
+			top--;
+			top[-1] = top[-1] + top[0];
+			break;
+		case OpCode::MIN:
+			top--;
+			top[-1] = top[-1] - top[0];
+			break;
+		case OpCode::MUL:
+			top--;
+			top[-1] = top[-1] * top[0];
+			break;
+		case OpCode::DIV:
+			top--;
+			top[-1] = top[-1] / top[0];
+			break;
+		case OpCode::POW:
+			top--;
+			top[-1] = std::pow(top[-1], top[0]);
+			break;
+		case OpCode::NEG:
+			top[-1] = -top[-1];
+			break;
+		case OpCode::POWI:
+			top[-1] = integerPower(top[-1], static_cast<int32_t>(b[i]));
+			break;
+		case OpCode::SQRT:
+			top[-1] = std::sqrt(top[-1]);
+			break;
+		case OpCode::CBRT:
+			top[-1] = std::cbrt(top[-1]);
+			break;
+		case OpCode::SAVE:
+			temporaries[b[i]] = top[-1];
+			break;
+		case OpCode::RECALL:
+			*top++ = temporaries[a[i]];
+			break;
+		case OpCode::MINIMUM:
+			top--;
+			top[-1] = minimumOf(top[-1], top[0]);
+			break;
+		case OpCode::MAXIMUM:
+			top--;
+			top[-1] = maximumOf(top[-1], top[0]);
+			break;
+		case OpCode::ABS:
+			top[-1] = std::fabs(top[-1]);
+			break;
+		case OpCode::SELECT:
+			top -= 2;
+			top[-1] = isTrue(top[-1]) ? top[0] : top[1];
+			break;
+		case OpCode::BRANCH:
+			top--;
+			if (!isTrue(top[0])) {
+				i = b[i] - 1;
+			}
+			break;
+		case OpCode::JUMP:
+			i = b[i] - 1;
+			break;
+		case OpCode::JOIN:
+			break;
+		case OpCode::SIN:
+		case OpCode::COS:
+		case OpCode::EXP:
+		case OpCode::LOG:
+		case OpCode::FAST_SIN:
+		case OpCode::FAST_COS:
+		case OpCode::FAST_EXP:
+		case OpCode::FAST_LOG:
+			top[-1] = applyOpCode(opcodes[i], top[-1], 0);
+			break;
+		}
+	}
+
+	return top[-1];
+}
+
+double executeProgram(const Program& program, const double* bindings = nullptr) {
+	return executeProgram(program.view(), bindings);
+}
+
+// Compile time expressions
+
+// Formulas known when the program is built can be parsed by the compiler itself: parseStaticExpression is constexpr and
+// runs the same ShuntingYard as parseToken, and StaticFormula turns the result into nested calls that
+// are inlined into straight line arithmetic, with no parse and no resolve at run time:
+//
+//   static constexpr auto AREA = parseStaticExpression("pi*r^2");
+//   double area = StaticFormula<AREA>::evaluate(&radius);
+//
+// The variables get their slots in the order they first appear. The operations with constant operands are folded
+// by the compiler, so an expression of only literals is a constant, except the powers with exponents other than -1,
+// 0, 1 and 2, since std::pow isn't constexpr, which are folded by the optimizer of the compiler instead, and the
+// operations that overflow or divide by zero, which run. Those four powers are folded as integerPower does, which
+// rounds them correctly.
+// An invalid expression doesn't compile, the error points to the throw of the reason.
+
+// Numbers of a literal, the same syntax as parseNumber. They are exact when the digits and the power of ten fit in
+// the mantissa of a long double, which covers most literals, the rest can be an ulp away from the ones of parseNumber
+constexpr bool parseStaticNumber(std::string_view text, double& value) {
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	bool digits = false;
+	size_t i = 0;
+
+	for (; i < text.size() && (isDigit(text[i]) || text[i] == '.'); i++) {
+		if (text[i] == '.') {
+			if (text.find('.', i + 1) != std::string_view::npos) {
+				return false;
+			}
+			continue;
+		}
+
+		digits = true;
+		bool fraction = text.find('.') < i;
+		if (mantissa < 1000000000000000000ull) {
+			mantissa = mantissa * 10 + (text[i] - '0');
+			exponent -= fraction ? 1 : 0;
+		}
+		else {
+			exponent += fraction ? 0 : 1; // Digits beyond the precision of the mantissa
+		}
+	}
+
+	if (!digits) {
+		return false;
+	}
+
+	if (i < text.size()) {
+		i++; // The e of the exponent, the lexer only takes it followed by digits
+		bool negative = text[i] == '-';
+		if (text[i] == '+' || text[i] == '-') {
+			i++;
+		}
+
+		int written = 0;
+		for (; i < text.size(); i++) {
+			written = std::min(written * 10 + (text[i] - '0'), 100000);
+		}
+		exponent += negative ? -written : written;
+	}
+
+	// The scaling is done in long double, which has a wider range than double where it is wider, so the numbers
+	// out of range are found after it instead of overflowing, which isn't allowed in a constant expression
+	constexpr long double POWERS[] = { 1e1L, 1e2L, 1e4L, 1e8L, 1e16L, 1e32L, 1e64L, 1e128L, 1e256L };
+
+	int steps = exponent < 0 ? -exponent : exponent;
+	if (steps >= 512) {
+		return mantissa == 0 && (value = 0, true); // Out of the range of a double for any other mantissa
+	}
+
+	long double scaled = static_cast<long double>(mantissa);
+	for (int bit = 0; bit < 9; bit++) {
+		if (steps & (1 << bit)) {
+			scaled = exponent < 0 ? scaled / POWERS[bit] : scaled * POWERS[bit];
+		}
+	}
+
+	if (scaled > std::numeric_limits<double>::max()) {
+		return false;
+	}
+	double result = static_cast<double>(scaled);
+
+	if (result == 0 && mantissa != 0) {
+		return false; // So small it is 0
+	}
+
+	value = result;
+	return true;
+}
+
+template<size_t Capacity>
+struct StaticExpression {
+	struct Node {
+		OpCode opcode = OpCode::PUSH;
+		uint32_t a = 0, b = 0; // Same as in a Program: children, slot of LOAD and exponent of POWI
+		double value = 0; // Constant of PUSH
+		uint32_t c = 0; // An IF is a SELECT with the condition a, the then branch b and the else branch c
+	};
+
+	Node nodes[Capacity] = {};
+	size_t size = 0;
+	size_t root = 0;
+	std::string_view variables[Capacity] = {};
+	size_t variableCount = 0;
+
+	constexpr bool isConstant() const {
+		return nodes[root].opcode == OpCode::PUSH;
+	}
+
+	// The slot of the variable, or VariableTable::NOT_FOUND
+	constexpr size_t getSlot(std::string_view name) const {
+		for (size_t i = 0; i < variableCount; i++) {
+			if (variables[i] == name) {
+				return i;
+			}
+		}
+		return VariableTable::NOT_FOUND;
+	}
+
+	constexpr uint32_t addNode(OpCode opcode, uint32_t a = 0, uint32_t b = 0, double value = 0, uint32_t c = 0) {
+		nodes[size] = { opcode, a, b, value, c };
+		return static_cast<uint32_t>(size++);
+	}
+};
+
+// Makes the errors of the compile time expressions compile errors, the compiler shows this throw
+constexpr void requireStatic(bool valid, ErrorCode code) {
+	if (!valid) {
+		throw std::invalid_argument(getErrorDescription(code));
+	}
+}
+
+// Whether the operation on the constants gives a finite value. An infinity isn't a constant expression, so the
+// operations that overflow or divide by zero aren't folded, they give the same infinity when they run
+constexpr bool isFiniteFold(OpCode opcode, double a, double b) {
+	constexpr double MAX = std::numeric_limits<double>::max();
+	double left = a < 0 ? -a : a;
+	double right = b < 0 ? -b : b;
+
+	switch (opcode) {
+	case OpCode::SUM:
+	case OpCode::MIN:
+		return left <= MAX / 2 && right <= MAX / 2;
+	case OpCode::MUL:
+		return left <= 1 || right <= MAX / left;
+	case OpCode::DIV:
+		return right != 0 && (right >= 1 || left <= MAX * right);
+	default:
+		return true;
+	}
+}
+
+// Applies an operation to the nodes of its operands, folding it if they are constants. The c operand is only
+// used by IF, which is the branch it takes when the condition is a constant
+template<size_t Capacity>
+constexpr uint32_t reduceStatic(StaticExpression<Capacity>& expression, Operation operation, uint32_t a, uint32_t b, uint32_t c = 0) {
+	using Node = typename StaticExpression<Capacity>::Node;
+	const Node& left = expression.nodes[a];
+	const Node& right = expression.nodes[b];
+
+	if (operation == Operation::NEG) {
+		if (left.opcode == OpCode::PUSH) {
+			return expression.addNode(OpCode::PUSH, 0, 0, -left.value);
+		}
+		return expression.addNode(OpCode::NEG, a);
+	}
+
+	if (operation == Operation::ABS) {
+		if (left.opcode == OpCode::PUSH) {
+			return expression.addNode(OpCode::PUSH, 0, 0, left.value < 0 ? -left.value : (left.value == 0 ? 0.0 : left.value));
+		}
+		return expression.addNode(OpCode::ABS, a);
+	}
+
+	if (operation == Operation::IF) {
+		if (left.opcode == OpCode::PUSH) {
+			return isTrue(left.value) ? b : c;
+		}
+		return expression.addNode(OpCode::SELECT, a, b, 0, c);
+	}
+
+	// The library functions aren't constexpr, the compiler folds them when the operand is a constant
+	if (operation == Operation::SQRT || isElementary(operation)) {
+		return expression.addNode(getOpCode(operation), a);
+	}
+
+	if (operation == Operation::POW && right.opcode == OpCode::PUSH) {
+		double exponent = right.value;
+
+		// The exponents are the ones of STRICT, the compiled expressions only have that precision
+		if (isIntegerPower(exponent, Precision::STRICT)) {
+			int integer = static_cast<int>(exponent);
+			bool finite = integer == -1 ? isFiniteFold(OpCode::DIV, 1, left.value)
+				: integer != 2 || isFiniteFold(OpCode::MUL, left.value, left.value);
+			if (left.opcode == OpCode::PUSH && finite) {
+				return expression.addNode(OpCode::PUSH, 0, 0, integerPower(left.value, integer));
+			}
+			return expression.addNode(OpCode::POWI, a, static_cast<uint32_t>(integer));
+		}
+	}
+
+	OpCode opcode = getOpCode(operation);
+	if (left.opcode == OpCode::PUSH && right.opcode == OpCode::PUSH && opcode != OpCode::POW && isFiniteFold(opcode, left.value, right.value)) {
+		double value = 0;
+		switch (opcode) {
+		case OpCode::SUM:
+			value = left.value + right.value;
+			break;
+		case OpCode::MIN:
+			value = left.value - right.value;
+			break;
+		case OpCode::MUL:
+			value = left.value * right.value;
+			break;
+		case OpCode::MINIMUM:
+			value = minimumOf(left.value, right.value);
+			break;
+		case OpCode::MAXIMUM:
+			value = maximumOf(left.value, right.value);
+			break;
+		default:
+			value = left.value / right.value;
+			break;
+		}
+		return expression.addNode(OpCode::PUSH, 0, 0, value);
+	}
+
+	return expression.addNode(opcode, a, b);
+}
+
+// The stack of StaticBuilder, the subset of std::vector that ShuntingYard uses
+template<typename T, size_t Capacity>
+struct StaticStack {
+	T items[Capacity] = {};
+	size_t count = 0;
+
+	constexpr void push_back(const T& item) {
+		items[count++] = item;
+	}
+
+	constexpr void pop_back() {
+		count--;
+	}
+
+	constexpr T& back() {
+		return items[count - 1];
+	}
+
+	constexpr bool empty() const {
+		return count == 0;
+	}
+
+	constexpr size_t size() const {
+		return count;
+	}
+};
+
+// The builder of the nodes of parseStaticExpression, a literal of N characters never has more than N nodes,
+// operands or pending operators. The errors throw, which makes them compile errors
+template<size_t N>
+struct StaticBuilder {
+	using Operand = uint32_t;
+
+	template<typename T>
+	using Stack = StaticStack<T, N>;
+
+	StaticExpression<N>& expression;
+
+	constexpr uint32_t number(const Lexeme& lexeme) {
+		double value = 0;
+		requireStatic(parseStaticNumber(lexeme.text, value), ErrorCode::INVALID_NUMBER);
+		return expression.addNode(OpCode::PUSH, 0, 0, value);
+	}
+
+	// The variables get their slots as they appear
+	constexpr uint32_t identifier(const Lexeme& lexeme) {
+		double value = 0;
+		if (getConstant(lexeme.text, value)) {
+			return expression.addNode(OpCode::PUSH, 0, 0, value);
+		}
+
+		size_t slot = expression.getSlot(lexeme.text);
+		if (slot == VariableTable::NOT_FOUND) {
+			slot = expression.variableCount;
+			expression.variables[expression.variableCount++] = lexeme.text;
+		}
+		return expression.addNode(OpCode::LOAD, static_cast<uint32_t>(slot));
+	}
+
+	constexpr uint32_t reduce(Operation operation, uint32_t a, uint32_t b, uint32_t c) {
+		return reduceStatic(expression, operation, a, b, c);
+	}
+
+	constexpr bool failed() const {
+		return false;
+	}
+
+	constexpr void fail(ErrorCode code, size_t, size_t) {
+		requireStatic(false, code);
+	}
+
+	constexpr bool reuseGroup(size_t, uint32_t&, size_t&) {
+		return false;
+	}
+
+	constexpr void closeGroup(size_t, size_t, uint32_t) {}
+
+	template<typename Yard>
+	constexpr bool checkpoint(Yard&) {
+		return false;
+	}
+
+	constexpr void reduced(size_t, uint32_t) {}
+
+	constexpr bool extend(Lexer&) {
+		return false;
+	}
+};
+
+template<size_t N>
+constexpr StaticExpression<N> parseStaticExpression(const char (&text)[N]) {
+	StaticExpression<N> expression;
+	StaticBuilder<N> builder{ expression };
+	ShuntingYard<StaticBuilder<N>> yard(builder, std::string_view(text, N - 1));
+	expression.root = yard.parse();
+	return expression;
+}
+
+// Every node is its own instantiation, so the compiler sees the whole expression as one inlined function
+template<const auto& Expression, size_t Index>
+constexpr double evaluateStaticNode([[maybe_unused]] const double* bindings) {
+	constexpr auto node = Expression.nodes[Index];
+
+	if constexpr (node.opcode == OpCode::PUSH) {
+		return node.value;
+	}
+	else if constexpr (node.opcode == OpCode::LOAD) {
+		return bindings[node.a];
+	}
+	else if constexpr (node.opcode == OpCode::NEG) {
+		return -evaluateStaticNode<Expression, node.a>(bindings);
+	}
+	else if constexpr (node.opcode == OpCode::POWI) {
+		return integerPower(evaluateStaticNode<Expression, node.a>(bindings), static_cast<int32_t>(node.b));
+	}
+	else if constexpr (node.opcode == OpCode::SQRT) {
+		return std::sqrt(evaluateStaticNode<Expression, node.a>(bindings));
+	}
+	else if constexpr (node.opcode == OpCode::CBRT) {
+		return std::cbrt(evaluateStaticNode<Expression, node.a>(bindings));
+	}
+	else if constexpr (node.opcode == OpCode::ABS) {
+		return std::fabs(evaluateStaticNode<Expression, node.a>(bindings));
+	}
+	else if constexpr (node.opcode == OpCode::SIN) {
+		return std::sin(evaluateStaticNode<Expression, node.a>(bindings));
+	}
+	else if constexpr (node.opcode == OpCode::COS) {
+		return std::cos(evaluateStaticNode<Expression, node.a>(bindings));
+	}
+	else if constexpr (node.opcode == OpCode::EXP) {
+		return std::exp(evaluateStaticNode<Expression, node.a>(bindings));
+	}
+	else if constexpr (node.opcode == OpCode::LOG) {
+		return std::log(evaluateStaticNode<Expression, node.a>(bindings));
+	}
+	else if constexpr (node.opcode == OpCode::SELECT) {
+		// Only the branch taken is evaluated, the compiler can still evaluate both when they are cheap
+		return isTrue(evaluateStaticNode<Expression, node.a>(bindings)) ? evaluateStaticNode<Expression, node.b>(bindings) : evaluateStaticNode<Expression, node.c>(bindings);
+	}
+	else {
+		double a = evaluateStaticNode<Expression, node.a>(bindings);
+		double b = evaluateStaticNode<Expression, node.b>(bindings);
+
+		if constexpr (node.opcode == OpCode::SUM) {
+			return a + b;
+		}
+		else if constexpr (node.opcode == OpCode::MIN) {
+			return a - b;
+		}
+		else if constexpr (node.opcode == OpCode::MUL) {
+			return a * b;
+		}
+		else if constexpr (node.opcode == OpCode::DIV) {
+			return a / b;
+		}
+		else if constexpr (node.opcode == OpCode::MINIMUM) {
+			return minimumOf(a, b);
+		}
+		else if constexpr (node.opcode == OpCode::MAXIMUM) {
+			return maximumOf(a, b);
+		}
+		else {
+			return std::pow(a, b);
+		}
+	}
+}
+
+// The expression must be a constexpr variable with static storage, like the result of parseStaticExpression
+template<const auto& Expression>
+struct StaticFormula {
+	static constexpr bool IS_CONSTANT = Expression.isConstant();
+	static constexpr size_t VARIABLE_COUNT = Expression.variableCount;
+
+	// The bindings are in the order of the slots of the expression, a constant doesn't need them
+	static constexpr double evaluate(const double* bindings = nullptr) {
+		return evaluateStaticNode<Expression, Expression.root>(bindings);
+	}
+
+	double operator()(const double* bindings) const {
+		return evaluate(bindings);
+	}
+};
+
+// Batch evaluation
+
+// Evaluates one program over columns of values, every instruction is applied to a whole block of values at once
+// so the dispatch is paid once per block and the arithmetic runs in SIMD kernels
+
+constexpr size_t BATCH_BLOCK_SIZE = 256;
+
+// The kernels are written once for a generic value so the vector body and the scalar tail do the same operation
+struct SumKernel {
+	template<typename T> static T apply(T a, T b) { return a + b; }
+};
+
+struct MinKernel {
+	template<typename T> static T apply(T a, T b) { return a - b; }
+};
+
+struct MulKernel {
+	template<typename T> static T apply(T a, T b) { return a * b; }
+};
+
+struct DivKernel {
+	template<typename T> static T apply(T a, T b) { return a / b; }
+};
+
+template<typename Kernel>
+void binaryKernel(const double* a, const double* b, double* result, size_t count) {
+	size_t i = 0;
+	for (; i + SimdDouble::WIDTH <= count; i += SimdDouble::WIDTH) {
+		Kernel::apply(SimdDouble::load(a + i), SimdDouble::load(b + i)).store(result + i);
+	}
+	for (; i < count; i++) {
+		result[i] = Kernel::apply(a[i], b[i]);
+	}
+}
+
+void negateKernel(const double* a, double* result, size_t count) {
+	size_t i = 0;
+	for (; i + SimdDouble::WIDTH <= count; i += SimdDouble::WIDTH) {
+		(-SimdDouble::load(a + i)).store(result + i);
+	}
+	for (; i < count; i++) {
+		result[i] = -a[i];
+	}
+}
+
+void sqrtKernel(const double* a, double* result, size_t count) {
+	size_t i = 0;
+	for (; i + SimdDouble::WIDTH <= count; i += SimdDouble::WIDTH) {
+		sqrt(SimdDouble::load(a + i)).store(result + i);
+	}
+	for (; i < count; i++) {
+		result[i] = std::sqrt(a[i]);
+	}
+}
+
+void cbrtKernel(const double* a, double* result, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		result[i] = std::cbrt(a[i]);
+	}
+}
+
+// Same multiplications as integerPower, the exponent is shared by the whole block so every lane follows the same steps
+void integerPowerKernel(const double* a, int exponent, double* result, size_t count) {
+	unsigned int n = exponent < 0 ? -static_cast<unsigned int>(exponent) : exponent;
+	SimdDouble one = SimdDouble::broadcast(1);
+
+	size_t i = 0;
+	for (; i + SimdDouble::WIDTH <= count; i += SimdDouble::WIDTH) {
+		SimdDouble base = SimdDouble::load(a + i);
+		SimdDouble value = one;
+
+		for (unsigned int bits = n; bits != 0; bits >>= 1) {
+			if (bits & 1) {
+				value = value * base;
+			}
+			base = base * base;
+		}
+
+		(exponent < 0 ? one / value : value).store(result + i);
+	}
+	for (; i < count; i++) {
+		result[i] = integerPower(a[i], exponent);
+	}
+}
+
+// There is no vector instruction for the power so it is a plain loop the compiler can still unroll
+void powerKernel(const double* a, const double* b, double* result, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		result[i] = std::pow(a[i], b[i]);
+	}
+}
+
+// The kernels of the functions are plain loops without branches, the compiler vectorizes them with its own
+// minimum, maximum, and and blend instructions
+void minimumKernel(const double* a, const double* b, double* result, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		result[i] = minimumOf(a[i], b[i]);
+	}
+}
+
+void maximumKernel(const double* a, const double* b, double* result, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		result[i] = maximumOf(a[i], b[i]);
+	}
+}
+
+void absKernel(const double* a, double* result, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		result[i] = std::fabs(a[i]);
+	}
+}
+
+void selectKernel(const double* condition, const double* then, const double* otherwise, double* result, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		result[i] = isTrue(condition[i]) ? then[i] : otherwise[i];
+	}
+}
+
+// The fast functions only have the vector version, the scalar tail runs them on one lane as the scalar engines.
+// The sine and cosine also have the scalar version with the limit of the reduction
+struct FastSinKernel {
+	static SimdDouble apply(SimdDouble a) { return fastSinCos<false>(a); }
+	static double scalar(double a) { return fastSin(a); }
+};
+
+struct FastCosKernel {
+	static SimdDouble apply(SimdDouble a) { return fastSinCos<true>(a); }
+	static double scalar(double a) { return fastCos(a); }
+};
+
+struct FastExpKernel {
+	static SimdDouble apply(SimdDouble a) { return fastExp(a); }
+};
+
+struct FastLogKernel {
+	static SimdDouble apply(SimdDouble a) { return fastLog(a); }
+};
+
+template<typename Kernel>
+void unaryKernel(const double* a, double* result, size_t count) {
+	size_t i = 0;
+	for (; i + SimdDouble::WIDTH <= count; i += SimdDouble::WIDTH) {
+		Kernel::apply(SimdDouble::load(a + i)).store(result + i);
+	}
+	for (; i < count; i++) {
+		result[i] = Kernel::apply(SimdDouble::broadcast(a[i])).first();
+	}
+}
+
+// A block with any argument beyond the limit of the reduction, inf or NaN runs the scalar version, which calls
+// the C library for them. The result can be the same block as the arguments, so they are checked first
+template<typename Kernel>
+void trigonometricKernel(const double* a, double* result, size_t count) {
+	bool reduced = true;
+	for (size_t i = 0; i < count; i++) {
+		reduced &= std::fabs(a[i]) < FAST_TRIGONOMETRIC_LIMIT;
+	}
+
+	if (reduced) {
+		unaryKernel<Kernel>(a, result, count);
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		result[i] = Kernel::scalar(a[i]);
+	}
+}
+
+// The C library has no vector versions of its functions, so the strict ones are plain loops
+template<double (*Function)(double)>
+void libraryKernel(const double* a, double* result, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		result[i] = Function(a[i]);
+	}
+}
+
+void elementaryKernel(OpCode opcode, const double* a, double* result, size_t count) {
+	switch (opcode) {
+	case OpCode::SIN:
+		libraryKernel<std::sin>(a, result, count);
+		break;
+	case OpCode::COS:
+		libraryKernel<std::cos>(a, result, count);
+		break;
+	case OpCode::EXP:
+		libraryKernel<std::exp>(a, result, count);
+		break;
+	case OpCode::LOG:
+		libraryKernel<std::log>(a, result, count);
+		break;
+	case OpCode::FAST_SIN:
+		trigonometricKernel<FastSinKernel>(a, result, count);
+		break;
+	case OpCode::FAST_COS:
+		trigonometricKernel<FastCosKernel>(a, result, count);
+		break;
+	case OpCode::FAST_EXP:
+		unaryKernel<FastExpKernel>(a, result, count);
+		break;
+	default:
+		unaryKernel<FastLogKernel>(a, result, count);
+		break;
+	}
+}
+
+// Each column holds the values of one variable, columns[slot][i] is the value of the variable in the row i.
+// A lazy IF only evaluates the branches some row of the block takes: when all the rows agree only that branch is
+// evaluated, otherwise both are evaluated for the whole block and every row selects its own value at the JOIN
+void executeProgramBatch(const ProgramView& program, const double* const* columns, double* out, size_t count) {
+	// Every stack position owns a block of values, the stack entries point to it or directly to a column
+	// so loading a variable doesn't copy its values. The blocks of the temporaries go after the ones of the stack
+	std::vector<double> buffers(std::max<size_t>(program.stackSize + program.temporaryCount, 1) * BATCH_BLOCK_SIZE);
+	std::vector<const double*> stack(std::max<size_t>(program.stackSize, 1));
+	double* temporaries = &buffers[program.stackSize * BATCH_BLOCK_SIZE];
+
+	// The IFs being evaluated, the ones that take both branches keep the condition and the value of the then
+	// branch in two blocks of their nesting depth
+	enum class Taken : uint8_t { THEN, ELSE, BOTH };
+	std::vector<Taken> branches;
+	std::vector<double> branchBuffers;
+
+	for (size_t start = 0; start < count; start += BATCH_BLOCK_SIZE) {
+		size_t blockSize = std::min(BATCH_BLOCK_SIZE, count - start);
+		size_t top = 0; // Next free position of the stack
+
+		for (size_t i = 0; i < program.size(); i++) {
+			OpCode opcode = program.opcodes[i];
+
+			switch (opcode) {
+			case OpCode::PUSH: {
+				double* buffer = &buffers[top * BATCH_BLOCK_SIZE];
+				std::fill(buffer, buffer + blockSize, program.constants[program.a[i]]);
+				stack[top++] = buffer;
+				break;
+			}
+			case OpCode::LOAD:
+				stack[top++] = columns[program.a[i]] + start;
+				break;
+			case OpCode::SAVE:
+				std::copy(stack[top - 1], stack[top - 1] + blockSize, &temporaries[program.b[i] * BATCH_BLOCK_SIZE]);
+				break;
+			case OpCode::RECALL: {
+				// Copied, the temporary can be saved again while this value is still on the stack
+				const double* temporary = &temporaries[program.a[i] * BATCH_BLOCK_SIZE];
+				double* buffer = &buffers[top * BATCH_BLOCK_SIZE];
+				std::copy(temporary, temporary + blockSize, buffer);
+				stack[top++] = buffer;
+				break;
+			}
+			case OpCode::SELECT: {
+				top -= 2;
+				double* buffer = &buffers[(top - 1) * BATCH_BLOCK_SIZE];
+				selectKernel(stack[top - 1], stack[top], stack[top + 1], buffer, blockSize);
+				stack[top - 1] = buffer;
+				break;
+			}
+			case OpCode::BRANCH: {
+				const double* condition = stack[--top];
+				size_t taken = 0;
+				for (size_t row = 0; row < blockSize; row++) {
+					taken += isTrue(condition[row]);
+				}
+
+				if (taken == blockSize) {
+					branches.push_back(Taken::THEN);
+				}
+				else if (taken == 0) {
+					branches.push_back(Taken::ELSE);
+					i = program.b[i] - 1;
+				}
+				else {
+					branches.push_back(Taken::BOTH);
+					branchBuffers.resize(std::max(branchBuffers.size(), 2 * branches.size() * BATCH_BLOCK_SIZE));
+					std::copy(condition, condition + blockSize, &branchBuffers[2 * (branches.size() - 1) * BATCH_BLOCK_SIZE]);
+				}
+				break;
+			}
+			case OpCode::JUMP:
+				if (branches.back() == Taken::BOTH) {
+					top--;
+					std::copy(stack[top], stack[top] + blockSize, &branchBuffers[(2 * branches.size() - 1) * BATCH_BLOCK_SIZE]);
+				}
+				else {
+					i = program.b[i] - 1;
+				}
+				break;
+			case OpCode::JOIN:
+				if (branches.back() == Taken::BOTH) {
+					const double* condition = &branchBuffers[2 * (branches.size() - 1) * BATCH_BLOCK_SIZE];
+					double* buffer = &buffers[(top - 1) * BATCH_BLOCK_SIZE];
+					selectKernel(condition, condition + BATCH_BLOCK_SIZE, stack[top - 1], buffer, blockSize);
+					stack[top - 1] = buffer;
+				}
+				branches.pop_back();
+				break;
+			case OpCode::NEG:
+			case OpCode::POWI:
+			case OpCode::SQRT:
+			case OpCode::CBRT:
+			case OpCode::ABS: {
+				double* buffer = &buffers[(top - 1) * BATCH_BLOCK_SIZE];
+
+				if (opcode == OpCode::NEG) {
+					negateKernel(stack[top - 1], buffer, blockSize);
+				}
+				else if (opcode == OpCode::ABS) {
+					absKernel(stack[top - 1], buffer, blockSize);
+				}
+				else if (opcode == OpCode::POWI) {
+					integerPowerKernel(stack[top - 1], static_cast<int32_t>(program.b[i]), buffer, blockSize);
+				}
+				else if (opcode == OpCode::SQRT) {
+					sqrtKernel(stack[top - 1], buffer, blockSize);
+				}
+				else {
+					cbrtKernel(stack[top - 1], buffer, blockSize);
+				}
+
+				stack[top - 1] = buffer;
+				break;
+			}
+			case OpCode::SIN:
+			case OpCode::COS:
+			case OpCode::EXP:
+			case OpCode::LOG:
+			case OpCode::FAST_SIN:
+			case OpCode::FAST_COS:
+			case OpCode::FAST_EXP:
+			case OpCode::FAST_LOG: {
+				double* buffer = &buffers[(top - 1) * BATCH_BLOCK_SIZE];
+				elementaryKernel(opcode, stack[top - 1], buffer, blockSize);
+				stack[top - 1] = buffer;
+				break;
+			}
+			default: {
+				top--;
+				double* buffer = &buffers[(top - 1) * BATCH_BLOCK_SIZE];
+				const double* a = stack[top - 1];
+				const double* b = stack[top];
+
+				switch (opcode) {
+				case OpCode::SUM:
+					binaryKernel<SumKernel>(a, b, buffer, blockSize);
+					break;
+				case OpCode::MIN:
+					binaryKernel<MinKernel>(a, b, buffer, blockSize);
+					break;
+				case OpCode::MUL:
+					binaryKernel<MulKernel>(a, b, buffer, blockSize);
+					break;
+				case OpCode::DIV:
+					binaryKernel<DivKernel>(a, b, buffer, blockSize);
+					break;
+				case OpCode::POW:
+					powerKernel(a, b, buffer, blockSize);
+					break;
+				case OpCode::MINIMUM:
+					minimumKernel(a, b, buffer, blockSize);
+					break;
+				case OpCode::MAXIMUM:
+					maximumKernel(a, b, buffer, blockSize);
+					break;
+				default:
+					break;
+				}
+
+				stack[top - 1] = buffer;
+				break;
+			}
+			}
+		}
+
+		std::copy(stack[0], stack[0] + blockSize, out + start);
+	}
+}
+
+void executeProgramBatch(const Program& program, const double* const* columns, double* out, size_t count) {
+	executeProgramBatch(program.view(), columns, out, count);
+}
+
+// Native code
+
+// The hot programs are translated to machine code, a function that takes the bindings and returns the result.
+// The stack of the program is mapped to registers: the position k of the stack lives in xmm<k> for the first
+// REGISTER_SLOTS positions and in the frame of the function for the deeper ones, so a program evaluates without
+// touching memory except for the bindings and the constants. The calls to pow and cbrt clobber every xmm register,
+// so the live positions are saved in the frame around them.
+
+using NativeFunction = double (*)(const double* bindings);
+
+constexpr uint32_t DEFAULT_JIT_THRESHOLD = 1000; // Evaluations of an expression before it is compiled to native code
+
+// Executable memory with the code of one program followed by its constants
+class NativeCode {
+public:
+	NativeCode(const NativeCode&) = delete;
+	NativeCode& operator=(const NativeCode&) = delete;
+
+	~NativeCode() {
+#ifdef CALCULATOR_HAS_JIT
+		munmap(memory, size);
+#endif
+	}
+
+	NativeFunction getFunction() const {
+		return function;
+	}
+
+	size_t getSize() const {
+		return size;
+	}
+
+	// Copies the code to new memory and makes it executable, returns null if the system doesn't allow it
+	static std::unique_ptr<NativeCode> create(const std::vector<uint8_t>& code) {
+#ifdef CALCULATOR_HAS_JIT
+		size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		size_t size = (code.size() + pageSize - 1) / pageSize * pageSize;
+
+		// Written first and made executable after, the memory is never writable and executable at once
+		void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED) {
+			return nullptr;
+		}
+
+		std::memcpy(memory, code.data(), code.size());
+		if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+			munmap(memory, size);
+			return nullptr;
+		}
+
+		return std::unique_ptr<NativeCode>(new NativeCode(memory, size));
+#else
+		(void)code;
+		return nullptr;
+#endif
+	}
+
+private:
+	void* memory;
+	size_t size;
+	NativeFunction function;
+
+	NativeCode(void* memory, size_t size) : memory(memory), size(size) {
+		static_assert(sizeof(NativeFunction) == sizeof(void*), "The code address must fit a function pointer");
+		std::memcpy(&function, &memory, sizeof(function));
+	}
+};
+
+// Emits the x86-64 instructions used by the native code, only the SSE2 scalar double instructions and a few
+// integer ones. The registers are numbers, 0 to 15 for both the xmm and the general purpose registers
+class X86Assembler {
+public:
+	static constexpr int RAX = 0, RSP = 4, RBX = 3, RDI = 7, R12 = 12;
+
+	std::vector<uint8_t> code;
+
+	void byte(uint8_t value) {
+		code.push_back(value);
+	}
+
+	void u32(uint32_t value) {
+		for (int i = 0; i < 4; i++) {
+			byte(static_cast<uint8_t>(value >> (8 * i)));
+		}
+	}
+
+	void u64(uint64_t value) {
+		for (int i = 0; i < 8; i++) {
+			byte(static_cast<uint8_t>(value >> (8 * i)));
+		}
+	}
+
+	// The prefix selects the instruction with the opcode, F2 for the scalar doubles and 66 for the packed ones
+	void sseRegister(uint8_t prefix, uint8_t opcode, int reg, int rm) {
+		byte(prefix);
+		rex(false, reg, rm);
+		byte(0x0F);
+		byte(opcode);
+		modrm(3, reg, rm);
+	}
+
+	void sseMemory(uint8_t prefix, uint8_t opcode, int reg, int base, int32_t displacement) {
+		byte(prefix);
+		rex(false, reg, base);
+		byte(0x0F);
+		byte(opcode);
+		memoryOperand(reg, base, displacement);
+	}
+
+	void movsdLoad(int xmm, int base, int32_t displacement) {
+		sseMemory(0xF2, 0x10, xmm, base, displacement);
+	}
+
+	void movsdStore(int base, int32_t displacement, int xmm) {
+		sseMemory(0xF2, 0x11, xmm, base, displacement);
+	}
+
+	void movapd(int destination, int source) {
+		if (destination != source) {
+			sseRegister(0x66, 0x28, destination, source);
+		}
+	}
+
+	// Flips the sign bit going through rax, so no constant is needed for it
+	void negate(int xmm) {
+		byte(0x66); // movq rax, xmm
+		rex(true, xmm, RAX);
+		byte(0x0F);
+		byte(0x7E);
+		modrm(3, xmm, RAX);
+
+		byte(0x48); // btc rax, 63
+		byte(0x0F);
+		byte(0xBA);
+		modrm(3, 7, RAX);
+		byte(63);
+
+		byte(0x66); // movq xmm, rax
+		rex(true, xmm, RAX);
+		byte(0x0F);
+		byte(0x6E);
+		modrm(3, xmm, RAX);
+	}
+
+	void push(int reg) {
+		rex(false, 0, reg);
+		byte(0x50 + (reg & 7));
+	}
+
+	void pop(int reg) {
+		rex(false, 0, reg);
+		byte(0x58 + (reg & 7));
+	}
+
+	void moveRegister(int destination, int source) {
+		rex(true, source, destination);
+		byte(0x89);
+		modrm(3, source, destination);
+	}
+
+	void addStack(int32_t amount) {
+		byte(0x48);
+		byte(0x81);
+		modrm(3, amount < 0 ? 5 : 0, RSP); // sub or add
+		u32(static_cast<uint32_t>(amount < 0 ? -amount : amount));
+	}
+
+	// lea reg, [rip + displacement], returns the position of the displacement to patch it once the target is known
+	size_t leaRelative(int reg) {
+		rex(true, reg, 0);
+		byte(0x8D);
+		modrm(0, reg, 5);
+		size_t position = code.size();
+		u32(0);
+		return position;
+	}
+
+	// jcc rel32 with the second byte of its opcode, 0x84 is je and 0x8A is jp. Returns the position of the
+	// displacement to patch once the target is known
+	size_t jumpIf(uint8_t condition) {
+		byte(0x0F);
+		byte(condition);
+		size_t position = code.size();
+		u32(0);
+		return position;
+	}
+
+	// jmp rel32, patched as jumpIf
+	size_t jump() {
+		byte(0xE9);
+		size_t position = code.size();
+		u32(0);
+		return position;
+	}
+
+	// The displacement is relative to the end of the instruction, which is the end of the displacement itself
+	void patchRelative(size_t position, size_t target) {
+		uint32_t displacement = static_cast<uint32_t>(target - (position + 4));
+		for (int i = 0; i < 4; i++) {
+			code[position + i] = static_cast<uint8_t>(displacement >> (8 * i));
+		}
+	}
+
+	void call(const void* function) {
+		byte(0x48); // movabs rax, function
+		byte(0xB8);
+		u64(reinterpret_cast<uintptr_t>(function));
+		byte(0xFF); // call rax
+		modrm(3, 2, RAX);
+	}
+
+	void ret() {
+		byte(0xC3);
+	}
+
+private:
+	void rex(bool wide, int reg, int rm) {
+		uint8_t value = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+		if (value != 0x40) {
+			byte(value);
+		}
+	}
+
+	void modrm(int mode, int reg, int rm) {
+		byte(static_cast<uint8_t>((mode << 6) | ((reg & 7) << 3) | (rm & 7)));
+	}
+
+	// [base + displacement32], the bases rsp and r12 need a SIB byte
+	void memoryOperand(int reg, int base, int32_t displacement) {
+		modrm(2, reg, base);
+		if ((base & 7) == 4) {
+			byte(0x24);
+		}
+		u32(static_cast<uint32_t>(displacement));
+	}
+};
+
+// Translates programs to native code, the programs that are too big return null and stay in the bytecode
+class NativeCompiler {
+public:
+	static constexpr int REGISTER_SLOTS = 14; // xmm0 to xmm13, xmm14 and xmm15 are scratch registers
+	static constexpr size_t MAX_FRAME_SLOTS = 4096; // Stack positions and temporaries, the frame must fit in the stack of any thread
+	static constexpr size_t MAX_NODES = 1 << 20;
+
+	static std::unique_ptr<NativeCode> compile(const ProgramView& program) {
+#ifdef CALCULATOR_HAS_JIT
+		if (program.size() == 0 || program.size() > MAX_NODES || program.stackSize + program.temporaryCount > MAX_FRAME_SLOTS) {
+			return nullptr;
+		}
+
+		NativeCompiler compiler(program);
+		compiler.emit();
+		return NativeCode::create(compiler.assembler.code);
+#else
+		(void)program;
+		return nullptr;
+#endif
+	}
+
+private:
+	static constexpr int SCRATCH_A = 14, SCRATCH_B = 15;
+
+	const ProgramView& program;
+	X86Assembler assembler;
+	int32_t frameSize;
+	int32_t oneOffset; // Offset of the constant 1 in the constants, used by the negative integer powers
+	int32_t absMaskOffset; // Offset of the mask that clears the sign bit, used by ABS
+
+	explicit NativeCompiler(const ProgramView& program) : program(program) {
+		// The positions of the stack live at [rsp + 8 * k] followed by the temporaries, the frame keeps rsp aligned
+		// to 16 for the calls
+		frameSize = static_cast<int32_t>(((8 * (program.stackSize + program.temporaryCount) + 8 + 15) & ~size_t(15)) - 8);
+		oneOffset = static_cast<int32_t>(8 * program.constantCount);
+		absMaskOffset = oneOffset + 8;
+	}
+
+	static int32_t home(size_t slot) {
+		return static_cast<int32_t>(8 * slot);
+	}
+
+	int32_t temporaryHome(size_t temporary) const {
+		return home(program.stackSize + temporary);
+	}
+
+	bool inRegister(size_t slot) const {
+		return slot < static_cast<size_t>(REGISTER_SLOTS);
+	}
+
+	// Returns the register with the value of the slot, loading it into the scratch register if it lives in the frame
+	int fetch(size_t slot, int scratch) {
+		if (inRegister(slot)) {
+			return static_cast<int>(slot);
+		}
+		assembler.movsdLoad(scratch, X86Assembler::RSP, home(slot));
+		return scratch;
+	}
+
+	// Writes back the result computed in the register returned by fetch
+	void writeBack(size_t slot, int reg) {
+		if (!inRegister(slot)) {
+			assembler.movsdStore(X86Assembler::RSP, home(slot), reg);
+		}
+	}
+
+	void load(size_t slot, int base, int32_t displacement) {
+		if (inRegister(slot)) {
+			assembler.movsdLoad(static_cast<int>(slot), base, displacement);
+		}
+		else {
+			assembler.movsdLoad(SCRATCH_A, base, displacement);
+			assembler.movsdStore(X86Assembler::RSP, home(slot), SCRATCH_A);
+		}
+	}
+
+	// x^n with the same multiplications as integerPower, so the result is the same to the last bit
+	void emitIntegerPower(int reg, int exponent) {
+		unsigned int n = exponent < 0 ? -static_cast<unsigned int>(exponent) : exponent;
+		int base = SCRATCH_B;
+
+		if (n == 0) {
+			assembler.movsdLoad(reg, X86Assembler::R12, oneOffset);
+			return;
+		}
+
+		assembler.movapd(base, reg);
+		bool first = true;
+		while (n != 0) {
+			if (n & 1) {
+				if (first) {
+					assembler.movapd(reg, base); // 1 * base is exact, so the first multiplication is a copy
+					first = false;
+				}
+				else {
+					assembler.sseRegister(0xF2, 0x59, reg, base);
+				}
+			}
+
+			n >>= 1;
+			if (n != 0) {
+				assembler.sseRegister(0xF2, 0x59, base, base);
+			}
+		}
+
+		if (exponent < 0) {
+			assembler.movsdLoad(base, X86Assembler::R12, oneOffset);
+			assembler.sseRegister(0xF2, 0x5E, base, reg);
+			assembler.movapd(reg, base);
+		}
+	}
+
+	// The calls don't keep any xmm register, so every position in a register is saved before and loaded after
+	void emitCall(const void* function, size_t top, size_t arguments) {
+		size_t live = std::min<size_t>(top, REGISTER_SLOTS);
+		for (size_t slot = 0; slot < live; slot++) {
+			assembler.movsdStore(X86Assembler::RSP, home(slot), static_cast<int>(slot));
+		}
+
+		size_t result = top - arguments;
+		for (size_t i = 0; i < arguments; i++) {
+			assembler.movsdLoad(static_cast<int>(i), X86Assembler::RSP, home(result + i));
+		}
+
+		assembler.call(function);
+		assembler.movsdStore(X86Assembler::RSP, home(result), 0);
+
+		for (size_t slot = 0; slot < std::min<size_t>(result + 1, REGISTER_SLOTS); slot++) {
+			assembler.movsdLoad(static_cast<int>(slot), X86Assembler::RSP, home(slot));
+		}
+	}
+
+	// Picks the then or the else value with the mask of the condition, (mask & then) | (~mask & else), so the
+	// result doesn't depend on a branch the processor could mispredict
+	void emitSelect(size_t top) {
+		int condition = fetch(top - 3, SCRATCH_A);
+		assembler.sseRegister(0x66, 0x57, SCRATCH_B, SCRATCH_B); // xorpd
+		assembler.sseRegister(0xF2, 0xC2, SCRATCH_B, condition); // cmpneqsd, NaN isn't equal so it is true
+		assembler.byte(4);
+
+		size_t then = top - 2, otherwise = top - 1;
+		if (inRegister(then)) {
+			assembler.movapd(SCRATCH_A, static_cast<int>(then));
+		}
+		else {
+			assembler.movsdLoad(SCRATCH_A, X86Assembler::RSP, home(then));
+		}
+		assembler.sseRegister(0x66, 0x54, SCRATCH_A, SCRATCH_B); // andpd
+
+		if (inRegister(otherwise)) {
+			assembler.sseRegister(0x66, 0x55, SCRATCH_B, static_cast<int>(otherwise)); // andnpd
+		}
+		else if (inRegister(then)) {
+			// The register of the then value is free once it is copied
+			assembler.movsdLoad(static_cast<int>(then), X86Assembler::RSP, home(otherwise));
+			assembler.sseRegister(0x66, 0x55, SCRATCH_B, static_cast<int>(then));
+		}
+		else {
+			assembler.movsdStore(X86Assembler::RSP, home(then), SCRATCH_A);
+			assembler.movsdLoad(SCRATCH_A, X86Assembler::RSP, home(otherwise));
+			assembler.sseRegister(0x66, 0x55, SCRATCH_B, SCRATCH_A);
+			assembler.movsdLoad(SCRATCH_A, X86Assembler::RSP, home(then));
+		}
+		assembler.sseRegister(0x66, 0x56, SCRATCH_A, SCRATCH_B); // orpd
+
+		if (inRegister(top - 3)) {
+			assembler.movapd(static_cast<int>(top - 3), SCRATCH_A);
+		}
+		else {
+			assembler.movsdStore(X86Assembler::RSP, home(top - 3), SCRATCH_A);
+		}
+	}
+
+	void emit() {
+		using Power = double (*)(double, double);
+		using Root = double (*)(double);
+		static const Power power = std::pow;
+		static const Root cubeRoot = std::cbrt;
+		static const Root elementary[] = { std::sin, std::cos, std::exp, std::log, fastSin, fastCos, fastExp, fastLog }; // In the order of their opcodes
+
+		// rbx keeps the bindings and r12 the constants, both are kept by the calls
+		assembler.push(X86Assembler::RBX);
+		assembler.push(X86Assembler::R12);
+		assembler.moveRegister(X86Assembler::RBX, X86Assembler::RDI);
+		size_t constantsPatch = assembler.leaRelative(X86Assembler::R12);
+		assembler.addStack(-frameSize);
+
+		size_t top = 0; // Number of values on the stack
+
+		// The jumps of the lazy IFs go forward, they are patched once the code of their target node is emitted
+		std::vector<size_t> nodeOffsets(program.size());
+		std::vector<std::pair<size_t, uint32_t>> jumps; // Displacement to patch and its target node
+
+		for (size_t i = 0; i < program.size(); i++) {
+			OpCode opcode = program.opcodes[i];
+			nodeOffsets[i] = assembler.code.size();
+
+			switch (opcode) {
+			case OpCode::PUSH:
+				load(top++, X86Assembler::R12, static_cast<int32_t>(8 * program.a[i]));
+				break;
+			case OpCode::LOAD:
+				load(top++, X86Assembler::RBX, static_cast<int32_t>(8 * program.a[i]));
+				break;
+			case OpCode::SUM:
+			case OpCode::MIN:
+			case OpCode::MUL:
+			case OpCode::DIV: {
+				static constexpr uint8_t OPCODES[] = { 0x58, 0x5C, 0x59, 0x5E }; // addsd, subsd, mulsd, divsd
+
+				int a = fetch(top - 2, SCRATCH_A);
+				int b = fetch(top - 1, SCRATCH_B);
+				assembler.sseRegister(0xF2, OPCODES[static_cast<int>(opcode) - static_cast<int>(OpCode::SUM)], a, b);
+				writeBack(top - 2, a);
+				top--;
+				break;
+			}
+			case OpCode::MINIMUM:
+			case OpCode::MAXIMUM: {
+				int a = fetch(top - 2, SCRATCH_A);
+				int b = fetch(top - 1, SCRATCH_B);
+				assembler.sseRegister(0xF2, opcode == OpCode::MINIMUM ? 0x5D : 0x5F, a, b); // minsd, maxsd
+				writeBack(top - 2, a);
+				top--;
+				break;
+			}
+			case OpCode::NEG:
+			case OpCode::SQRT:
+			case OpCode::POWI:
+			case OpCode::ABS: {
+				int a = fetch(top - 1, SCRATCH_A);
+				if (opcode == OpCode::NEG) {
+					assembler.negate(a);
+				}
+				else if (opcode == OpCode::ABS) {
+					assembler.movsdLoad(SCRATCH_B, X86Assembler::R12, absMaskOffset);
+					assembler.sseRegister(0x66, 0x54, a, SCRATCH_B); // andpd
+				}
+				else if (opcode == OpCode::SQRT) {
+					assembler.sseRegister(0xF2, 0x51, a, a);
+				}
+				else {
+					emitIntegerPower(a, static_cast<int32_t>(program.b[i]));
+				}
+				writeBack(top - 1, a);
+				break;
+			}
+			case OpCode::POW:
+				emitCall(reinterpret_cast<const void*>(power), top, 2);
+				top--;
+				break;
+			case OpCode::CBRT:
+				emitCall(reinterpret_cast<const void*>(cubeRoot), top, 1);
+				break;
+			case OpCode::SIN:
+			case OpCode::COS:
+			case OpCode::EXP:
+			case OpCode::LOG:
+			case OpCode::FAST_SIN:
+			case OpCode::FAST_COS:
+			case OpCode::FAST_EXP:
+			case OpCode::FAST_LOG:
+				emitCall(reinterpret_cast<const void*>(elementary[static_cast<size_t>(opcode) - static_cast<size_t>(OpCode::SIN)]), top, 1);
+				break;
+			case OpCode::SAVE:
+				assembler.movsdStore(X86Assembler::RSP, temporaryHome(program.b[i]), fetch(top - 1, SCRATCH_A));
+				break;
+			case OpCode::RECALL:
+				load(top++, X86Assembler::RSP, temporaryHome(program.a[i]));
+				break;
+			case OpCode::SELECT:
+				emitSelect(top);
+				top -= 2;
+				break;
+			case OpCode::BRANCH: {
+				// ucomisd sets the parity flag for NaN, which takes the then branch, and the zero flag for 0 or NaN
+				int condition = fetch(top - 1, SCRATCH_A);
+				assembler.sseRegister(0x66, 0x57, SCRATCH_B, SCRATCH_B); // xorpd
+				assembler.sseRegister(0x66, 0x2E, condition, SCRATCH_B); // ucomisd
+				size_t nan = assembler.jumpIf(0x8A); // jp
+				jumps.emplace_back(assembler.jumpIf(0x84), program.b[i]); // je
+				assembler.patchRelative(nan, assembler.code.size());
+				top--;
+				break;
+			}
+			case OpCode::JUMP:
+				// The else branch puts its value in the same position as the then branch
+				jumps.emplace_back(assembler.jump(), program.b[i]);
+				top--;
+				break;
+			case OpCode::JOIN:
+				break;
+			}
+		}
+
+		for (const auto& [position, target] : jumps) {
+			assembler.patchRelative(position, nodeOffsets[target]);
+		}
+
+		// The result is the position 0, which is always xmm0
+		assembler.addStack(frameSize);
+		assembler.pop(X86Assembler::R12);
+		assembler.pop(X86Assembler::RBX);
+		assembler.ret();
+
+		// The constants go after the code, aligned, followed by the 1 of the integer powers and the mask of ABS
+		while (assembler.code.size() % 8 != 0) {
+			assembler.byte(0xCC);
+		}
+		assembler.patchRelative(constantsPatch, assembler.code.size());
+
+		for (size_t i = 0; i < program.constantCount; i++) {
+			uint64_t bits;
+			std::memcpy(&bits, &program.constants[i], sizeof(bits));
+			assembler.u64(bits);
+		}
+
+		uint64_t one;
+		double oneValue = 1;
+		std::memcpy(&one, &oneValue, sizeof(one));
+		assembler.u64(one);
+		assembler.u64(0x7FFFFFFFFFFFFFFFull);
+	}
+};
+
+// Counts the evaluations of an expression and holds its native code once it is hot. Several threads can evaluate
+// the same expression, the first one that sees it reach the threshold compiles it and the rest keep using the
+// bytecode until the code is published. A copy starts counting again from zero
+class JitState {
+public:
+	JitState() = default;
+
+	JitState(const JitState& other) : threshold(other.threshold) {}
+
+	// Only moved while no other thread uses it, so the code moves with the function that points into it
+	JitState(JitState&& other) noexcept
+		: threshold(other.threshold), evaluations(other.evaluations.load()), compiling(other.compiling.load()),
+		function(other.function.load()), code(std::move(other.code)) {}
+
+	JitState& operator=(const JitState&) = delete;
+	JitState& operator=(JitState&&) = delete;
+
+	// 0 never compiles
+	void setThreshold(uint32_t threshold) {
+		this->threshold = threshold;
+	}
+
+	// Returns the native function if there is one, counting one more evaluation until then
+	NativeFunction getFunction(const ProgramView& program) const {
+		NativeFunction current = function.load(std::memory_order_acquire);
+		if (current != nullptr || threshold == 0) {
+			return current;
+		}
+
+		// The count doesn't need to be exact, so it isn't a read modify write that would serialize the threads
+		uint32_t count = evaluations.load(std::memory_order_relaxed);
+		if (count < threshold) {
+			evaluations.store(count + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		if (compiling.load(std::memory_order_relaxed) || compiling.exchange(true, std::memory_order_acquire)) {
+			return nullptr; // Compiled by another thread, or it can't be compiled
+		}
+
+		code = NativeCompiler::compile(program);
+		if (code) {
+			function.store(code->getFunction(), std::memory_order_release);
+			countEvent(Counter::NATIVE_COMPILATIONS);
+		}
+		return code ? code->getFunction() : nullptr;
+	}
+
+	bool isCompiled() const {
+		return function.load(std::memory_order_acquire) != nullptr;
+	}
+
+private:
+	uint32_t threshold = DEFAULT_JIT_THRESHOLD;
+	mutable std::atomic<uint32_t> evaluations{ 0 };
+	mutable std::atomic<bool> compiling{ false }; // Set by the thread that compiles, it is never cleared
+	mutable std::atomic<NativeFunction> function{ nullptr };
+	mutable std::unique_ptr<NativeCode> code; // Only written by the thread that set compiling
+};
+
+// Compiled expressions
+
+// An expression that is parsed once and then evaluated many times with different values for its variables
+// Only the program is kept, the tree is released once it is lowered
+struct CompiledExpression {
+	VariableTable variables;
+	Program program;
+	size_t eliminatedNodes = 0; // Tokens removed by the optimizer
+	JitState jit;
+
+	// The bindings hold one value for each variable, in the order of variables.names
+	double evaluate(const double* bindings) const {
+		ScopedTimer timer(Timer::EVALUATE);
+		countEvent(Counter::EVALUATIONS);
+
+		if (NativeFunction function = jit.getFunction(program.view())) {
+			return function(bindings);
+		}
+		return executeProgram(program, bindings);
+	}
+
+	// Evaluates count rows at once, columns[slot] holds the count values of the variable of that slot
+	void evaluateBatch(const double* const* columns, double* out, size_t count) const {
+		countEvent(Counter::BATCH_ROWS, count);
+		executeProgramBatch(program, columns, out, count);
+	}
+
+	size_t getVariableCount() const {
+		return variables.size();
+	}
+};
+
+struct CompileOptions {
+	bool optimize = true; // Fold the constants, simplify the tree and share its identical subtrees before lowering it
+	bool allowNewVariables = true; // Identifiers that aren't constants or given variables become variables
+	uint32_t jitThreshold = DEFAULT_JIT_THRESHOLD; // Evaluations before compiling to native code, 0 never compiles
+	Precision precision = Precision::STRICT; // Of sin, cos, exp and log, the constants are always folded with the C library
+};
+
+// The given variables keep their position as slot, any other identifier in the expression that isn't a constant
+// becomes a new variable added after them in the order it appears
+// Doesn't throw, if the expression is invalid the returned error is set and the compiled expression is left empty
+CompileError tryCompileExpression(std::string_view expression, const std::vector<std::string>& variables, CompiledExpression& compiled, const CompileOptions& options = {}) {
+	ScopedTimer timer(Timer::COMPILE);
+	countEvent(Counter::COMPILATIONS);
+
+	compiled.variables.names = variables;
+	compiled.jit.setThreshold(options.jitThreshold);
+
+	// The tree only lives while compiling, so every compilation of the thread reuses the same arena
+	thread_local TokenArena arena;
+	arena.reset();
+
+	CompileError error;
+	TokenPtr root = parseToken(expression, &arena, &compiled.variables, options.allowNewVariables, &error);
+	if (error) {
+		countEvent(Counter::COMPILE_ERRORS);
+		return error;
+	}
+
+	if (options.optimize) {
+		compiled.eliminatedNodes = optimizeExpression(root, &arena, options.precision);
+		countEvent(Counter::ELIMINATED_NODES, compiled.eliminatedNodes);
+	}
+
+	compiled.program = compileProgram(*root, options.optimize, options.precision);
+	return error;
+}
+
+// Same as tryCompileExpression but an invalid expression throws std::invalid_argument with the message of the error
+CompiledExpression compileExpression(std::string_view expression, const std::vector<std::string>& variables, const CompileOptions& options = {}) {
+	CompiledExpression compiled;
+
+	CompileError error = tryCompileExpression(expression, variables, compiled, options);
+	if (error) {
+		throw std::invalid_argument(error.getMessage(expression));
+	}
+
+	return compiled;
+}
+
+// Incremental parsing
+
+// Ordered map of the offsets of a text to values, a treap whose nodes carry the shift still pending for the keys of
+// their children, so the entries after an edit move with the text in logarithmic time instead of one by one. The
+// nodes are made in an arena and only freed with it, so the values must not own any other resource
+template<typename T>
+class OffsetTree {
+public:
+	struct Node {
+		size_t key; // Exact once the shifts of its ancestors were pushed, which the searches do on their way down
+		T value;
+		Node* left;
+		Node* right;
+		size_t shift; // Pending for the keys of the children, modular so it can move them back
+		uint32_t priority;
+	};
+
+	void clear() {
+		root = nullptr;
+	}
+
+	// The entry of the key, null if there isn't one
+	Node* find(size_t key) {
+		Node* node = root;
+		while (node != nullptr && node->key != key) {
+			push(node);
+			node = key < node->key ? node->left : node->right;
+		}
+		return node;
+	}
+
+	// The first entry at or after the key, null if there isn't one
+	Node* lowerBound(size_t key) {
+		Node* found = nullptr;
+		for (Node* node = root; node != nullptr;) {
+			push(node);
+			if (node->key >= key) {
+				found = node;
+				node = node->left;
+			}
+			else {
+				node = node->right;
+			}
+		}
+		return found;
+	}
+
+	// The last entry before the key, null if there isn't one
+	Node* lastBefore(size_t key) {
+		Node* found = nullptr;
+		for (Node* node = root; node != nullptr;) {
+			push(node);
+			if (node->key < key) {
+				found = node;
+				node = node->right;
+			}
+			else {
+				node = node->left;
+			}
+		}
+		return found;
+	}
+
+	// Adds the entry or replaces the value of the one with the same key
+	void insert(size_t key, const T& value, TokenArena& arena) {
+		if (Node* node = find(key)) {
+			node->value = value;
+			return;
+		}
+
+		Node* left;
+		Node* right;
+		split(root, key, left, right);
+
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		root = merge(merge(left, arena.create<Node>(Node{ key, value, nullptr, nullptr, 0, seed })), right);
+	}
+
+	// Removes the entries from begin to end, not included
+	void erase(size_t begin, size_t end) {
+		if (begin >= end) {
+			return;
+		}
+
+		Node* left;
+		Node* middle;
+		Node* right;
+		split(root, begin, left, middle);
+		split(middle, end, middle, right);
+		root = merge(left, right);
+	}
+
+	// Moves the entries at or after the offset, they must stay after the ones before it
+	void shift(size_t offset, ptrdiff_t delta) {
+		Node* left;
+		Node* right;
+		split(root, offset, left, right);
+
+		if (right != nullptr) {
+			right->key += static_cast<size_t>(delta);
+			right->shift += static_cast<size_t>(delta);
+		}
+		root = merge(left, right);
+	}
+
+private:
+	Node* root = nullptr;
+	uint32_t seed = 2463534242; // Of the xorshift of the priorities
+
+	static void push(Node* node) {
+		if (node->shift == 0) {
+			return;
+		}
+
+		for (Node* child : { node->left, node->right }) {
+			if (child != nullptr) {
+				child->key += node->shift;
+				child->shift += node->shift;
+			}
+		}
+		node->shift = 0;
+	}
+
+	// The entries before the key go to the left and the rest to the right, the depth is logarithmic
+	static void split(Node* node, size_t key, Node*& left, Node*& right) {
+		if (node == nullptr) {
+			left = right = nullptr;
+			return;
+		}
+
+		push(node);
+		if (node->key < key) {
+			split(node->right, key, node->right, right);
+			left = node;
+		}
+		else {
+			split(node->left, key, left, node->left);
+			right = node;
+		}
+	}
+
+	// All the keys of the left tree are before the ones of the right one
+	static Node* merge(Node* left, Node* right) {
+		if (left == nullptr || right == nullptr) {
+			return left != nullptr ? left : right;
+		}
+
+		if (left->priority > right->priority) {
+			push(left);
+			left->right = merge(left->right, right);
+			return left;
+		}
+
+		push(right);
+		right->left = merge(left, right->left);
+		return right;
+	}
+};
+
+// Keeps the text and the tree of an expression that is being edited, like a long formula in an editor that shows
+// its result while it is typed. At every operator of the top level the parser keeps a checkpoint of its stacks, the
+// pending operators and their operands, and an edit is parsed again from the last checkpoint before it. The parse
+// stops at the first old checkpoint after the edit whose stacks are the same but for the last operand, from there
+// on the old tree is still the tree of the text, so the new operand only takes the place of the old one in the node
+// of the operator of the checkpoint. Within the part parsed again, a parenthesized group that the edit doesn't touch
+// parses to the same tree wherever it is, so the group is taken as it is and the parser jumps over its text.
+// The text is in a gap buffer, the lexer reads the text before the gap in place and the gap moves along the parse,
+// and the groups and the checkpoints are in treaps by offset. So an edit costs the text parsed again, which for a
+// sum or product of terms is the term edited, and the distance the gap moves from the previous edit, with a
+// logarithm of the size for every checkpoint or group looked up. A parse that fails keeps none of its checkpoints,
+// the old ones after it keep the tree or the error they lead to, so the edit that fixes the text still stops there.
+// The tokens and checkpoints of the old trees stay in the arena until the parsed text adds up to a few times the
+// size of the text, then it is parsed again from scratch in the arena. The variables are never removed, so their
+// slots don't change between edits, a variable that isn't in the text anymore is only ignored
+class IncrementalParser {
+public:
+	// The given variables take the first slots, the rest of identifiers that aren't constants become new variables
+	explicit IncrementalParser(const std::vector<std::string>& variables = {}) {
+		this->variables.names = variables;
+	}
+
+	IncrementalParser(const IncrementalParser&) = delete;
+	IncrementalParser& operator=(const IncrementalParser&) = delete;
+
+	// Parses a new text from scratch
+	CompileError setText(std::string_view newText) {
+		before = newText;
+		after.clear();
+		return parseAgain();
+	}
+
+	// Replaces the removed characters at the offset with the inserted ones, as std::string::replace does. Throws
+	// std::out_of_range if the offset is past the end of the text
+	CompileError edit(size_t offset, size_t removed, std::string_view inserted) {
+		if (offset > getSize()) {
+			throw std::out_of_range("Edit out of the text");
+		}
+		removed = std::min(removed, getSize() - offset);
+		size_t end = offset + removed;
+
+		// The checkpoints and the groups that start in the removed text go, and so do the checkpoints past the
+		// error of the last parse that are before the edit, the tree or error they lead to changes with it
+		checkpoints.erase(offset, end);
+		groups.erase(offset, end);
+
+		FutureTree::Node* suspended = futures.lowerBound(1);
+		if (suspended != nullptr && suspended->key < offset) {
+			checkpoints.erase(suspended->key, offset);
+		}
+
+		FutureTree::Node* covering = futures.lastBefore(end + 1);
+		Future* future = covering->value;
+		bool current = covering->key == 0;
+		futures.erase(1, end + 1);
+
+		// The groups around the edit start after the last checkpoint before it, since they can't hold an operator of
+		// the top level, and a group that ends before the edit holds no other group around it
+		CheckpointTree::Node* resume = checkpoints.lastBefore(offset);
+		GroupTree::Node* group = groups.lowerBound(resume != nullptr ? resume->key : 0);
+		while (group != nullptr && group->key < offset) {
+			size_t begin = group->key;
+			if (begin + group->value.length <= offset) {
+				group = groups.lowerBound(begin + group->value.length);
+			}
+			else {
+				groups.erase(begin, begin + 1);
+				group = groups.lowerBound(begin + 1);
+			}
+		}
+
+		moveGap(offset);
+		after.resize(after.size() - removed);
+		before += inserted;
+
+		ptrdiff_t delta = static_cast<ptrdiff_t>(inserted.size()) - static_cast<ptrdiff_t>(removed);
+		checkpoints.shift(end, delta);
+		groups.shift(end, delta);
+		futures.shift(std::max<size_t>(end, 1), delta);
+		checkpoints.erase(0, 1); // Its operator starts the text now, no parse gets there with an operand
+
+		// The checkpoints after the edit keep the future they had, at the start of the text it is the only one
+		if (!current) {
+			futures.insert(offset + inserted.size(), future, arena);
+		}
+
+		if (parsedCharacters > 4 * getSize() + TokenArena::INITIAL_BLOCK_SIZE) {
+			return parseAgain();
+		}
+
+		return parse(resume, offset + inserted.size());
+	}
+
+	// A copy of the text, whose characters are split around the gap
+	std::string getText() const {
+		return before + std::string(after.rbegin(), after.rend());
+	}
+
+	size_t getSize() const {
+		return before.size() + after.size();
+	}
+
+	// Null if the text isn't a valid expression
+	const Token* getRoot() const {
+		return root;
+	}
+
+	const CompileError& getError() const {
+		return error;
+	}
+
+	const VariableTable& getVariables() const {
+		return variables;
+	}
+
+	// Characters parsed by the last parse, the ones of the groups that were reused aren't counted
+	size_t getLastParsedCharacters() const {
+		return lastParsedCharacters;
+	}
+
+	// NaN if the text isn't a valid expression
+	double evaluate(const double* bindings = nullptr) const {
+		return root ? resolveToken(*root, bindings) : std::numeric_limits<double>::quiet_NaN();
+	}
+
+	// Lowers the tree to a program, the optimizer can't change the tree since its groups are reused, so only the
+	// identical subtrees are shared. Returns false if the text isn't a valid expression
+	bool compile(CompiledExpression& compiled, const CompileOptions& options = {}) const {
+		if (!root) {
+			return false;
+		}
+
+		compiled.variables = variables;
+		compiled.eliminatedNodes = 0;
+		compiled.jit.setThreshold(options.jitThreshold);
+		compiled.program = compileProgram(*root, options.optimize, options.precision);
+		return true;
+	}
+
+private:
+	// A parenthesized expression or a call from its start to the end of its ')', the tree of its content doesn't
+	// depend on the text around it
+	struct Group {
+		size_t length;
+		Token* token;
+	};
+
+	// The state of the parser at an operator of the top level, once the operators it closes are reduced. Only the
+	// last operand is kept, the one below each pending operator is the last one of its own checkpoint
+	struct Checkpoint {
+		static constexpr size_t MAX_OPERATORS = 4; // The deeper states, like long chains of powers, have none
+
+		Token* operand;
+		size_t operatorCount;
+		Operation operations[MAX_OPERATORS];
+		Checkpoint* pending[MAX_OPERATORS]; // The checkpoints where the operators were pushed, null for a negation
+		OperationToken* node; // Of its operator, its first operand is the last one of the state
+	};
+
+	// The tree or the error the checkpoints lead to, the offset of the error is counted from the end of the text
+	// since the text after them doesn't change
+	struct Future {
+		Token* root;
+		CompileError error;
+	};
+
+	using GroupTree = OffsetTree<Group>;
+	using CheckpointTree = OffsetTree<Checkpoint*>;
+	using FutureTree = OffsetTree<Future*>;
+
+	// The builder of the incremental parses, the nodes are made by a Parser but kept as plain pointers, since the
+	// arena owns them and the checkpoints copy them
+	struct Builder {
+		using Operand = Token*;
+
+		template<typename T>
+		using Stack = std::vector<T>;
+
+		IncrementalParser& incremental;
+		Parser parser;
+		size_t editEnd; // The checkpoints from here on are the old ones, where the parse can stop
+		size_t resumed = SIZE_MAX; // The offset of the checkpoint the parse starts from
+		CheckpointTree::Node* resumedCheckpoint = nullptr;
+		std::vector<std::pair<size_t, Checkpoint*>> waits; // The pending operators with a checkpoint by their place
+
+		// The new checkpoints and the nodes of the operators reduced, which only replace the old ones if the parse
+		// doesn't fail, the checkpoints past the error still lead to the old nodes
+		std::vector<std::pair<size_t, Checkpoint*>> recorded;
+		std::vector<std::pair<Checkpoint*, OperationToken*>> reductions;
+
+		Future* future = nullptr; // Of the checkpoint where the parse stopped
+		size_t reusedCharacters = 0;
+
+		Builder(IncrementalParser& incremental, size_t editEnd)
+			: incremental(incremental), parser(std::string_view(), &incremental.arena, &incremental.variables), editEnd(editEnd) {}
+
+		Token* number(const Lexeme& lexeme) {
+			return parser.number(lexeme).release();
+		}
+
+		Token* identifier(const Lexeme& lexeme) {
+			return parser.identifier(lexeme).release();
+		}
+
+		Token* reduce(Operation operation, Token* a, Token* b, Token* c) {
+			return parser.reduce(operation, TokenPtr(a), TokenPtr(b), TokenPtr(c)).release();
+		}
+
+		bool failed() const {
+			return parser.failed();
+		}
+
+		void fail(ErrorCode code, size_t offset, size_t length) {
+			parser.fail(code, offset, length);
+		}
+
+		bool reuseGroup(size_t offset, Token*& token, size_t& end) {
+			GroupTree::Node* group = incremental.groups.find(offset);
+			if (group == nullptr) {
+				return false;
+			}
+
+			token = group->value.token;
+			end = offset + group->value.length;
+			reusedCharacters += group->value.length;
+			return true;
+		}
+
+		void closeGroup(size_t begin, size_t end, Token* token) {
+			incremental.groups.insert(begin, { end - begin, token }, incremental.arena);
+		}
+
+		void reduced(size_t place, Token* node) {
+			if (!waits.empty() && waits.back().first == place) {
+				reductions.push_back({ waits.back().second, static_cast<OperationToken*>(node) });
+				waits.pop_back();
+			}
+		}
+
+		bool extend(Lexer& lexer) {
+			if (incremental.after.empty()) {
+				return false;
+			}
+
+			incremental.moveGap(incremental.getBoundary(incremental.before.size()));
+			lexer.expression = incremental.before;
+			return true;
+		}
+
+		// Stops at an old checkpoint with the same state, otherwise records the state when it is one of the top
+		// level that fits in a checkpoint
+		template<typename Yard>
+		bool checkpoint(Yard& yard) {
+			size_t offset = yard.current.offset;
+			size_t count = yard.operators.size();
+			if (offset == resumed) {
+				waits.push_back({ count, resumedCheckpoint->value });
+				return false;
+			}
+			if (count > Checkpoint::MAX_OPERATORS) {
+				return false;
+			}
+
+			Checkpoint* pending[Checkpoint::MAX_OPERATORS] = {};
+			for (const auto& wait : waits) {
+				pending[wait.first] = wait.second;
+			}
+
+			for (size_t i = 0; i < count; i++) {
+				Operation operation = yard.operators[i].operation;
+				if (operation == Operation::NONE || (operation != Operation::NEG && pending[i] == nullptr)) {
+					return false;
+				}
+			}
+
+			CheckpointTree::Node* old = offset >= editEnd ? incremental.checkpoints.find(offset) : nullptr;
+			if (old != nullptr && resync(*old->value, pending, yard, offset)) {
+				return true;
+			}
+
+			Checkpoint* checkpoint = incremental.arena.create<Checkpoint>();
+			checkpoint->operand = yard.operands.back();
+			checkpoint->operatorCount = count;
+			for (size_t i = 0; i < count; i++) {
+				checkpoint->operations[i] = yard.operators[i].operation;
+				checkpoint->pending[i] = pending[i];
+			}
+
+			recorded.push_back({ offset, checkpoint });
+			waits.push_back({ count, checkpoint });
+			return false;
+		}
+
+		// Replaces the old checkpoints from the first offset to the last one with the new ones
+		void commit(size_t first, size_t last) {
+			CheckpointTree& checkpoints = incremental.checkpoints;
+			checkpoints.erase(first, last);
+			for (const auto& checkpoint : recorded) {
+				checkpoints.insert(checkpoint.first, checkpoint.second, incremental.arena);
+			}
+			for (const auto& reduction : reductions) {
+				reduction.first->node = reduction.second;
+			}
+		}
+
+		// The operands below the last one are the ones of the checkpoints of the pending operators, so the same
+		// operators with the same checkpoints are the same state
+		template<typename Yard>
+		bool resync(Checkpoint& old, Checkpoint* const* pending, const Yard& yard, size_t offset) {
+			if (old.operatorCount != yard.operators.size()) {
+				return false;
+			}
+			for (size_t i = 0; i < old.operatorCount; i++) {
+				if (old.operations[i] != yard.operators[i].operation || old.pending[i] != pending[i]) {
+					return false;
+				}
+			}
+
+			// The node of the operator is there when the old parse reduced it, even if it failed later, and the
+			// later checkpoints may hold it
+			Future* oldFuture = incremental.futures.lastBefore(offset + 1)->value;
+			Token* operand = yard.operands.back();
+			if (old.node != nullptr) {
+				if (old.node->a.get() != old.operand) {
+					return false;
+				}
+
+				// The arena owns the old operand, so it is released instead of deleted
+				old.node->a.release();
+				old.node->a.reset(operand);
+			}
+			else if (oldFuture->root != nullptr) {
+				return false;
+			}
+
+			old.operand = operand;
+			future = oldFuture;
+			return true;
+		}
+	};
+
+	std::string before; // The text before the gap, the lexer reads it in place
+	std::string after; // The text after the gap reversed, so the gap moves with pushes and pops at the back
+	TokenArena arena;
+	VariableTable variables;
+	Token* root = nullptr; // Owned by the arena
+	CompileError error;
+	GroupTree groups; // By the offset where they start, the old ones that the edits didn't touch
+	CheckpointTree checkpoints; // By the offset of their operator
+	FutureTree futures; // The future of the checkpoints from every offset to the next one, from 0 the current one
+	size_t parsedCharacters = 0; // Since the arena was reset
+	size_t lastParsedCharacters = 0;
+
+	char getCharacter(size_t offset) const {
+		return offset < before.size() ? before[offset] : after[after.size() - 1 - (offset - before.size())];
+	}
+
+	void moveGap(size_t offset) {
+		if (offset < before.size()) {
+			after.append(before.rbegin(), before.rbegin() + (before.size() - offset));
+			before.resize(offset);
+		}
+		else {
+			size_t moved = offset - before.size();
+			before.append(after.rbegin(), after.rbegin() + moved);
+			after.resize(after.size() - moved);
+		}
+	}
+
+	// Where the lexer can stop seeing the text from the offset on: right after the operator of an old checkpoint,
+	// which is a lexeme of its own unless an e before it makes it the sign of an exponent, or at the end of the text
+	size_t getBoundary(size_t offset) {
+		for (CheckpointTree::Node* node = checkpoints.lowerBound(offset); node != nullptr; node = checkpoints.lowerBound(node->key + 1)) {
+			char previous = getCharacter(node->key - 1);
+			if (previous != 'e' && previous != 'E') {
+				return node->key + 1;
+			}
+		}
+		return getSize();
+	}
+
+	CompileError parseAgain() {
+		root = nullptr;
+		groups.clear();
+		checkpoints.clear();
+		futures.clear();
+		arena.reset();
+		parsedCharacters = 0;
+
+		futures.insert(0, arena.create<Future>(), arena);
+		return parse(nullptr, 0);
+	}
+
+	// Parses from the checkpoint, or from the start without one, the trees must already be moved to the new text
+	CompileError parse(CheckpointTree::Node* resume, size_t editEnd) {
+		// The lexer views the text before the gap, which mustn't move while it grows
+		if (before.capacity() < getSize()) {
+			before.reserve(2 * getSize());
+		}
+		moveGap(getBoundary(editEnd));
+
+		Builder builder(*this, editEnd);
+		ShuntingYard<Builder> yard(builder, before);
+
+		size_t start = 0;
+		if (resume != nullptr) {
+			// The operand below every pending operator is the last one of its checkpoint
+			const Checkpoint& state = *resume->value;
+			start = resume->key;
+			yard.operators.clear();
+			yard.operands.clear();
+
+			for (size_t i = 0; i < state.operatorCount; i++) {
+				Operation operation = state.operations[i];
+				yard.operators.push_back({ operation, operation == Operation::NEG ? MAX_PRIORITY : getPriority(operation), start });
+				if (state.pending[i] != nullptr) {
+					yard.operands.push_back(state.pending[i]->operand);
+					builder.waits.push_back({ i, state.pending[i] });
+				}
+			}
+			yard.operands.push_back(state.operand);
+
+			builder.resumed = start;
+			builder.resumedCheckpoint = resume;
+			yard.resume(start);
+		}
+
+		Token* parsed = yard.parse();
+		recordParseDepth(yard.maxDepth);
+
+		size_t stop = yard.current.offset;
+		size_t first = resume != nullptr ? start + 1 : 0;
+		if (yard.stopped) {
+			root = builder.future->root;
+			error = builder.future->error;
+			if (error) {
+				error.offset = getSize() - error.offset;
+			}
+
+			builder.commit(first, stop);
+			futures.erase(1, stop + 1);
+			futures.insert(0, builder.future, arena);
+		}
+		else {
+			root = parsed;
+			error = builder.parser.error;
+
+			Future* future = arena.create<Future>(Future{ root, error });
+			if (error) {
+				// The old checkpoints after the one it started from are kept with the future they had, which is
+				// still the one of the text after them, for the edit that gets the parse past the error
+				future->error.offset = getSize() - error.offset;
+				if (futures.find(start + 1) == nullptr) {
+					futures.insert(start + 1, futures.find(0)->value, arena);
+				}
+			}
+			else {
+				builder.commit(first, SIZE_MAX);
+				futures.erase(1, SIZE_MAX);
+			}
+			futures.insert(0, future, arena);
+		}
+
+		lastParsedCharacters = stop - start - std::min(stop - start, builder.reusedCharacters);
+		parsedCharacters += lastParsedCharacters;
+		return error;
+	}
+};
+
+// Cache
+
+// Removes the whitespace that doesn't change the meaning of the expression, a single space is kept between
+// two numbers or identifiers because "1 2" isn't the same expression as "12"
+void normalizeExpression(std::string_view expression, std::string& normalized) {
+	normalized.clear();
+	bool pendingSpace = false;
+
+	for (char character : expression) {
+		if (isSpace(character)) {
+			pendingSpace = !normalized.empty();
+			continue;
+		}
+
+		if (pendingSpace && (isIdentifierPart(character) || character == '.') && (isIdentifierPart(normalized.back()) || normalized.back() == '.')) {
+			normalized.push_back(' ');
+		}
+
+		pendingSpace = false;
+		normalized.push_back(character);
+	}
+}
+
+// Least recently used cache of compiled expressions keyed by their normalized text
+class ExpressionCache {
+public:
+	static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+	ExpressionCache(size_t capacity = DEFAULT_CAPACITY, const CompileOptions& options = {})
+		: capacity(capacity), options(options) {}
+
+	// The copy has its own entries, counters and compiled expressions, so the threads that use each copy share no
+	// state, not even the evaluations counted and the native code compiled by the JitState of an expression
+	ExpressionCache(const ExpressionCache& other) : capacity(other.capacity), options(other.options) {
+		for (const Entry& entry : other.entries) {
+			entries.emplace_back(entry.first, std::make_shared<const CompiledExpression>(*entry.second));
+			index.emplace(entries.back().first, std::prev(entries.end()));
+		}
+	}
+
+	// Moving the list keeps its nodes, so the keys of the index still view their strings
+	ExpressionCache(ExpressionCache&&) = default;
+	ExpressionCache& operator=(ExpressionCache&&) = default;
+	ExpressionCache& operator=(const ExpressionCache&) = delete;
+
+	// Returns the compiled expression, compiling it only if it isn't in the cache
+	// The expressions that fail to compile throw as compileExpression does and they aren't cached
+	std::shared_ptr<const CompiledExpression> get(std::string_view expression) {
+		CompileError error;
+		auto compiled = get(expression, error);
+
+		if (error) {
+			throw std::invalid_argument(error.getMessage(expression));
+		}
+		return compiled;
+	}
+
+	// Doesn't throw, returns null and sets the error if the expression can't be compiled
+	std::shared_ptr<const CompiledExpression> get(std::string_view expression, CompileError& error) {
+		normalizeExpression(expression, key);
+
+		if (auto found = find(key)) {
+			return found;
+		}
+
+		auto created = std::make_shared<CompiledExpression>();
+		error = tryCompileExpression(expression, {}, *created, options);
+		if (error) {
+			return nullptr;
+		}
+
+		std::shared_ptr<const CompiledExpression> compiled = std::move(created);
+		add(key, compiled);
+		return compiled;
+	}
+
+	// Adds an expression compiled somewhere else, like the ones loaded from a program file, as the most recently used.
+	// The compiled expression must have been compiled from that expression
+	void insert(std::string_view expression, std::shared_ptr<const CompiledExpression> compiled) {
+		normalizeExpression(expression, key);
+		insertNormalized(key, std::move(compiled));
+	}
+
+	// Returns the compiled expression of a text already normalized by normalizeExpression, or null if it isn't in the
+	// cache. Counts the hit or the miss, it doesn't compile
+	std::shared_ptr<const CompiledExpression> find(std::string_view normalized) {
+		auto found = index.find(normalized);
+		if (found == index.end()) {
+			misses++;
+			countEvent(Counter::CACHE_MISSES);
+			return nullptr;
+		}
+
+		hits++;
+		countEvent(Counter::CACHE_HITS);
+		entries.splice(entries.begin(), entries, found->second); // Move to the front as the most recently used
+		return found->second->second;
+	}
+
+	// Same as insert with a text already normalized by normalizeExpression
+	void insertNormalized(std::string_view normalized, std::shared_ptr<const CompiledExpression> compiled) {
+		auto found = index.find(normalized);
+		if (found != index.end()) {
+			found->second->second = std::move(compiled);
+			entries.splice(entries.begin(), entries, found->second);
+			return;
+		}
+
+		add(normalized, std::move(compiled));
+	}
+
+	void setCapacity(size_t capacity) {
+		this->capacity = capacity;
+
+		while (entries.size() > capacity) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+
+	void clear() {
+		index.clear();
+		entries.clear();
+	}
+
+	size_t getCapacity() const {
+		return capacity;
+	}
+
+	const CompileOptions& getOptions() const {
+		return options;
+	}
+
+	size_t getSize() const {
+		return entries.size();
+	}
+
+	size_t getHits() const {
+		return hits;
+	}
+
+	size_t getMisses() const {
+		return misses;
+	}
+
+private:
+	using Entry = std::pair<std::string, std::shared_ptr<const CompiledExpression>>;
+
+	size_t capacity;
+	CompileOptions options;
+
+	std::list<Entry> entries; // From the most to the least recently used
+	std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+
+	std::string key; // Reused between lookups so a hit doesn't allocate
+
+	size_t hits = 0;
+	size_t misses = 0;
+
+	// Adds a new entry, evicting the least recently used one if the cache is full
+	void add(std::string_view normalized, std::shared_ptr<const CompiledExpression> compiled) {
+		if (capacity == 0) {
+			return;
+		}
+
+		if (entries.size() >= capacity) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+
+		entries.emplace_front(std::string(normalized), std::move(compiled));
+		index.emplace(entries.front().first, entries.begin()); // The key views the string stored in the list node
+	}
+};
+
+// Cache of compiled expressions used by many threads at once, the expressions go to one of a few caches by the hash
+// of their normalized text and each one has its own lock, so the threads only wait for the lookups of the same cache.
+// The locks are only held to look up and to add, the expressions are compiled and evaluated outside of them. The
+// threads that miss an expression that another one is compiling wait for it, so it is compiled once and they all get
+// the same compiled expression.
+// The capacity is split between the caches and each one evicts its own least recently used expressions, so the
+// expression evicted is the oldest of its cache, not always the oldest of all
+class SharedExpressionCache {
+public:
+	static constexpr size_t SHARD_COUNT = 16;
+
+	SharedExpressionCache(size_t capacity = ExpressionCache::DEFAULT_CAPACITY, const CompileOptions& options = {}) : options(options) {
+		for (size_t i = 0; i < SHARD_COUNT; i++) {
+			shards[i].cache = ExpressionCache(getShardCapacity(capacity, i), options);
+		}
+	}
+
+	// Doesn't throw, returns null and sets the error if the expression can't be compiled
+	std::shared_ptr<const CompiledExpression> get(std::string_view expression, CompileError& error) {
+		thread_local std::string key;
+		normalizeExpression(expression, key);
+		Shard& shard = getShard(key);
+
+		std::unique_lock<std::mutex> lock(shard.mutex);
+		if (auto found = shard.cache.find(key)) {
+			return found;
+		}
+
+		// The error of another text with the same key would have the offsets of that text, so after a failed
+		// compilation every thread that waited for it compiles its own text, the failures aren't cached anyway
+		bool shared = true;
+		auto compiling = shard.compiling.find(key);
+		if (compiling != shard.compiling.end()) {
+			std::shared_ptr<Compilation> other = compiling->second;
+			shard.compiled.wait(lock, [&] { return other->done; });
+			if (other->compiled) {
+				return other->compiled;
+			}
+			shared = false;
+		}
+
+		auto compilation = std::make_shared<Compilation>();
+		if (shared) {
+			shard.compiling.emplace(key, compilation);
+		}
+		lock.unlock();
+
+		auto finish = [&](std::shared_ptr<const CompiledExpression> compiled) {
+			lock.lock();
+			if (compiled) {
+				shard.cache.insertNormalized(key, compiled);
+			}
+			compilation->compiled = std::move(compiled);
+			compilation->done = true;
+			if (shared) {
+				shard.compiling.erase(key);
+				shard.compiled.notify_all();
+			}
+		};
+
+		auto created = std::make_shared<CompiledExpression>();
+		try {
+			error = tryCompileExpression(expression, {}, *created, options);
+		}
+		catch (...) {
+			finish(nullptr);
+			throw;
+		}
+
+		finish(error ? nullptr : std::move(created));
+		return compilation->compiled;
+	}
+
+	void insert(std::string_view expression, std::shared_ptr<const CompiledExpression> compiled) {
+		thread_local std::string key;
+		normalizeExpression(expression, key);
+		Shard& shard = getShard(key);
+
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.cache.insertNormalized(key, std::move(compiled));
+	}
+
+	void setCapacity(size_t capacity) {
+		for (size_t i = 0; i < SHARD_COUNT; i++) {
+			std::lock_guard<std::mutex> lock(shards[i].mutex);
+			shards[i].cache.setCapacity(getShardCapacity(capacity, i));
+		}
+	}
+
+	size_t getCapacity() const {
+		return sum(&ExpressionCache::getCapacity);
+	}
+
+	const CompileOptions& getOptions() const {
+		return options;
+	}
+
+	size_t getSize() const {
+		return sum(&ExpressionCache::getSize);
+	}
+
+	size_t getHits() const {
+		return sum(&ExpressionCache::getHits);
+	}
+
+	size_t getMisses() const {
+		return sum(&ExpressionCache::getMisses);
+	}
+
+private:
+	// An expression being compiled by a thread, the others wait for it
+	struct Compilation {
+		std::shared_ptr<const CompiledExpression> compiled; // Null if it failed
+		bool done = false;
+	};
+
+	struct Shard {
+		mutable std::mutex mutex;
+		std::condition_variable compiled; // Notified when a compilation of the cache is done
+		ExpressionCache cache;
+		std::unordered_map<std::string, std::shared_ptr<Compilation>> compiling; // By the normalized text
+	};
+
+	CompileOptions options;
+	std::array<Shard, SHARD_COUNT> shards;
+
+	Shard& getShard(std::string_view normalized) {
+		return shards[std::hash<std::string_view>{}(normalized) % SHARD_COUNT];
+	}
+
+	// The caches add up to the capacity, the first ones take one more when it isn't a multiple of their count
+	static size_t getShardCapacity(size_t capacity, size_t shard) {
+		return capacity / SHARD_COUNT + (shard < capacity % SHARD_COUNT ? 1 : 0);
+	}
+
+	size_t sum(size_t (ExpressionCache::*getter)() const) const {
+		size_t total = 0;
+		for (const Shard& shard : shards) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			total += (shard.cache.*getter)();
+		}
+		return total;
+	}
+};
+
+// Program files
+
+// Compiled expressions saved in a binary file that is mapped and used as it is when it is loaded, so a program
+// that starts with many known expressions doesn't parse them again. The layout is the one of the memory of the
+// machine that wrote it, the byte order mark rejects the files of the machines with another one.
+//
+// File header, 24 bytes:
+//   char magic[8]             "CALCPRG\n"
+//   uint32 version            PROGRAM_FILE_VERSION
+//   uint32 byteOrder          0x01020304 as written by the machine
+//   uint64 count              number of expressions
+// uint64 offsets[count]       offset of every expression from the start of the file, they are multiples of 8
+//
+// Expression, starting at its offset:
+//   uint32 nodeCount, constantCount, variableCount, stackSize, sourceLength, namesLength, eliminatedNodes, temporaryCount
+//   double constants[constantCount]
+//   uint32 a[nodeCount]
+//   uint32 b[nodeCount]
+//   uint8 opcodes[nodeCount]
+//   char names[namesLength]   the names of the variables in slot order, each one ends with a '\0'
+//   char source[sourceLength] text of the expression it was compiled from
+//
+// Everything is validated when the file is opened, a file that passes can be evaluated without any other check
+
+constexpr char PROGRAM_FILE_MAGIC[8] = { 'C', 'A', 'L', 'C', 'P', 'R', 'G', '\n' };
+constexpr uint32_t PROGRAM_FILE_VERSION = 4; // 2 added the temporaries, 3 the functions and IF and 4 the elementary functions
+constexpr uint32_t PROGRAM_FILE_OLDEST_VERSION = 2; // The programs of the older versions are still valid ones
+constexpr uint32_t PROGRAM_FILE_BYTE_ORDER = 0x01020304;
+
+struct ProgramFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t count;
+};
+
+struct ProgramFileEntry {
+	uint32_t nodeCount;
+	uint32_t constantCount;
+	uint32_t variableCount;
+	uint32_t stackSize;
+	uint32_t sourceLength;
+	uint32_t namesLength;
+	uint32_t eliminatedNodes;
+	uint32_t temporaryCount;
+};
+
+// Checks that the program only reads the constants, bindings and temporaries it has, that it only recalls the
+// temporaries already saved, that its children are the nodes left on the stack, that every IF jumps to its own
+// nodes and that its stack size is the real one, so every engine can run it
+bool validateProgram(const ProgramView& program, size_t variableCount) {
+	constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+	// The engines allocate the temporaries, there can't be more than nodes
+	if (program.temporaryCount > program.size()) {
+		return false;
+	}
+
+	// The lazy IFs being checked, the temporaries saved in a branch can only be recalled in that branch
+	struct OpenIf {
+		uint32_t branch;
+		uint32_t jump;
+		size_t depth; // Size of the stack without the condition
+		size_t firstSaved; // Position in savedOrder when the branch started
+	};
+
+	std::vector<uint32_t> stack;
+	std::vector<bool> saved(program.temporaryCount);
+	std::vector<uint32_t> savedOrder;
+	std::vector<OpenIf> open;
+	size_t maxDepth = 0;
+
+	auto endBranch = [&] {
+		for (size_t j = open.back().firstSaved; j < savedOrder.size(); j++) {
+			saved[savedOrder[j]] = false;
+		}
+		savedOrder.resize(open.back().firstSaved);
+	};
+
+	for (size_t i = 0; i < program.size(); i++) {
+		uint32_t a = program.a[i];
+		uint32_t b = program.b[i];
+
+		switch (program.opcodes[i]) {
+		case OpCode::PUSH:
+			if (a >= program.constantCount) {
+				return false;
+			}
+			break;
+		case OpCode::LOAD:
+			if (a >= variableCount) {
+				return false;
+			}
+			break;
+		case OpCode::RECALL:
+			if (a >= program.temporaryCount || !saved[a]) {
+				return false;
+			}
+			break;
+		case OpCode::SAVE:
+			if (b >= program.temporaryCount || stack.empty() || stack.back() != a) {
+				return false;
+			}
+			saved[b] = true;
+			savedOrder.push_back(b);
+			stack.pop_back();
+			break;
+		case OpCode::SELECT:
+			if (stack.size() < 3 || stack.back() != b || stack[stack.size() - 3] != a) {
+				return false;
+			}
+			stack.resize(stack.size() - 3);
+			break;
+		case OpCode::BRANCH:
+			if (stack.empty() || stack.back() != a) {
+				return false;
+			}
+			stack.pop_back();
+			open.push_back({ static_cast<uint32_t>(i), NONE, stack.size(), savedOrder.size() });
+			continue; // It doesn't push a value
+		case OpCode::JUMP:
+			// The BRANCH jumps right after it, and it jumps forward
+			if (open.empty() || open.back().jump != NONE || program.b[open.back().branch] != i + 1 || b <= i || b >= program.size()
+				|| stack.size() != open.back().depth + 1 || stack.back() != a) {
+				return false;
+			}
+			stack.pop_back();
+			endBranch();
+			open.back().jump = static_cast<uint32_t>(i);
+			continue;
+		case OpCode::JOIN:
+			if (open.empty() || open.back().branch != a || open.back().jump == NONE || program.b[open.back().jump] != i
+				|| stack.size() != open.back().depth + 1 || stack.back() != b) {
+				return false;
+			}
+			stack.pop_back();
+			endBranch();
+			open.pop_back();
+			break;
+		case OpCode::SUM:
+		case OpCode::MIN:
+		case OpCode::MUL:
+		case OpCode::DIV:
+		case OpCode::POW:
+		case OpCode::MINIMUM:
+		case OpCode::MAXIMUM:
+			if (stack.size() < 2 || stack.back() != b) {
+				return false;
+			}
+			stack.pop_back();
+			[[fallthrough]];
+		case OpCode::NEG:
+		case OpCode::POWI:
+		case OpCode::SQRT:
+		case OpCode::CBRT:
+		case OpCode::ABS:
+		case OpCode::SIN:
+		case OpCode::COS:
+		case OpCode::EXP:
+		case OpCode::LOG:
+		case OpCode::FAST_SIN:
+		case OpCode::FAST_COS:
+		case OpCode::FAST_EXP:
+		case OpCode::FAST_LOG:
+			if (stack.empty() || stack.back() != a) {
+				return false;
+			}
+			stack.pop_back();
+			break;
+		default:
+			return false;
+		}
+
+		stack.push_back(static_cast<uint32_t>(i));
+		maxDepth = std::max(maxDepth, stack.size());
+	}
+
+	return stack.size() == 1 && open.empty() && maxDepth == program.stackSize;
+}
+
+// Collects compiled expressions and saves them in a program file
+class ProgramFileWriter {
+public:
+	void add(std::string_view source, const CompiledExpression& compiled) {
+		const Program& program = compiled.program;
+
+		std::string names;
+		for (const std::string& name : compiled.variables.names) {
+			names += name;
+			names += '\0';
+		}
+
+		ProgramFileEntry entry{};
+		entry.nodeCount = static_cast<uint32_t>(program.size());
+		entry.constantCount = static_cast<uint32_t>(program.constants.size());
+		entry.variableCount = static_cast<uint32_t>(compiled.variables.size());
+		entry.stackSize = static_cast<uint32_t>(program.stackSize);
+		entry.sourceLength = static_cast<uint32_t>(source.size());
+		entry.namesLength = static_cast<uint32_t>(names.size());
+		entry.eliminatedNodes = static_cast<uint32_t>(compiled.eliminatedNodes);
+		entry.temporaryCount = static_cast<uint32_t>(program.temporaryCount);
+
+		offsets.push_back(data.size());
+		append(&entry, sizeof(entry));
+		append(program.constants.data(), program.constants.size() * sizeof(double));
+		append(program.a.data(), program.size() * sizeof(uint32_t));
+		append(program.b.data(), program.size() * sizeof(uint32_t));
+		append(program.opcodes.data(), program.size() * sizeof(OpCode));
+		append(names.data(), names.size());
+		append(source.data(), source.size());
+		data.append((8 - data.size() % 8) % 8, '\0'); // The next expression starts aligned for its constants
+	}
+
+	size_t getCount() const {
+		return offsets.size();
+	}
+
+	bool save(const char* path) const {
+		FILE* file = std::fopen(path, "wb");
+		if (file == nullptr) {
+			return false;
+		}
+
+		ProgramFileHeader header{};
+		std::memcpy(header.magic, PROGRAM_FILE_MAGIC, sizeof(header.magic));
+		header.version = PROGRAM_FILE_VERSION;
+		header.byteOrder = PROGRAM_FILE_BYTE_ORDER;
+		header.count = offsets.size();
+
+		// The offsets in the file are from its start, the data goes after the header and the offsets
+		uint64_t start = sizeof(header) + offsets.size() * sizeof(uint64_t);
+		std::vector<uint64_t> fileOffsets(offsets.size());
+		for (size_t i = 0; i < offsets.size(); i++) {
+			fileOffsets[i] = start + offsets[i];
+		}
+
+		bool success = std::fwrite(&header, sizeof(header), 1, file) == 1
+			&& std::fwrite(fileOffsets.data(), sizeof(uint64_t), fileOffsets.size(), file) == fileOffsets.size()
+			&& std::fwrite(data.data(), 1, data.size(), file) == data.size();
+
+		return std::fclose(file) == 0 && success;
+	}
+
+private:
+	std::vector<uint64_t> offsets; // From the start of the data
+	std::string data;
+
+	void append(const void* bytes, size_t size) {
+		data.append(static_cast<const char*>(bytes), size);
+	}
+};
+
+// A program file opened for reading, the programs are views into the mapping so they are used without copying them
+class ProgramFile {
+public:
+	ProgramFile() = default;
+	ProgramFile(const ProgramFile&) = delete;
+	ProgramFile& operator=(const ProgramFile&) = delete;
+
+	~ProgramFile() {
+		close();
+	}
+
+	// Returns false if the file can't be read or it isn't a valid program file, getError tells why
+	bool open(const char* path) {
+		close();
+
+		if (!map(path)) {
+			error = "Can't read the file";
+			return false;
+		}
+
+		if (!parse()) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	const std::string& getError() const {
+		return error;
+	}
+
+	size_t size() const {
+		return entries.size();
+	}
+
+	std::string_view getSource(size_t i) const {
+		return entries[i].source;
+	}
+
+	const ProgramView& getProgram(size_t i) const {
+		return entries[i].program;
+	}
+
+	size_t getVariableCount(size_t i) const {
+		return entries[i].variableCount;
+	}
+
+	// Runs the program straight from the mapping
+	double evaluate(size_t i, const double* bindings) const {
+		return executeProgram(entries[i].program, bindings);
+	}
+
+	// Copies the program so the compiled expression can outlive the file
+	void load(size_t i, CompiledExpression& compiled) const {
+		const Entry& entry = entries[i];
+		const ProgramView& view = entry.program;
+
+		compiled.program.opcodes.assign(view.opcodes, view.opcodes + view.size());
+		compiled.program.a.assign(view.a, view.a + view.size());
+		compiled.program.b.assign(view.b, view.b + view.size());
+		compiled.program.constants.assign(view.constants, view.constants + view.constantCount);
+		compiled.program.stackSize = view.stackSize;
+		compiled.program.temporaryCount = view.temporaryCount;
+		compiled.eliminatedNodes = entry.eliminatedNodes;
+
+		compiled.variables.names.clear();
+		for (size_t start = 0; start < entry.names.size();) {
+			size_t end = entry.names.find('\0', start);
+			compiled.variables.names.emplace_back(entry.names.substr(start, end - start));
+			start = end + 1;
+		}
+	}
+
+private:
+	struct Entry {
+		ProgramView program;
+		size_t variableCount;
+		size_t eliminatedNodes;
+		std::string_view names;
+		std::string_view source;
+	};
+
+	const char* data = nullptr;
+	size_t fileSize = 0;
+	bool mapped = false; // Otherwise the data was read into memory
+	std::vector<Entry> entries;
+	std::string error;
+
+	bool map(const char* path) {
+#ifdef CALCULATOR_HAS_MMAP
+		int descriptor = ::open(path, O_RDONLY);
+		if (descriptor >= 0) {
+			struct stat status;
+			if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+				void* mapping = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+				if (mapping != MAP_FAILED) {
+					data = static_cast<const char*>(mapping);
+					fileSize = static_cast<size_t>(status.st_size);
+					mapped = true;
+				}
+			}
+			::close(descriptor); // The mapping keeps the file alive
+
+			if (mapped) {
+				return true;
+			}
+		}
+#endif
+		// Without a mapping the file is read at once, the buffer of new is aligned enough for the constants
+		FILE* file = std::fopen(path, "rb");
+		if (file == nullptr) {
+			return false;
+		}
+
+		std::string contents;
+		char buffer[64 * 1024];
+		for (size_t read; (read = std::fread(buffer, 1, sizeof(buffer), file)) > 0;) {
+			contents.append(buffer, read);
+		}
+		std::fclose(file);
+
+		char* copy = new char[std::max<size_t>(contents.size(), 1)];
+		std::memcpy(copy, contents.data(), contents.size());
+		data = copy;
+		fileSize = contents.size();
+		return true;
+	}
+
+	void close() {
+		if (data != nullptr) {
+#ifdef CALCULATOR_HAS_MMAP
+			if (mapped) {
+				munmap(const_cast<char*>(data), fileSize);
+			}
+#endif
+			if (!mapped) {
+				delete[] data;
+			}
+		}
+
+		data = nullptr;
+		fileSize = 0;
+		mapped = false;
+		entries.clear();
+	}
+
+	bool fail(const char* message) {
+		error = message;
+		return false;
+	}
+
+	bool parse() {
+		ProgramFileHeader header;
+		if (fileSize < sizeof(header)) {
+			return fail("Not a program file");
+		}
+
+		std::memcpy(&header, data, sizeof(header));
+		if (std::memcmp(header.magic, PROGRAM_FILE_MAGIC, sizeof(header.magic)) != 0) {
+			return fail("Not a program file");
+		}
+		if (header.byteOrder != PROGRAM_FILE_BYTE_ORDER) {
+			return fail("The program file was written by a machine with another byte order");
+		}
+		if (header.version < PROGRAM_FILE_OLDEST_VERSION || header.version > PROGRAM_FILE_VERSION) {
+			return fail("Unsupported version of the program file");
+		}
+		if (header.count > (fileSize - sizeof(header)) / sizeof(uint64_t)) {
+			return fail("The program file is truncated");
+		}
+
+		entries.reserve(header.count);
+		for (uint64_t i = 0; i < header.count; i++) {
+			uint64_t offset;
+			std::memcpy(&offset, data + sizeof(header) + i * sizeof(uint64_t), sizeof(offset));
+
+			if (!parseEntry(offset)) {
+				return fail("The program file is corrupt");
+			}
+		}
+
+		return true;
+	}
+
+	bool parseEntry(uint64_t offset) {
+		ProgramFileEntry header;
+		if (offset % 8 != 0 || offset > fileSize || fileSize - offset < sizeof(header)) {
+			return false;
+		}
+		std::memcpy(&header, data + offset, sizeof(header));
+
+		// All the sizes are 32 bits, so the total can't overflow 64 bits
+		uint64_t size = sizeof(header) + uint64_t(header.constantCount) * sizeof(double)
+			+ uint64_t(header.nodeCount) * (2 * sizeof(uint32_t) + sizeof(OpCode)) + header.namesLength + header.sourceLength;
+		if (size > fileSize - offset || header.nodeCount == 0) {
+			return false;
+		}
+
+		const char* cursor = data + offset + sizeof(header);
+		Entry entry;
+
+		entry.program.constants = reinterpret_cast<const double*>(cursor);
+		cursor += header.constantCount * sizeof(double);
+		entry.program.a = reinterpret_cast<const uint32_t*>(cursor);
+		cursor += header.nodeCount * sizeof(uint32_t);
+		entry.program.b = reinterpret_cast<const uint32_t*>(cursor);
+		cursor += header.nodeCount * sizeof(uint32_t);
+		entry.program.opcodes = reinterpret_cast<const OpCode*>(cursor);
+		cursor += header.nodeCount * sizeof(OpCode);
+		entry.program.nodeCount = header.nodeCount;
+		entry.program.constantCount = header.constantCount;
+		entry.program.stackSize = header.stackSize;
+		entry.program.temporaryCount = header.temporaryCount;
+
+		entry.names = std::string_view(cursor, header.namesLength);
+		cursor += header.namesLength;
+		entry.source = std::string_view(cursor, header.sourceLength);
+		entry.variableCount = header.variableCount;
+		entry.eliminatedNodes = header.eliminatedNodes;
+
+		// Every name ends with a '\0', so there are as many as variables
+		if (static_cast<size_t>(std::count(entry.names.begin(), entry.names.end(), '\0')) != entry.variableCount
+			|| (!entry.names.empty() && entry.names.back() != '\0')) {
+			return false;
+		}
+
+		if (!validateProgram(entry.program, entry.variableCount)) {
+			return false;
+		}
+
+		entries.push_back(entry);
+		return true;
+	}
+};
+
+// Threads
+
+// Pool of threads where every worker has its own queue of tasks, a worker takes the newest task of its own queue and
+// when it's empty it steals the oldest task of the other queues, so the work spreads without a shared queue
+class ThreadPool {
+public:
+	static constexpr size_t NOT_A_WORKER = static_cast<size_t>(-1);
+
+	ThreadPool(size_t threadCount) : queues(std::max<size_t>(threadCount, 1)) {
+		for (size_t i = 0; i < queues.size(); i++) {
+			threads.emplace_back([this, i] { workerLoop(i); });
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+	}
+
+	// The tasks submitted from a worker go to its own queue, the rest are spread over all the queues
+	void submit(std::function<void()> task) {
+		size_t index = (currentPool == this) ? currentWorker : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+
+		{
+			std::lock_guard<std::mutex> lock(queues[index].mutex);
+			queues[index].tasks.push_back(std::move(task));
+		}
+
+		pending.fetch_add(1, std::memory_order_release);
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex); // Pairs with the check of the workers before they sleep
+		}
+		wake.notify_one();
+	}
+
+	// Runs the pending tasks in the calling thread until the condition is true, so waiting for a task never blocks a thread
+	// that could be running it
+	template<typename Condition>
+	void waitFor(Condition condition) {
+		size_t index = (currentPool == this) ? currentWorker : 0;
+
+		while (!condition()) {
+			if (!runTask(index)) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	size_t getThreadCount() const {
+		return threads.size();
+	}
+
+	// Index of the worker running the calling thread, or NOT_A_WORKER for the threads outside any pool
+	static size_t getCurrentWorkerIndex() {
+		return currentPool ? currentWorker : NOT_A_WORKER;
+	}
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<Queue> queues;
+	std::vector<std::thread> threads;
+	std::atomic<size_t> nextQueue{ 0 };
+	std::atomic<size_t> pending{ 0 };
+
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	static thread_local ThreadPool* currentPool;
+	static thread_local size_t currentWorker;
+
+	bool runTask(size_t index) {
+		std::function<void()> task;
+
+		{
+			Queue& own = queues[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.tasks.empty()) {
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+			}
+		}
+
+		for (size_t i = 1; !task && i < queues.size(); i++) {
+			Queue& victim = queues[(index + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty()) {
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+			}
+		}
+
+		if (!task) {
+			return false;
+		}
+
+		pending.fetch_sub(1, std::memory_order_relaxed);
+		task();
+		return true;
+	}
+
+	void workerLoop(size_t index) {
+		currentPool = this;
+		currentWorker = index;
+
+		while (true) {
+			if (runTask(index)) {
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			wake.wait(lock, [this] { return stopping || pending.load(std::memory_order_acquire) > 0; });
+
+			if (stopping && pending.load(std::memory_order_acquire) == 0) {
+				return;
+			}
+		}
+	}
+};
+
+thread_local ThreadPool* ThreadPool::currentPool = nullptr;
+thread_local size_t ThreadPool::currentWorker = ThreadPool::NOT_A_WORKER;
+
+// Parallel evaluation
+
+// Evaluates one huge program using all the threads of a pool. The program is in post order, where the subtree of
+// the node i takes the positions [i - size + 1, i], so the independent subtrees are only ranges of the program.
+// The subtrees up to the threshold are evaluated by the tasks, what is left above them is evaluated after joining them.
+// A subtree is only a task if the temporaries it saves and recalls don't live outside of it, so every task has its
+// own temporaries. Nothing is recursive, so the deep left leaning chains like a long sum don't overflow the stack.
+// The branches of a lazy IF are never split in tasks, they are only evaluated when their IF takes them.
+class ParallelEvaluator {
+public:
+	static constexpr size_t DEFAULT_THRESHOLD = 16 * 1024;
+
+	// The program must outlive the evaluator
+	ParallelEvaluator(const Program& program, ThreadPool& pool, size_t threshold = DEFAULT_THRESHOLD) : program(program), pool(pool) {
+		computeSizes();
+		computeReaches();
+		split(std::max<size_t>(threshold, 1));
+	}
+
+	double evaluate(const double* bindings) const {
+		std::vector<double> results(subtrees.size());
+		std::atomic<size_t> remaining{ subtrees.size() };
+
+		for (size_t i = 0; i < subtrees.size(); i++) {
+			pool.submit([this, i, bindings, &results, &remaining] {
+				results[i] = evaluateRange(subtrees[i].begin, subtrees[i].end, bindings, nullptr);
+				remaining.fetch_sub(1, std::memory_order_release);
+			});
+		}
+
+		pool.waitFor([&remaining] { return remaining.load(std::memory_order_acquire) == 0; });
+
+		// The nodes above the subtrees are evaluated in order, jumping over the subtrees already evaluated
+		return evaluateRange(0, program.size(), bindings, results.data());
+	}
+
+	size_t getTaskCount() const {
+		return subtrees.size();
+	}
+
+private:
+	struct Subtree {
+		size_t begin, end;
+	};
+
+	const Program& program;
+	ThreadPool& pool;
+	std::vector<size_t> sizes; // Number of nodes of the subtree of each node
+	std::vector<std::pair<size_t, size_t>> reaches; // First and last node of the lifetimes of the temporaries used in the subtree of each node
+	std::vector<Subtree> subtrees; // Sorted by their position in the program
+
+	// The children always go before their parent, so their sizes are known when the parent is reached. The subtree
+	// of an IF goes from its condition to it, and the BRANCH and JUMP end the subtrees of the condition and the
+	// then branch
+	void computeSizes() {
+		sizes.resize(program.size());
+
+		for (size_t i = 0; i < program.size(); i++) {
+			OpCode opcode = program.opcodes[i];
+
+			sizes[i] = 1;
+			if (opcode == OpCode::SELECT || opcode == OpCode::JOIN) {
+				sizes[i] = i - program.a[i] + sizes[program.a[i]];
+				continue;
+			}
+			if (!isLeaf(opcode)) {
+				sizes[i] += sizes[program.a[i]];
+			}
+			if (isBinary(opcode)) {
+				sizes[i] += sizes[program.b[i]];
+			}
+		}
+	}
+
+	// The roots of the values an IF depends on: the condition, the then branch and the else branch
+	std::array<size_t, 3> getBranches(size_t i) const {
+		uint32_t a = program.a[i], b = program.b[i];
+		if (program.opcodes[i] == OpCode::SELECT) {
+			return { a, b - sizes[b], b };
+		}
+		return { program.a[a], program.a[program.b[a] - 1], b };
+	}
+
+	// The lifetime of a temporary goes from its SAVE to its last RECALL, a subtree with the lifetimes of all its
+	// temporaries inside doesn't share them with the rest of the program
+	void computeReaches() {
+		reaches.resize(program.size());
+
+		std::vector<size_t> partners(program.size()); // Last RECALL of each SAVE and SAVE of each RECALL
+		std::vector<size_t> saves(program.temporaryCount); // Last SAVE of each temporary so far
+		for (size_t i = 0; i < program.size(); i++) {
+			if (program.opcodes[i] == OpCode::SAVE) {
+				saves[program.b[i]] = i;
+				partners[i] = i;
+			}
+			else if (program.opcodes[i] == OpCode::RECALL) {
+				partners[i] = saves[program.a[i]];
+				partners[partners[i]] = i;
+			}
+		}
+
+		for (size_t i = 0; i < program.size(); i++) {
+			OpCode opcode = program.opcodes[i];
+
+			reaches[i] = { i, i };
+			if (opcode == OpCode::SAVE) {
+				reaches[i].second = partners[i];
+			}
+			else if (opcode == OpCode::RECALL) {
+				reaches[i].first = partners[i];
+			}
+
+			auto merge = [this, i](size_t child) {
+				reaches[i].first = std::min(reaches[i].first, reaches[child].first);
+				reaches[i].second = std::max(reaches[i].second, reaches[child].second);
+			};
+			if (opcode == OpCode::SELECT || opcode == OpCode::JOIN) {
+				for (size_t child : getBranches(i)) {
+					merge(child);
+				}
+				continue;
+			}
+			if (!isLeaf(opcode)) {
+				merge(program.a[i]);
+			}
+			if (isBinary(opcode)) {
+				merge(program.b[i]);
+			}
+		}
+	}
+
+	// Takes the biggest subtrees under the threshold as tasks, the ones much smaller than it are left for the final
+	// sequential pass because a task for them would cost more than evaluating them
+	void split(size_t threshold) {
+		size_t minimum = std::max<size_t>(threshold / 8, 1);
+
+		std::vector<size_t> pending;
+		pending.push_back(program.size() - 1);
+
+		while (!pending.empty()) {
+			size_t i = pending.back();
+			pending.pop_back();
+
+			size_t begin = i + 1 - sizes[i];
+			bool contained = reaches[i].first >= begin && reaches[i].second <= i;
+
+			if (sizes[i] <= threshold && contained) {
+				if (sizes[i] >= minimum) {
+					subtrees.push_back({ begin, i + 1 });
+				}
+				continue;
+			}
+
+			if (isLeaf(program.opcodes[i])) {
+				continue;
+			}
+			if (program.opcodes[i] == OpCode::SELECT || program.opcodes[i] == OpCode::JOIN) {
+				auto branches = getBranches(i);
+				pending.push_back(branches[0]);
+				if (program.opcodes[i] == OpCode::SELECT) {
+					pending.push_back(branches[1]);
+					pending.push_back(branches[2]);
+				}
+				continue;
+			}
+			pending.push_back(program.a[i]);
+			if (isBinary(program.opcodes[i])) {
+				pending.push_back(program.b[i]);
+			}
+		}
+
+		std::sort(subtrees.begin(), subtrees.end(), [](const Subtree& a, const Subtree& b) { return a.begin < b.begin; });
+	}
+
+	// Evaluates the nodes in the range as a stack machine, when the results of the subtrees are given they are
+	// used instead of evaluating the nodes of the subtrees
+	double evaluateRange(size_t begin, size_t end, const double* bindings, const double* subtreeResults) const {
+		std::vector<double> stack;
+		std::vector<double> temporaries(program.temporaryCount);
+		size_t nextSubtree = 0;
+
+		for (size_t i = begin; i < end; i++) {
+			if (subtreeResults != nullptr && nextSubtree < subtrees.size() && subtrees[nextSubtree].begin == i) {
+				stack.push_back(subtreeResults[nextSubtree]);
+				i = subtrees[nextSubtree].end - 1;
+				nextSubtree++;
+				continue;
+			}
+
+			OpCode opcode = program.opcodes[i];
+
+			switch (opcode) {
+			case OpCode::PUSH:
+				stack.push_back(program.constants[program.a[i]]);
+				break;
+			case OpCode::LOAD:
+				stack.push_back(bindings[program.a[i]]);
+				break;
+			case OpCode::POWI:
+				stack.back() = integerPower(stack.back(), static_cast<int32_t>(program.b[i]));
+				break;
+			case OpCode::SAVE:
+				temporaries[program.b[i]] = stack.back();
+				break;
+			case OpCode::RECALL:
+				stack.push_back(temporaries[program.a[i]]);
+				break;
+			case OpCode::SELECT: {
+				double otherwise = stack.back();
+				stack.pop_back();
+				double then = stack.back();
+				stack.pop_back();
+				stack.back() = isTrue(stack.back()) ? then : otherwise;
+				break;
+			}
+			case OpCode::BRANCH: {
+				bool condition = isTrue(stack.back());
+				stack.pop_back();
+				if (!condition) {
+					i = program.b[i] - 1;
+				}
+				break;
+			}
+			case OpCode::JUMP:
+				i = program.b[i] - 1;
+				break;
+			case OpCode::JOIN:
+				break;
+			default: {
+				double bValue = 0;
+				if (isBinary(opcode)) {
+					bValue = stack.back();
+					stack.pop_back();
+				}
+
+				stack.back() = applyOpCode(opcode, stack.back(), bValue);
+				break;
+			}
+			}
+		}
+
+		return stack.back();
+	}
+};
+
+// Incremental evaluation
+
+// Keeps the value of every node of a program, so when only a few variables change between evaluations only the
+// nodes that depend on them are evaluated again. In a tree that is the path from the variable to the root, in a
+// DAG the nodes above any of its uses, and a RECALL depends on its SAVE. The branches of a lazy IF are only
+// evaluated while the IF takes them, the nodes of the other branch that change wait until it is taken, and only the
+// nodes whose value changes mark the nodes that depend on them. Not thread safe, and the compiled expression must
+// outlive the evaluator
+class IncrementalEvaluator {
+public:
+	// The bindings hold the initial value of every variable, as in CompiledExpression::evaluate
+	IncrementalEvaluator(const CompiledExpression& expression, const double* bindings) : expression(expression), program(expression.program) {
+		size_t size = program.size();
+		this->bindings.assign(bindings, bindings + expression.getVariableCount());
+		affected.resize(this->bindings.size());
+		builtAffected.assign(this->bindings.size(), false);
+		values.resize(size);
+		dirty.assign(size, false);
+		marks.assign(size, false);
+		sources.resize(size);
+
+		// The dependencies of every node: its children, or the SAVE of its temporary for a RECALL. The BRANCH
+		// depends on the condition and the JOIN on the BRANCH and both branches
+		std::vector<uint32_t> saves(program.temporaryCount); // Last SAVE of every temporary so far
+		std::vector<uint32_t> stack; // The nodes on the stack of the program, to find the then branch of a SELECT
+		std::vector<uint32_t> open; // Regions of the lazy IFs around the node
+		std::vector<std::pair<uint32_t, uint32_t>> edges; // Node and node that depends on it
+		loadStarts.assign(this->bindings.size() + 1, 0);
+
+		for (uint32_t i = 0; i < size; i++) {
+			OpCode opcode = program.opcodes[i];
+
+			if (opcode == OpCode::BRANCH) {
+				if (guards.empty()) {
+					guards.assign(size, NONE);
+				}
+				guards[i] = open.empty() ? NONE : open.back();
+				sources[i] = static_cast<uint32_t>(regions.size());
+				regions.push_back({ program.a[i], guards[i], true });
+				regions.push_back({ program.a[i], guards[i], false });
+				open.push_back(sources[i]);
+			}
+			else if (opcode == OpCode::JUMP) {
+				open.back()++; // From the then region to the else one
+			}
+			else if (!open.empty()) {
+				if (opcode == OpCode::JOIN) {
+					open.pop_back();
+				}
+				guards[i] = open.empty() ? NONE : open.back();
+			}
+
+			if (opcode == OpCode::LOAD) {
+				loadStarts[program.a[i] + 1]++;
+			}
+			else if (opcode == OpCode::RECALL) {
+				sources[i] = saves[program.a[i]];
+				edges.emplace_back(sources[i], i);
+			}
+			else if (opcode == OpCode::SELECT) {
+				sources[i] = stack[stack.size() - 2];
+				edges.emplace_back(program.a[i], i);
+				edges.emplace_back(sources[i], i);
+				edges.emplace_back(program.b[i], i);
+			}
+			else if (opcode == OpCode::JOIN) {
+				edges.emplace_back(program.a[i], i);
+				edges.emplace_back(program.a[program.b[program.a[i]] - 1], i);
+				edges.emplace_back(program.b[i], i);
+			}
+			else if (opcode != OpCode::PUSH && opcode != OpCode::JUMP) {
+				edges.emplace_back(program.a[i], i);
+				if (opcode == OpCode::SAVE) {
+					saves[program.b[i]] = i;
+				}
+			}
+			if (isBinary(opcode)) {
+				edges.emplace_back(program.b[i], i);
+			}
+
+			updateStack(stack, i);
+		}
+
+		// Both lists are grouped as compressed rows, the nodes that depend on the node i are in
+		// dependents[dependentStarts[i], dependentStarts[i + 1]) and the same for the loads of each slot
+		dependentStarts.assign(size + 1, 0);
+		for (const auto& [node, dependent] : edges) {
+			dependentStarts[node + 1]++;
+		}
+		for (size_t i = 0; i < size; i++) {
+			dependentStarts[i + 1] += dependentStarts[i];
+		}
+		for (size_t slot = 0; slot < this->bindings.size(); slot++) {
+			loadStarts[slot + 1] += loadStarts[slot];
+		}
+
+		dependents.resize(edges.size());
+		std::vector<uint32_t> next(dependentStarts.begin(), dependentStarts.end() - 1);
+		for (const auto& [node, dependent] : edges) {
+			dependents[next[node]++] = dependent;
+		}
+
+		loads.resize(loadStarts.back());
+		next.assign(loadStarts.begin(), loadStarts.end() - 1);
+		for (uint32_t i = 0; i < size; i++) {
+			if (program.opcodes[i] == OpCode::LOAD) {
+				loads[next[program.a[i]]++] = i;
+			}
+		}
+
+		if (regions.empty()) {
+			for (uint32_t i = 0; i < size; i++) {
+				evaluateNode(i);
+			}
+			return;
+		}
+
+		// The branches that aren't taken are left dirty from the start
+		deferred.resize(regions.size());
+		queued.assign((size + 63) / 64, 0);
+		for (uint32_t i = 0; i < size; i++) {
+			markDirty(i);
+		}
+		evaluate();
+	}
+
+	// Changes the value of a variable and returns the new result, only the nodes that depend on it are evaluated
+	double update(size_t slot, double value) {
+		if (!pending.empty() || !regions.empty() || !setBinding(slot, value)) {
+			set(slot, value);
+			return evaluate();
+		}
+
+		// Nothing else changed, so the nodes that depend on the variable are already in order
+		const std::vector<uint32_t>& nodes = getAffectedNodes(slot);
+		for (uint32_t node : nodes) {
+			evaluateNode(node);
+		}
+
+		lastEvaluatedNodes = nodes.size();
+		return values.back();
+	}
+
+	// Throws std::invalid_argument if the expression doesn't have the variable
+	double update(std::string_view name, double value) {
+		size_t slot = expression.variables.find(name);
+		if (slot == VariableTable::NOT_FOUND) {
+			throw std::invalid_argument("Unknown variable " + std::string(name));
+		}
+		return update(slot, value);
+	}
+
+	// Changes the value of a variable without evaluating, so several variables can change before the next evaluate
+	void set(size_t slot, double value) {
+		if (!setBinding(slot, value)) {
+			return;
+		}
+
+		// With lazy IFs the changes go up from the loads while they are evaluated, so a branch that isn't taken
+		// stops them
+		if (!regions.empty()) {
+			for (size_t i = loadStarts[slot]; i < loadStarts[slot + 1]; i++) {
+				markDirty(loads[i]);
+			}
+			return;
+		}
+
+		for (uint32_t node : getAffectedNodes(slot)) {
+			if (!dirty[node]) {
+				dirty[node] = true;
+				pending.push_back(node);
+			}
+		}
+	}
+
+	// Evaluates the nodes that depend on the variables set since the last evaluation, in the order of the program
+	// so their children are always up to date
+	double evaluate() {
+		if (!regions.empty()) {
+			return evaluateBranches();
+		}
+
+		std::sort(pending.begin(), pending.end());
+		for (uint32_t node : pending) {
+			evaluateNode(node);
+			dirty[node] = false;
+		}
+
+		lastEvaluatedNodes = pending.size();
+		pending.clear();
+		return values.back();
+	}
+
+	// Nodes evaluated by the last update or evaluate
+	size_t getLastEvaluatedNodes() const {
+		return lastEvaluatedNodes;
+	}
+
+private:
+	static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+	// One of the branches of a lazy IF, it is taken when the condition is true for the then region
+	struct Region {
+		uint32_t condition;
+		uint32_t parent; // Region of the IF, NONE out of any branch
+		bool then;
+	};
+
+	const CompiledExpression& expression;
+	const Program& program;
+	std::vector<double> bindings;
+	std::vector<double> values; // Of every node
+	std::vector<uint32_t> dependents, dependentStarts;
+	std::vector<uint32_t> loads, loadStarts; // LOAD nodes of every slot
+	std::vector<uint32_t> sources; // SAVE of every RECALL, then branch of every SELECT and then region of every BRANCH
+	std::vector<std::vector<uint32_t>> affected; // Sorted nodes that depend on every slot, built on its first change
+	std::vector<uint8_t> builtAffected;
+	std::vector<uint8_t> dirty;
+	std::vector<uint8_t> marks; // Only used while the affected nodes are found
+	std::vector<uint32_t> pending; // Dirty nodes, in any order, the programs with lazy IFs queue them instead
+	size_t lastEvaluatedNodes = 0;
+
+	// Only for the programs with lazy IFs
+	std::vector<Region> regions; // The then and else regions of every BRANCH, one after the other
+	std::vector<uint32_t> guards; // Innermost region of every node
+	std::vector<std::vector<uint32_t>> deferred; // Dirty nodes that wait for their region to be taken
+	std::vector<uint64_t> queued; // Bits of the dirty nodes to evaluate, the rest of dirty nodes are deferred
+	size_t firstQueued = NONE, lastQueued = 0;
+
+	void queue(uint32_t node) {
+		queued[node / 64] |= uint64_t(1) << (node % 64);
+		firstQueued = std::min<size_t>(firstQueued, node);
+		lastQueued = std::max<size_t>(lastQueued, node);
+	}
+
+	void markDirty(uint32_t node) {
+		if (!dirty[node]) {
+			dirty[node] = true;
+			queue(node);
+		}
+	}
+
+	static int lowestBit(uint64_t bits) {
+#if defined(__GNUC__)
+		return __builtin_ctzll(bits);
+#else
+		int bit = 0;
+		while ((bits & 1) == 0) {
+			bits >>= 1;
+			bit++;
+		}
+		return bit;
+#endif
+	}
+
+	// Same stack as the program has while it runs, each entry is the node of the value
+	void updateStack(std::vector<uint32_t>& stack, uint32_t i) const {
+		OpCode opcode = program.opcodes[i];
+		if (isLeaf(opcode)) {
+			stack.push_back(i);
+			return;
+		}
+		if (opcode == OpCode::BRANCH || opcode == OpCode::JUMP) {
+			stack.pop_back();
+			return;
+		}
+
+		if (opcode == OpCode::SELECT) {
+			stack.resize(stack.size() - 2);
+		}
+		else if (isBinary(opcode)) {
+			stack.pop_back();
+		}
+		stack.back() = i;
+	}
+
+	bool isTaken(uint32_t region) const {
+		return isTrue(values[regions[region].condition]) == regions[region].then;
+	}
+
+	// The outermost region around the node that isn't taken, NONE when the node is evaluated. The conditions of the
+	// regions around a node go before it, so they are already up to date when it is reached in order
+	uint32_t findBlockingRegion(uint32_t node) const {
+		uint32_t blocking = NONE;
+		for (uint32_t region = guards[node]; region != NONE; region = regions[region].parent) {
+			if (!isTaken(region)) {
+				blocking = region;
+			}
+		}
+		return blocking;
+	}
+
+	// The queued nodes are taken in the order of the program, the nodes they mark and the nodes that were waiting
+	// for the branch an IF takes now always go after them, so a single pass over the bits finds them all
+	double evaluateBranches() {
+		size_t evaluated = 0;
+		for (size_t word = firstQueued / 64; firstQueued != NONE && word <= lastQueued / 64; word++) {
+			while (queued[word] != 0) {
+				uint32_t node = static_cast<uint32_t>(word * 64 + lowestBit(queued[word]));
+				queued[word] &= queued[word] - 1;
+				evaluated += evaluateQueued(node);
+			}
+		}
+		firstQueued = NONE;
+		lastQueued = 0;
+
+		lastEvaluatedNodes = evaluated;
+		return values.back();
+	}
+
+	// Returns false if the node has to wait for its branch
+	bool evaluateQueued(uint32_t node) {
+		uint32_t blocking = findBlockingRegion(node);
+		if (blocking != NONE) {
+			deferred[blocking].push_back(node);
+			return false;
+		}
+
+		double previous = values[node];
+		evaluateNode(node);
+		dirty[node] = false;
+
+		if (program.opcodes[node] == OpCode::BRANCH) {
+			// The BRANCH doesn't have a value, its JOIN is always evaluated again
+			uint32_t taken = isTaken(sources[node]) ? sources[node] : sources[node] + 1;
+			for (uint32_t waiting : deferred[taken]) {
+				queue(waiting);
+			}
+			deferred[taken].clear();
+		}
+		else if (std::memcmp(&previous, &values[node], sizeof(previous)) == 0) {
+			return true;
+		}
+
+		for (size_t i = dependentStarts[node]; i < dependentStarts[node + 1]; i++) {
+			markDirty(dependents[i]);
+		}
+		return true;
+	}
+
+	// Returns false if the value is the same, compared by their bits so a NaN that stays the same isn't a change
+	bool setBinding(size_t slot, double value) {
+		if (std::memcmp(&bindings[slot], &value, sizeof(value)) == 0) {
+			return false;
+		}
+		bindings[slot] = value;
+		return true;
+	}
+
+	// Only the variables that change get their list, so most of them never take memory
+	const std::vector<uint32_t>& getAffectedNodes(size_t slot) {
+		std::vector<uint32_t>& nodes = affected[slot];
+		if (builtAffected[slot]) {
+			return nodes;
+		}
+		builtAffected[slot] = true;
+
+		// Every node found is marked so it is only added once, the marks are cleared at the end
+		std::vector<uint32_t> stack(loads.begin() + loadStarts[slot], loads.begin() + loadStarts[slot + 1]);
+		for (uint32_t node : stack) {
+			marks[node] = true;
+		}
+
+		while (!stack.empty()) {
+			uint32_t node = stack.back();
+			stack.pop_back();
+			nodes.push_back(node);
+
+			for (size_t i = dependentStarts[node]; i < dependentStarts[node + 1]; i++) {
+				uint32_t dependent = dependents[i];
+				if (!marks[dependent]) {
+					marks[dependent] = true;
+					stack.push_back(dependent);
+				}
+			}
+		}
+
+		for (uint32_t node : nodes) {
+			marks[node] = false;
+		}
+		std::sort(nodes.begin(), nodes.end());
+		nodes.shrink_to_fit();
+		return nodes;
+	}
+
+	// Same operations as executeProgram, so the result is the same to the last bit
+	void evaluateNode(uint32_t i) {
+		uint32_t a = program.a[i];
+		uint32_t b = program.b[i];
+
+		switch (program.opcodes[i]) {
+		case OpCode::PUSH:
+			values[i] = program.constants[a];
+			break;
+		case OpCode::LOAD:
+			values[i] = bindings[a];
+			break;
+		case OpCode::SAVE:
+			values[i] = values[a];
+			break;
+		case OpCode::RECALL:
+			values[i] = values[sources[i]];
+			break;
+		case OpCode::POWI:
+			values[i] = integerPower(values[a], static_cast<int32_t>(b));
+			break;
+		case OpCode::SELECT:
+			values[i] = isTrue(values[a]) ? values[sources[i]] : values[b];
+			break;
+		case OpCode::JOIN:
+			values[i] = isTrue(values[program.a[a]]) ? values[program.a[program.b[a] - 1]] : values[b];
+			break;
+		case OpCode::BRANCH:
+		case OpCode::JUMP:
+			break;
+		default:
+			values[i] = applyOpCode(program.opcodes[i], values[a], isBinary(program.opcodes[i]) ? values[b] : 0);
+			break;
+		}
+	}
+};
+
+// Automatic differentiation
+
+// Result of an operation node like applyOpCode, and its derivatives by the a and b operands. Where the function has no
+// derivative min and max take the one of the operand they return and abs(0) has 0, as the subgradients do. The fast
+// functions are differentiated with the fast functions
+struct Partials {
+	double a = 0;
+	double b = 0;
+};
+
+double differentiateOpCode(OpCode opcode, double aValue, double bValue, uint32_t exponent, Partials& partials) {
+	double value;
+
+	switch (opcode) {
+	case OpCode::SUM:
+		partials = { 1, 1 };
+		return aValue + bValue;
+	case OpCode::MIN:
+		partials = { 1, -1 };
+		return aValue - bValue;
+	case OpCode::MUL:
+		partials = { bValue, aValue };
+		return aValue * bValue;
+	case OpCode::DIV:
+		value = aValue / bValue;
+		partials = { 1 / bValue, -value / bValue };
+		return value;
+	case OpCode::POW:
+		// The derivative by the exponent is 0 when the power is 0, not the 0 * -inf of its formula. For the negative bases
+		// it is the NaN of their log, their powers only exist at the integers, and both modes drop it when the exponent
+		// doesn't depend on the variable
+		value = std::pow(aValue, bValue);
+		partials = { bValue * std::pow(aValue, bValue - 1), value == 0 ? 0 : value * std::log(aValue) };
+		return value;
+	case OpCode::NEG:
+		partials = { -1 };
+		return -aValue;
+	case OpCode::POWI: {
+		int32_t n = static_cast<int32_t>(exponent);
+		partials = { n == 0 ? 0 : n * integerPower(aValue, n - 1) };
+		return integerPower(aValue, n);
+	}
+	case OpCode::SQRT:
+		value = std::sqrt(aValue);
+		partials = { 0.5 / value };
+		return value;
+	case OpCode::CBRT:
+		value = std::cbrt(aValue);
+		partials = { 1 / (3 * value * value) };
+		return value;
+	case OpCode::MINIMUM:
+		partials = aValue < bValue ? Partials{ 1, 0 } : Partials{ 0, 1 };
+		return minimumOf(aValue, bValue);
+	case OpCode::MAXIMUM:
+		partials = aValue > bValue ? Partials{ 1, 0 } : Partials{ 0, 1 };
+		return maximumOf(aValue, bValue);
+	case OpCode::ABS:
+		partials = { aValue > 0 ? 1.0 : (aValue < 0 ? -1.0 : 0.0) };
+		return std::fabs(aValue);
+	case OpCode::SIN:
+		partials = { std::cos(aValue) };
+		return std::sin(aValue);
+	case OpCode::COS:
+		partials = { -std::sin(aValue) };
+		return std::cos(aValue);
+	case OpCode::EXP:
+		value = std::exp(aValue);
+		partials = { value };
+		return value;
+	case OpCode::LOG:
+		partials = { 1 / aValue };
+		return std::log(aValue);
+	case OpCode::FAST_SIN:
+		partials = { fastCos(aValue) };
+		return fastSin(aValue);
+	case OpCode::FAST_COS:
+		partials = { -fastSin(aValue) };
+		return fastCos(aValue);
+	case OpCode::FAST_EXP:
+		value = fastExp(aValue);
+		partials = { value };
+		return value;
+	case OpCode::FAST_LOG:
+		partials = { 1 / aValue };
+		return fastLog(aValue);
+	default:
+		throw std::invalid_argument("Opcode without derivative");
+	}
+}
+
+enum class DifferentiationMode {
+	FORWARD,
+	REVERSE,
+};
+
+// Evaluates an expression together with its derivatives by all of its variables, instead of the N + 1 evaluations
+// of the finite differences. Both modes run the program once applying the chain rule at every node:
+// - FORWARD carries the N derivatives of every value on the stack with it, dual numbers with N parts, so the cost
+//   grows with the number of variables. It keeps nothing besides the stack, it is the fastest one for a few variables
+// - REVERSE keeps the value and the local derivatives of every node, then walks the nodes backwards from the root
+//   adding the derivative of the result by every node to its children, so all of the gradient costs one more pass
+// Only the branch an IF takes is differentiated, the conditions have no derivative. The results of both modes are
+// the same up to the rounding of the order of their sums. Not thread safe, and the compiled expression must outlive
+// the evaluator
+class GradientEvaluator {
+public:
+	GradientEvaluator(const CompiledExpression& expression, DifferentiationMode mode = DifferentiationMode::REVERSE)
+		: program(expression.program), mode(mode), variableCount(expression.getVariableCount()) {
+		if (mode == DifferentiationMode::FORWARD) {
+			values.resize(program.stackSize + program.temporaryCount);
+			tangents.resize(values.size() * variableCount);
+			return;
+		}
+
+		values.resize(program.size());
+		partials.resize(program.size());
+		adjoints.resize(program.size());
+		reached.resize(program.size());
+		sources.resize(program.size());
+		thenRoots.resize(program.size());
+		saves.resize(program.temporaryCount);
+
+		// The then branch of a SELECT ends right before the else one, its root is found going through all the nodes
+		// in order with the roots of the subtrees on a stack
+		std::vector<uint32_t> roots;
+		for (size_t i = 0; i < program.size(); i++) {
+			OpCode opcode = program.opcodes[i];
+			uint32_t node = static_cast<uint32_t>(i);
+
+			if (isLeaf(opcode)) {
+				roots.push_back(node);
+			}
+			else if (opcode == OpCode::BRANCH || opcode == OpCode::JUMP) {
+				roots.pop_back();
+			}
+			else if (opcode == OpCode::SELECT) {
+				thenRoots[i] = roots[roots.size() - 2];
+				roots.resize(roots.size() - 2);
+				roots.back() = node;
+			}
+			else {
+				if (isBinary(opcode)) {
+					roots.pop_back();
+				}
+				roots.back() = node;
+			}
+		}
+	}
+
+	// The bindings hold one value for each variable as in CompiledExpression::evaluate, and the gradient gets the
+	// derivative by each of them in the same order. Returns the value of the expression
+	double evaluate(const double* bindings, double* gradient) {
+		return mode == DifferentiationMode::FORWARD ? evaluateForward(bindings, gradient) : evaluateReverse(bindings, gradient);
+	}
+
+	DifferentiationMode getMode() const {
+		return mode;
+	}
+
+private:
+	const Program& program;
+	DifferentiationMode mode;
+	size_t variableCount;
+	std::vector<double> values; // Of the stack and the temporaries going forward, of every node going in reverse
+	std::vector<double> tangents; // The derivatives of every value of the stack and the temporaries
+	std::vector<Partials> partials; // Derivatives of every node by its children
+	std::vector<double> adjoints; // Derivative of the result by every node
+	std::vector<bool> reached; // If the value of the node gets to the result
+	std::vector<uint32_t> sources; // The node a RECALL, SELECT or JOIN takes its value from
+	std::vector<uint32_t> thenRoots; // Last node of the then branch of every SELECT
+	std::vector<uint32_t> saves; // The SAVE of every temporary
+
+	double* getTangent(size_t position) {
+		return &tangents[position * variableCount];
+	}
+
+	// The same stack as executeProgram, every position has its value and its derivatives
+	double evaluateForward(const double* bindings, double* gradient) {
+		const size_t count = variableCount;
+		const size_t temporaries = program.stackSize;
+		size_t top = 0;
+
+		for (size_t i = 0; i < program.size(); i++) {
+			OpCode opcode = program.opcodes[i];
+			uint32_t a = program.a[i], b = program.b[i];
+
+			switch (opcode) {
+			case OpCode::PUSH:
+				values[top] = program.constants[a];
+				std::fill_n(getTangent(top), count, 0.0);
+				top++;
+				break;
+			case OpCode::LOAD:
+				values[top] = bindings[a];
+				std::fill_n(getTangent(top), count, 0.0);
+				getTangent(top)[a] = 1;
+				top++;
+				break;
+			case OpCode::SAVE:
+				values[temporaries + b] = values[top - 1];
+				std::copy_n(getTangent(top - 1), count, getTangent(temporaries + b));
+				break;
+			case OpCode::RECALL:
+				values[top] = values[temporaries + a];
+				std::copy_n(getTangent(temporaries + a), count, getTangent(top));
+				top++;
+				break;
+			case OpCode::SELECT: {
+				top -= 2;
+				size_t taken = isTrue(values[top - 1]) ? top : top + 1;
+				values[top - 1] = values[taken];
+				std::copy_n(getTangent(taken), count, getTangent(top - 1));
+				break;
+			}
+			case OpCode::BRANCH:
+				top--;
+				if (!isTrue(values[top])) {
+					i = b - 1;
+				}
+				break;
+			case OpCode::JUMP:
+				i = b - 1;
+				break;
+			case OpCode::JOIN:
+				break;
+			default: {
+				// The result replaces the a operand, and the b operand is the position above it
+				double bValue = 0;
+				if (isBinary(opcode)) {
+					bValue = values[--top];
+				}
+
+				Partials derivatives;
+				values[top - 1] = differentiateOpCode(opcode, values[top - 1], bValue, b, derivatives);
+
+				// An operand that doesn't depend on the variable adds nothing, also with an infinite or NaN partial like the
+				// exponent of a negative base, as going in reverse where its constants drop what they get
+				auto term = [](double partial, double tangent) {
+					return tangent == 0 ? 0 : partial * tangent;
+				};
+
+				double* tangent = getTangent(top - 1);
+				if (isBinary(opcode)) {
+					const double* bTangent = getTangent(top);
+					for (size_t k = 0; k < count; k++) {
+						tangent[k] = term(derivatives.a, tangent[k]) + term(derivatives.b, bTangent[k]);
+					}
+				}
+				else {
+					for (size_t k = 0; k < count; k++) {
+						tangent[k] = term(derivatives.a, tangent[k]);
+					}
+				}
+				break;
+			}
+			}
+		}
+
+		std::copy_n(getTangent(0), count, gradient);
+		return values[0];
+	}
+
+	// The children of every node go before it, so going backwards every node has all of its derivative before it
+	// passes it to its children. The nodes of the branches not taken are skipped in both directions, the values and
+	// derivatives they have are the ones of earlier evaluations
+	double evaluateReverse(const double* bindings, double* gradient) {
+		const size_t size = program.size();
+
+		for (size_t i = 0; i < size; i++) {
+			OpCode opcode = program.opcodes[i];
+			uint32_t a = program.a[i], b = program.b[i];
+
+			switch (opcode) {
+			case OpCode::PUSH:
+				values[i] = program.constants[a];
+				break;
+			case OpCode::LOAD:
+				values[i] = bindings[a];
+				break;
+			case OpCode::SAVE:
+				values[i] = values[a];
+				saves[b] = static_cast<uint32_t>(i);
+				break;
+			case OpCode::RECALL:
+				sources[i] = saves[a];
+				values[i] = values[sources[i]];
+				break;
+			case OpCode::SELECT:
+				sources[i] = isTrue(values[a]) ? thenRoots[i] : b;
+				values[i] = values[sources[i]];
+				break;
+			case OpCode::BRANCH:
+				if (!isTrue(values[a])) {
+					i = b - 1;
+				}
+				break;
+			case OpCode::JUMP:
+				i = b - 1;
+				break;
+			case OpCode::JOIN: {
+				// The condition of the BRANCH decides again which branch ran, the then one ends at the JUMP
+				uint32_t jump = program.b[a] - 1;
+				sources[i] = isTrue(values[program.a[a]]) ? program.a[jump] : b;
+				values[i] = values[sources[i]];
+				break;
+			}
+			default:
+				values[i] = differentiateOpCode(opcode, values[a], isBinary(opcode) ? values[b] : 0, b, partials[i]);
+				break;
+			}
+		}
+
+		std::fill_n(gradient, variableCount, 0.0);
+		std::fill(adjoints.begin(), adjoints.end(), 0.0);
+		std::fill(reached.begin(), reached.end(), false);
+		adjoints[size - 1] = 1;
+		reached[size - 1] = true;
+
+		// Only what the root reaches through the side every SELECT took gets its adjoint, as going forward. Skipping
+		// the adjoints of 0 instead isn't the same, 0 * inf is NaN going forward too
+		auto propagate = [this](uint32_t node, double adjoint) {
+			adjoints[node] += adjoint;
+			reached[node] = true;
+		};
+
+		for (size_t i = size; i-- > 0;) {
+			OpCode opcode = program.opcodes[i];
+			uint32_t a = program.a[i], b = program.b[i];
+			double adjoint = adjoints[i];
+			if (!reached[i] && opcode != OpCode::JOIN && opcode != OpCode::JUMP) {
+				continue;
+			}
+
+			switch (opcode) {
+			case OpCode::PUSH:
+			case OpCode::BRANCH:
+				break;
+			case OpCode::LOAD:
+				gradient[a] += adjoint;
+				break;
+			case OpCode::SAVE:
+				propagate(a, adjoint);
+				break;
+			case OpCode::RECALL:
+			case OpCode::SELECT:
+				propagate(sources[i], adjoint);
+				break;
+			case OpCode::JOIN:
+				// Goes over the else branch when the then one ran, the JUMP is only reached from the else one
+				if (reached[i]) {
+					propagate(sources[i], adjoint);
+				}
+				if (sources[i] != b) {
+					i = program.b[a] - 1;
+				}
+				break;
+			case OpCode::JUMP:
+				i = program.a[b];
+				break;
+			default:
+				propagate(a, partials[i].a * adjoint);
+				if (isBinary(opcode)) {
+					propagate(b, partials[i].b * adjoint);
+				}
+				break;
+			}
+		}
+
+		return values[size - 1];
+	}
+};
+
+} // namespace
@@ -0,0 +1,149 @@
+/*
+ * Tests of the calculator library through the API of calculator.h, like a program that embeds it: only the header
+ * is included and only the library is linked. Every failure prints what was checked.
+ */
+
+#include "calculator.h"
+
+#include<cmath>
+#include<cstdio>
+#include<cstring>
+#include<string>
+
+size_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+	if (!condition) {
+		failures++;
+		std::printf("%s\n", what.c_str());
+	}
+}
+
+bool sameBits(double a, double b) {
+	return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+void checkCompile() {
+	const char* variables[] = { "x", "y" };
+	CalculatorError error;
+
+	// The text doesn't need to end with a '\0', only its length is read
+	const char text[] = "x*y+1 and what follows";
+	CalculatorExpression* expression = calculatorCompile(text, 5, variables, 2, CALCULATOR_DEFAULT, &error);
+	check(expression != nullptr, "x*y+1 doesn't compile");
+	if (expression != nullptr) {
+		double bindings[] = { 2, 3 };
+		check(calculatorEvaluate(expression, bindings) == 7, "x*y+1 isn't 7 at (2, 3)");
+		check(calculatorGetVariableCount(expression) == 2, "x*y+1 doesn't have 2 variables");
+		check(std::strcmp(calculatorGetVariableName(expression, 1), "y") == 0, "the second variable of x*y+1 isn't y");
+		check(calculatorGetVariableName(expression, 2) == nullptr, "x*y+1 has a name for the slot 2");
+		calculatorFree(expression);
+	}
+
+	// The names that aren't given become variables after the given ones
+	expression = calculatorCompile("x+z", 3, variables, 1, CALCULATOR_DEFAULT, &error);
+	check(expression != nullptr, "x+z doesn't compile with new variables");
+	if (expression != nullptr) {
+		check(calculatorGetVariableCount(expression) == 2, "x+z doesn't have 2 variables");
+		check(std::strcmp(calculatorGetVariableName(expression, 1), "z") == 0, "the second variable of x+z isn't z");
+		check(calculatorGetVariableName(expression, static_cast<size_t>(-1)) == nullptr, "x+z has a name for the last slot");
+		calculatorFree(expression);
+	}
+
+	// Without variables the bindings can be NULL
+	expression = calculatorCompile("2^10", 4, nullptr, 0, CALCULATOR_DEFAULT, nullptr);
+	check(expression != nullptr && calculatorEvaluate(expression, nullptr) == 1024, "2^10 isn't 1024");
+	calculatorFree(expression);
+
+	calculatorFree(nullptr);
+	check(calculatorGetVersion() == CALCULATOR_API_VERSION, "the version of the library isn't the one of the header");
+}
+
+void checkErrors() {
+	const char* variables[] = { "x" };
+	CalculatorError error;
+
+	check(calculatorCompile("2+*3", 4, nullptr, 0, CALCULATOR_DEFAULT, &error) == nullptr, "2+*3 compiles");
+	check(error.position == 2, "the error of 2+*3 isn't at 2");
+	check(std::strcmp(error.message, "Unexpected '*' at position 2") == 0, std::string("the error of 2+*3 is ") + error.message);
+
+	check(calculatorCompile("(1+2", 4, nullptr, 0, CALCULATOR_DEFAULT, nullptr) == nullptr, "(1+2 compiles without an error to fill");
+
+	check(calculatorCompile("x+z", 3, variables, 1, CALCULATOR_NO_NEW_VARIABLES, &error) == nullptr, "x+z compiles without new variables");
+	check(error.position == 2, "the error of z in x+z isn't at 2");
+
+	// The message quotes the unknown name, which doesn't fit, so it is cut at the size of the buffer
+	std::string text = "1+" + std::string(400, 'v');
+	std::string expected = "Unknown identifier '" + std::string(400, 'v');
+	check(calculatorCompile(text.data(), text.size(), nullptr, 0, CALCULATOR_NO_NEW_VARIABLES, &error) == nullptr, "a long unknown name compiles");
+	check(error.position == 2, "the error of a long unknown name isn't at 2");
+	check(std::strlen(error.message) == sizeof(error.message) - 1, "the message of a long unknown name isn't cut to the buffer");
+	check(expected.compare(0, sizeof(error.message) - 1, error.message) == 0, std::string("the message of a long unknown name is ") + error.message);
+}
+
+void checkFlags() {
+	const char* variables[] = { "x" };
+
+	// FAST takes the square root for ^0.5, which keeps the sign of -0 that the power drops
+	CalculatorExpression* strict = calculatorCompile("x^0.5", 5, variables, 1, CALCULATOR_DEFAULT, nullptr);
+	CalculatorExpression* fast = calculatorCompile("x^0.5", 5, variables, 1, CALCULATOR_FAST_PRECISION, nullptr);
+	double zero = -0.0;
+	check(!std::signbit(calculatorEvaluate(strict, &zero)), "x^0.5 is -0 at -0 with the strict precision");
+	check(std::signbit(calculatorEvaluate(fast, &zero)), "x^0.5 isn't -0 at -0 with the fast precision");
+	calculatorFree(strict);
+	calculatorFree(fast);
+
+	// Past the evaluations that compile to native code, the bytecode must still give the same bits
+	const char text[] = "sin(x)*x^3/(1+x^2)";
+	CalculatorExpression* jit = calculatorCompile(text, std::strlen(text), variables, 1, CALCULATOR_DEFAULT, nullptr);
+	CalculatorExpression* bytecode = calculatorCompile(text, std::strlen(text), variables, 1, CALCULATOR_NO_JIT, nullptr);
+	bool same = true;
+	for (int i = 0; i < 3000; i++) {
+		double x = i * 0.01 - 15;
+		same &= sameBits(calculatorEvaluate(jit, &x), calculatorEvaluate(bytecode, &x));
+	}
+	check(same, std::string(text) + " gives other results with CALCULATOR_NO_JIT");
+	calculatorFree(jit);
+	calculatorFree(bytecode);
+}
+
+void checkBatch() {
+	const char* variables[] = { "x", "y" };
+	CalculatorExpression* expression = calculatorCompile("x/y+sqrt(x)", 11, variables, 2, CALCULATOR_DEFAULT, nullptr);
+
+	constexpr size_t COUNT = 37; // Not a multiple of the SIMD width, so the last rows are the scalar ones
+	double x[COUNT], y[COUNT], out[COUNT];
+	for (size_t i = 0; i < COUNT; i++) {
+		x[i] = i * 0.75;
+		y[i] = 3.0 - i * 0.25;
+	}
+
+	const double* columns[] = { x, y };
+	calculatorEvaluateBatch(expression, columns, out, COUNT);
+	bool same = true;
+	for (size_t i = 0; i < COUNT; i++) {
+		double bindings[] = { x[i], y[i] };
+		same &= sameBits(out[i], calculatorEvaluate(expression, bindings));
+	}
+	check(same, "the batch of x/y+sqrt(x) differs from the rows evaluated one at a time");
+	calculatorFree(expression);
+
+	// The class of the header frees its handle and throws the message of the error
+	try {
+		calculator::Expression invalid("1+", {});
+		check(false, "the Expression of 1+ doesn't throw");
+	}
+	catch (const std::invalid_argument& exception) {
+		check(std::strcmp(exception.what(), "Unexpected end of the expression at position 2") == 0, std::string("the Expression of 1+ throws ") + exception.what());
+	}
+}
+
+int main() {
+	checkCompile();
+	checkErrors();
+	checkFlags();
+	checkBatch();
+
+	std::printf("%-24s %s\n", "library", failures == 0 ? "passed" : "FAILED");
+	return failures == 0 ? 0 : 1;
+}
@@ -6,238 +6,1326 @@
  * Repository: https://github.com/Electrodiux-pbh/console-calculator
  */
 
-#include<iostream>
-#include<string>
-#include<cmath>
-
-// Operations
-
-enum class Operation {
-	NONE = 0,
-	SUM,
-	MIN,
-	MUL,
-	DIV,
-	POW,
+#include "engine.hpp"
+
+// The server mode waits for its sockets with epoll
+#if defined(__linux__)
+#define CALCULATOR_HAS_SERVER
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<netdb.h>
+#include<cerrno>
+#include<csignal>
+#endif
+
+using namespace calculator::engine;
+
+// Batch input and output
+
+// Reads lines from a file through a large buffer, the lines are views into the buffer that stay valid until the next call
+class LineReader {
+public:
+	static constexpr size_t BUFFER_SIZE = 1024 * 1024;
+
+	LineReader(FILE* file) : file(file), buffer(BUFFER_SIZE) {}
+
+	// The buffer is reused, so the lines must be copied to be kept after the next call
+	bool linesStayValid() const {
+		return false;
+	}
+
+	bool next(std::string_view& line) {
+		while (true) {
+			const char* first = buffer.data() + begin;
+			const char* newline = static_cast<const char*>(std::memchr(first, '\n', end - begin));
+
+			if (newline != nullptr) {
+				size_t length = newline - first;
+				begin += length + 1;
+				line = trimCarriageReturn(std::string_view(first, length));
+				return true;
+			}
+
+			if (finished) {
+				if (begin == end) {
+					return false;
+				}
+
+				line = trimCarriageReturn(std::string_view(first, end - begin));
+				begin = end;
+				return true;
+			}
+
+			fill();
+		}
+	}
+
+private:
+	FILE* file;
+	std::vector<char> buffer;
+	size_t begin = 0; // First character not returned yet
+	size_t end = 0; // End of the characters read from the file
+	bool finished = false;
+
+	// Moves the incomplete line to the start of the buffer and reads after it, growing the buffer for very long lines
+	void fill() {
+		if (begin > 0) {
+			std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+			end -= begin;
+			begin = 0;
+		}
+
+		if (end == buffer.size()) {
+			buffer.resize(buffer.size() * 2);
+		}
+
+		size_t read = std::fread(buffer.data() + end, 1, buffer.size() - end, file);
+		end += read;
+
+		if (read == 0) {
+			finished = true;
+		}
+	}
+
+	static std::string_view trimCarriageReturn(std::string_view line) {
+		if (!line.empty() && line.back() == '\r') {
+			line.remove_suffix(1);
+		}
+		return line;
+	}
+};
+
+// Maps a whole file in memory so its lines can be read as views into the mapped pages without copying them
+class MappedLineReader {
+public:
+	// The pages already read are released every time this many bytes are consumed, so the resident memory stays flat
+	static constexpr size_t RELEASE_INTERVAL = 64 * 1024 * 1024;
+
+	MappedLineReader() = default;
+	MappedLineReader(const MappedLineReader&) = delete;
+	MappedLineReader& operator=(const MappedLineReader&) = delete;
+
+	~MappedLineReader() {
+		close();
+	}
+
+	// Returns false if the file can't be mapped, the caller can still read it with a LineReader
+	bool open(const char* path) {
+#ifdef CALCULATOR_HAS_MMAP
+		int descriptor = ::open(path, O_RDONLY);
+		if (descriptor < 0) {
+			return false;
+		}
+
+		struct stat status;
+		if (fstat(descriptor, &status) != 0) {
+			::close(descriptor);
+			return false;
+		}
+
+		size = static_cast<size_t>(status.st_size);
+		if (size > 0) {
+			void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			if (mapping == MAP_FAILED) {
+				::close(descriptor);
+				size = 0;
+				return false;
+			}
+
+			data = static_cast<const char*>(mapping);
+			madvise(mapping, size, MADV_SEQUENTIAL);
+		}
+
+		::close(descriptor); // The mapping keeps the file alive
+		return true;
+#else
+		(void)path;
+		return false;
+#endif
+	}
+
+	// The released pages are read again from the file if they are accessed, so the lines are valid while the file is mapped
+	bool linesStayValid() const {
+		return true;
+	}
+
+	bool next(std::string_view& line) {
+		if (position >= size) {
+			return false;
+		}
+
+		const char* first = data + position;
+		const char* newline = static_cast<const char*>(std::memchr(first, '\n', size - position));
+		size_t length = newline ? newline - first : size - position;
+
+		position += length + 1;
+		line = std::string_view(first, length);
+		if (!line.empty() && line.back() == '\r') {
+			line.remove_suffix(1);
+		}
+
+		if (position - released >= RELEASE_INTERVAL) {
+			release();
+		}
+
+		return true;
+	}
+
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+	size_t position = 0;
+	size_t released = 0; // Start of the pages still resident
+
+	// Tells the system the pages before the current line won't be needed again
+	void release() {
+#ifdef CALCULATOR_HAS_MMAP
+		size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		size_t end = (std::min(position, size) / pageSize) * pageSize;
+
+		if (end > released) {
+			madvise(const_cast<char*>(data) + released, end - released, MADV_DONTNEED);
+			released = end;
+		}
+#endif
+	}
+
+	void close() {
+#ifdef CALCULATOR_HAS_MMAP
+		if (data != nullptr) {
+			munmap(const_cast<char*>(data), size);
+			data = nullptr;
+		}
+#endif
+	}
 };
 
-Operation getOperationFromChar(char c) {
-	switch (c) {
-	case '+':
-		return Operation::SUM;
-	case '-':
-		return Operation::MIN;
-	case '*':
-		return Operation::MUL;
-	case '/':
-		return Operation::DIV;
-	case '^':
-		return Operation::POW;
-	}
-	return Operation::NONE;
+// Collects the output in a buffer that is written to the file only when it is full
+class OutputWriter {
+public:
+	static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+	OutputWriter(FILE* file) : file(file) {
+		buffer.reserve(BUFFER_SIZE + 64);
+	}
+
+	~OutputWriter() {
+		flush();
+	}
+
+	void write(std::string_view text) {
+		buffer.append(text);
+		if (buffer.size() >= BUFFER_SIZE) {
+			flush();
+		}
+	}
+
+
+	void flush() {
+		if (!buffer.empty()) {
+			std::fwrite(buffer.data(), 1, buffer.size(), file);
+			buffer.clear();
+		}
+		std::fflush(file);
+	}
+
+private:
+	FILE* file;
+	std::string buffer;
+};
+
+// Appends the result of one line of the batch input followed by a new line, the empty lines are kept as empty lines
+// so the output lines match the input lines, the lines that fail are written as "error" and its message is added to the errors
+// Nothing throws here, so a bad line costs the same as a good one
+bool evaluateLine(std::string_view line, size_t lineNumber, ExpressionCache& cache, std::string& output, std::string& errors) {
+	bool success = true;
+
+	if (line.find_first_not_of(" \t") != std::string_view::npos) {
+		ScopedTimer timer(Timer::LINE);
+
+		CompileError error;
+		auto expression = cache.get(line, error);
+
+		if (expression) {
+			appendNumber(output, expression->evaluate(nullptr));
+		}
+		else {
+			errors += "Line " + std::to_string(lineNumber) + ": " + error.getMessage(line) + ": ";
+			errors += line;
+			errors += '\n';
+			output += "error";
+			success = false;
+		}
+	}
+
+	output += '\n';
+	return success;
 }
 
-constexpr int MIN_PRIORITY = 1;
-constexpr int MAX_PRIORITY = 3;
+// Evaluates one expression per line and writes one result per line
+// Both the LineReader and the MappedLineReader can be used as reader
+template<typename Reader>
+int runBatch(Reader& reader, ExpressionCache& cache) {
+	OutputWriter writer(stdout); // Reused for all the results so the memory doesn't grow with the input
+	OutputWriter errorWriter(stderr); // The standard error isn't buffered, so many bad lines would be a write each
 
-int getPriority(Operation operation) {
-	switch (operation) {
-	case Operation::SUM:
-	case Operation::MIN:
-		return 1;
-	case Operation::MUL:
-	case Operation::DIV:
-		return 2;
-	case Operation::POW:
-		return 3;
-	default:
-		return 0;
+	std::string_view line;
+	std::string output, errors;
+	size_t lineNumber = 0;
+	int status = 0;
+
+	while (reader.next(line)) {
+		lineNumber++;
+
+		output.clear();
+		if (!evaluateLine(line, lineNumber, cache, output, errors)) {
+			errorWriter.write(errors);
+			errors.clear();
+			status = 1;
+		}
+
+		writer.write(output);
 	}
+
+	return status;
 }
 
-// Tokens
+// A group of consecutive lines evaluated by one task of the parallel batch
+struct BatchChunk {
+	size_t firstLineNumber = 0;
+	std::vector<std::string_view> lines;
+	std::string storage; // Copy of the lines when the reader doesn't keep them valid
+	std::vector<size_t> lengths;
 
-struct Token {
-	virtual double resolve() = 0; // Pure virtual function
-	virtual ~Token() {} // Virtual destructor
+	std::string output;
+	std::string errors;
+	bool success = true;
+	std::atomic<bool> done{ false };
 };
 
-struct NumberToken : Token {
+// Evaluates the lines in chunks on a work stealing pool and writes the results in the order of the input
+// Every thread has its own cache, so the threads don't share any mutable state while compiling and evaluating
+template<typename Reader>
+int runParallelBatch(Reader& reader, ExpressionCache& cache, size_t threadCount) {
+	constexpr size_t CHUNK_LINES = 1024;
+	constexpr size_t CHUNKS_PER_THREAD = 4; // Chunks in flight for each thread, the memory is bounded by this window
 
-	double value;
+	ThreadPool pool(threadCount);
+	OutputWriter writer(stdout);
+	OutputWriter errorWriter(stderr);
 
-	NumberToken(double value) {
-		this->value = value;
+	// One cache for every worker and one for the main thread, which runs tasks while it waits, all of them
+	// start with their own copies of the expressions already in the cache, like the preloaded ones
+	std::vector<ExpressionCache> caches;
+	caches.reserve(threadCount + 1);
+	for (size_t i = 0; i <= threadCount; i++) {
+		caches.emplace_back(cache);
 	}
 
-	double resolve() override {
-		return value;
+	std::vector<BatchChunk> chunks(threadCount * CHUNKS_PER_THREAD);
+
+	std::string_view line;
+	size_t lineNumber = 0;
+	bool finished = false;
+	int status = 0;
+
+	while (!finished) {
+		size_t used = 0;
+
+		for (; used < chunks.size() && !finished; used++) {
+			BatchChunk& chunk = chunks[used];
+			chunk.firstLineNumber = lineNumber + 1;
+			chunk.lines.clear();
+			chunk.storage.clear();
+			chunk.lengths.clear();
+
+			while (chunk.lines.size() + chunk.lengths.size() < CHUNK_LINES) {
+				if (!reader.next(line)) {
+					finished = true;
+					break;
+				}
+
+				lineNumber++;
+				if (reader.linesStayValid()) {
+					chunk.lines.push_back(line);
+				}
+				else {
+					chunk.storage.append(line);
+					chunk.lengths.push_back(line.size());
+				}
+			}
+
+			// The views are created once the storage won't grow anymore
+			size_t offset = 0;
+			for (size_t length : chunk.lengths) {
+				chunk.lines.emplace_back(chunk.storage.data() + offset, length);
+				offset += length;
+			}
+			chunk.lengths.clear();
+
+			chunk.done.store(false, std::memory_order_relaxed);
+			pool.submit([&chunk, &caches, threadCount] {
+				ExpressionCache& threadCache = caches[std::min(ThreadPool::getCurrentWorkerIndex(), threadCount)];
+
+				chunk.output.clear();
+				chunk.errors.clear();
+				chunk.success = true;
+
+				for (size_t i = 0; i < chunk.lines.size(); i++) {
+					chunk.success &= evaluateLine(chunk.lines[i], chunk.firstLineNumber + i, threadCache, chunk.output, chunk.errors);
+				}
+
+				chunk.done.store(true, std::memory_order_release);
+			});
+		}
+
+		for (size_t i = 0; i < used; i++) {
+			BatchChunk& chunk = chunks[i];
+			pool.waitFor([&chunk] { return chunk.done.load(std::memory_order_acquire); });
+
+			if (!chunk.success) {
+				errorWriter.write(chunk.errors);
+				status = 1;
+			}
+			writer.write(chunk.output);
+		}
 	}
 
-};
+	return status;
+}
+
+// Compiles every line of the input and saves them in a program file to preload them later, the repeated
+// expressions are saved once and the lines that fail are reported and skipped
+template<typename Reader>
+int compileToProgramFile(Reader& reader, const CompileOptions& options, const char* path) {
+	ProgramFileWriter writer;
+	std::unordered_set<std::string> saved; // Normalized as the keys of the cache
+	std::string key;
+
+	std::string_view line;
+	size_t lineNumber = 0;
+	int status = 0;
+
+	while (reader.next(line)) {
+		lineNumber++;
+
+		if (line.find_first_not_of(" \t") == std::string_view::npos) {
+			continue;
+		}
+
+		normalizeExpression(line, key);
+		if (!saved.insert(key).second) {
+			continue;
+		}
+
+		CompiledExpression compiled;
+		CompileError error = tryCompileExpression(line, {}, compiled, options);
+		if (error) {
+			std::cerr << "Line " << lineNumber << ": " << error.getMessage(line) << ": " << line << "\n";
+			status = 1;
+			continue;
+		}
+
+		writer.add(line, compiled);
+	}
+
+	if (!writer.save(path)) {
+		std::cerr << "Can't write " << path << std::endl;
+		return 1;
+	}
+
+	std::cerr << "Saved " << writer.getCount() << " expressions in " << path << std::endl;
+	return status;
+}
+
+// Adds the expressions of a program file to the cache and returns how many were added. The expressions of the
+// cache are evaluated without bindings, so the ones with variables are skipped
+// Both the ExpressionCache and the SharedExpressionCache can be used as cache
+template<typename Cache>
+size_t preloadCache(Cache& cache, const ProgramFile& file) {
+	size_t added = 0;
+
+	for (size_t i = 0; i < file.size(); i++) {
+		if (file.getVariableCount(i) > 0) {
+			continue;
+		}
+
+		auto compiled = std::make_shared<CompiledExpression>();
+		file.load(i, *compiled);
+		compiled->jit.setThreshold(cache.getOptions().jitThreshold);
+		cache.insert(file.getSource(i), std::move(compiled));
+		added++;
+	}
+
+	return added;
+}
 
-struct OperationToken : Token {
-	Operation operation;
+// Server
 
-	std::unique_ptr<Token> a, b;
+// Long running mode that evaluates the batches of expressions its clients send through a Unix or TCP socket. One
+// thread runs the event loop on epoll, it accepts the connections, cuts their input into requests and writes the
+// replies, and the requests are evaluated by the threads of a pool, which share the cache of compiled expressions.
+// A client can send many requests without waiting for the replies and every request is replied as soon as it is
+// evaluated, so the replies can come in another order than the requests, each one has the id of its request.
+//
+// Every message is a frame, the integers are little endian and the doubles are their IEEE 754 bits as a uint64:
+//   uint32 length                 bytes of the frame after this field
+//   uint32 id                     chosen by the client
+// Request:
+//   uint32 bindingCount
+//   bindings[bindingCount]        uint32 nameLength, char name[nameLength], double value
+//   uint32 expressionCount
+//   expressions[expressionCount]  uint32 length, char text[length]
+// Reply:
+//   uint32 resultCount            one for each expression of the request, in the same order
+//   results[resultCount]          uint8 status, then the double value when it is 0 or the error when it is 1:
+//                                 uint32 length, char message[length]
+//
+// The variables of the expressions of a request take their values from its bindings, an expression with a variable
+// without binding is an error. A frame that isn't well formed or is longer than MAX_FRAME_SIZE closes the connection
 
-	OperationToken(Operation operation, std::unique_ptr<Token> a, std::unique_ptr<Token> b)
-		: operation(operation), a(std::move(a)), b(std::move(b)) {}
+void appendUint32(std::string& data, uint32_t value) {
+	char bytes[4] = { char(value), char(value >> 8), char(value >> 16), char(value >> 24) };
+	data.append(bytes, sizeof(bytes));
+}
+
+void appendDouble(std::string& data, double value) {
+	uint64_t bits = toBits(value);
+	appendUint32(data, static_cast<uint32_t>(bits));
+	appendUint32(data, static_cast<uint32_t>(bits >> 32));
+}
 
-	OperationToken(Operation operation, std::unique_ptr<Token> a)
-		: operation(operation), a(std::move(a)), b(std::make_unique<NumberToken>(0)) {}
+void appendText(std::string& data, std::string_view text) {
+	appendUint32(data, static_cast<uint32_t>(text.size()));
+	data.append(text);
+}
+
+uint32_t decodeUint32(const char* data) {
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+	return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+}
 
-	double resolve() override {
-		double aValue = a->resolve();
-		double bValue = b->resolve();
+// Reads the fields of a frame, every read fails once a field would go past its end
+class FrameReader {
+public:
+	FrameReader(std::string_view data) : data(data) {}
 
-		switch (operation) {
-		case Operation::SUM:
-			return aValue + bValue;
-		case Operation::MIN:
-			return aValue - bValue;
-		case Operation::MUL:
-			return aValue * bValue;
-		case Operation::DIV:
-			return aValue / bValue;
-		case Operation::POW:
-			return std::pow(aValue, bValue);
-		default:
-			return 0;
+	bool readUint32(uint32_t& value) {
+		if (data.size() - offset < 4) {
+			return false;
 		}
+		value = decodeUint32(data.data() + offset);
+		offset += 4;
+		return true;
 	}
+
+	bool readDouble(double& value) {
+		uint32_t low, high;
+		if (!readUint32(low) || !readUint32(high)) {
+			return false;
+		}
+		value = fromBits(uint64_t(high) << 32 | low);
+		return true;
+	}
+
+	bool readText(std::string_view& text) {
+		uint32_t length;
+		if (!readUint32(length) || data.size() - offset < length) {
+			return false;
+		}
+		text = data.substr(offset, length);
+		offset += length;
+		return true;
+	}
+
+	bool isAtEnd() const {
+		return offset == data.size();
+	}
+
+private:
+	std::string_view data;
+	size_t offset = 0;
 };
 
-// Parser
+// Appends the reply frame of a request frame without its length field, returns false without a complete reply if the
+// request isn't well formed. Like the batch lines nothing throws, the expressions that fail are errors of the reply
+bool evaluateRequest(std::string_view request, SharedExpressionCache& cache, std::string& reply) {
+	ScopedTimer timer(Timer::REQUEST);
+	countEvent(Counter::SERVER_REQUESTS);
 
-constexpr double PI = 3.14159265358979323846;
-constexpr double E = 2.71828182845904523536;
+	FrameReader reader(request);
+	thread_local std::vector<std::pair<std::string_view, double>> bindings;
+	thread_local std::vector<double> values; // Of the slots of the expression being evaluated
+	bindings.clear();
 
-double parseNumber(std::string token) {
-	if (token == "pi") {
-		return PI;
+	uint32_t id, bindingCount;
+	if (!reader.readUint32(id) || !reader.readUint32(bindingCount)) {
+		return false;
 	}
-	else if (token == "e") {
-		return E;
+
+	for (uint32_t i = 0; i < bindingCount; i++) {
+		std::string_view name;
+		double value;
+		if (!reader.readText(name) || !reader.readDouble(value)) {
+			return false;
+		}
+		bindings.emplace_back(name, value);
 	}
-	else {
-		return std::stod(token);
+
+	uint32_t expressionCount;
+	if (!reader.readUint32(expressionCount)) {
+		return false;
+	}
+
+	// The length goes first, it is known once the results are written
+	size_t start = reply.size();
+	appendUint32(reply, 0);
+	appendUint32(reply, id);
+	appendUint32(reply, expressionCount);
+
+	std::string message;
+	for (uint32_t i = 0; i < expressionCount; i++) {
+		std::string_view text;
+		if (!reader.readText(text)) {
+			return false;
+		}
+
+		CompileError error;
+		auto expression = cache.get(text, error);
+		message.clear();
+
+		if (expression) {
+			const std::vector<std::string>& names = expression->variables.names;
+			values.resize(names.size());
+
+			for (size_t slot = 0; slot < names.size() && message.empty(); slot++) {
+				auto found = std::find_if(bindings.begin(), bindings.end(), [&](const auto& binding) { return binding.first == names[slot]; });
+				if (found == bindings.end()) {
+					message = "Unbound variable " + names[slot];
+				}
+				else {
+					values[slot] = found->second;
+				}
+			}
+		}
+		else {
+			message = error.getMessage(text);
+		}
+
+		if (message.empty()) {
+			reply.push_back(0);
+			appendDouble(reply, expression->evaluate(values.data()));
+		}
+		else {
+			reply.push_back(1);
+			appendText(reply, message);
+		}
+	}
+
+	if (!reader.isAtEnd()) {
+		return false;
 	}
+
+	std::string length;
+	appendUint32(length, static_cast<uint32_t>(reply.size() - start - 4));
+	reply.replace(start, 4, length);
+	return true;
 }
 
-std::unique_ptr<Token> parseToken(std::string expression) {
-	std::string right, left;
+#ifdef CALCULATOR_HAS_SERVER
+class CalculatorServer {
+public:
+	static constexpr uint32_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+	// A connection isn't read while it has this many requests being evaluated or this many bytes of replies that
+	// its client hasn't read, so a client that sends faster than it reads can't make the server run out of memory
+	static constexpr size_t MAX_PENDING_REQUESTS = 64;
+	static constexpr size_t MAX_PENDING_OUTPUT = 16 * 1024 * 1024;
+	static constexpr size_t READ_SIZE = 64 * 1024;
 
-	for (int i = 0; i < expression.size(); i++) {
-		char character = expression[i];
+	CalculatorServer(SharedExpressionCache& cache, ThreadPool& pool) : cache(cache), pool(pool) {}
 
-		if (character == '(') {
-			int open = 1;
-			int close = 0;
+	CalculatorServer(const CalculatorServer&) = delete;
+	CalculatorServer& operator=(const CalculatorServer&) = delete;
 
-			for (int j = i + 1; j < expression.size(); j++) {
-				char character = expression[j];
+	~CalculatorServer() {
+		// The tasks still running reply to the server
+		pool.waitFor([this] { return runningTasks.load(std::memory_order_acquire) == 0; });
 
-				if (character == '(') {
-					open++;
+		for (auto& connection : connections) {
+			::close(connection.first->fd);
+		}
+		for (int fd : { listenFd, wakeFd, epollFd }) {
+			if (fd >= 0) {
+				::close(fd);
+			}
+		}
+		if (!unixPath.empty()) {
+			::unlink(unixPath.c_str());
+		}
+	}
+
+	// The address is unix:<path> for a Unix socket or [host]:port for TCP, the host is every interface when it is empty
+	bool listen(const std::string& address) {
+		epollFd = epoll_create1(EPOLL_CLOEXEC);
+		wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (epollFd < 0 || wakeFd < 0) {
+			return fail("Can't create the event loop");
+		}
+
+		if (address.compare(0, 5, "unix:") == 0) {
+			sockaddr_un socketAddress{};
+			std::string path = address.substr(5);
+			if (path.empty() || path.size() >= sizeof(socketAddress.sun_path)) {
+				error = "Invalid socket path " + path;
+				return false;
+			}
+
+			// A socket left by a server that didn't end is replaced, any other file is kept
+			struct stat status;
+			if (::stat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+				::unlink(path.c_str());
+			}
+
+			socketAddress.sun_family = AF_UNIX;
+			std::memcpy(socketAddress.sun_path, path.c_str(), path.size() + 1);
+
+			listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0) {
+				return fail("Can't listen on " + path);
+			}
+			unixPath = path;
+		}
+		else {
+			size_t colon = address.rfind(':');
+			if (colon == std::string::npos) {
+				error = "The address " + address + " has no port";
+				return false;
+			}
+
+			std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+			if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+				host = host.substr(1, host.size() - 2); // IPv6
+			}
+
+			addrinfo hints{};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = AI_PASSIVE;
+
+			addrinfo* addresses = nullptr;
+			int result = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses);
+			if (result != 0) {
+				error = "Can't resolve " + address + ": " + gai_strerror(result);
+				return false;
+			}
+
+			for (addrinfo* candidate = addresses; candidate != nullptr && listenFd < 0; candidate = candidate->ai_next) {
+				listenFd = ::socket(candidate->ai_family, candidate->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, candidate->ai_protocol);
+				if (listenFd < 0) {
+					continue;
 				}
-				else if (character == ')') {
-					close++;
+
+				int enable = 1;
+				::setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+				if (::bind(listenFd, candidate->ai_addr, candidate->ai_addrlen) != 0) {
+					::close(listenFd);
+					listenFd = -1;
 				}
+			}
+			freeaddrinfo(addresses);
+
+			if (listenFd < 0) {
+				return fail("Can't listen on " + address);
+			}
+		}
+
+		if (::listen(listenFd, SOMAXCONN) != 0) {
+			return fail("Can't listen on " + address);
+		}
+
+		return watch(listenFd, &listenFd, EPOLLIN) && watch(wakeFd, &wakeFd, EPOLLIN);
+	}
+
+	// Runs the event loop until stop is called, returns false if it can't wait for the sockets
+	bool run() {
+		epoll_event events[64];
+
+		while (!stopping.load(std::memory_order_acquire)) {
+			int count = epoll_wait(epollFd, events, 64, -1);
+			if (count < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return fail("Can't wait for the connections");
+			}
 
-				if (open == close) {
-					std::string subExpression = expression.substr(i + 1, j - i - 1);
-					std::unique_ptr<Token> token = parseToken(subExpression);
+			for (int i = 0; i < count; i++) {
+				void* source = events[i].data.ptr;
 
-					std::string newExpression = expression.substr(0, i) + std::to_string(token->resolve()) + expression.substr(j + 1);
-					return parseToken(newExpression);
+				if (source == &listenFd) {
+					acceptConnections();
+				}
+				else if (source == &wakeFd) {
+					uint64_t wakes;
+					while (::read(wakeFd, &wakes, sizeof(wakes)) > 0) {}
+					sendReplies();
+				}
+				else {
+					Connection& connection = *static_cast<Connection*>(source);
+					if (!connection.closed && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+						closeConnection(connection);
+					}
+					if (!connection.closed && (events[i].events & EPOLLIN)) {
+						receive(connection);
+					}
+					if (!connection.closed && (events[i].events & EPOLLOUT)) {
+						send(connection);
+					}
 				}
 			}
+
+			// The connections closed in this round could still have events in it
+			closedConnections.clear();
 		}
+
+		return true;
 	}
 
-	// Iterate over the priority of the operations
-	// We will first resolve the operations with priority 1 and then the operations with priority 2
-	// Because creating the tree the operations that are more deep (proirity 2) will be resolved first
-	for (int priority = MIN_PRIORITY; priority <= MAX_PRIORITY; priority++) {
-		// Iterate over the expression
-		for (int i = 0; i < expression.size(); i++) {
-			char character = expression[i];
+	// Ends run, it can be called from any thread and from the signal handlers
+	void stop() {
+		stopping.store(true, std::memory_order_release);
+		uint64_t wake = 1;
+		[[maybe_unused]] ssize_t written = ::write(wakeFd, &wake, sizeof(wake));
+	}
 
-			// Get the operation
-			Operation operation = getOperationFromChar(character);
+	const std::string& getError() const {
+		return error;
+	}
 
-			if (operation == Operation::NONE) {
-				continue;
+private:
+	struct Connection {
+		int fd = -1;
+		uint32_t events = EPOLLIN; // Watched by epoll
+		std::string input; // Received bytes from inputOffset that aren't a whole request yet
+		size_t inputOffset = 0;
+		std::string output; // Replies from outputOffset that haven't been sent yet
+		size_t outputOffset = 0;
+		size_t pendingRequests = 0; // Submitted and not yet moved to the output
+		bool inputClosed = false;
+		bool closed = false;
+
+		// Written by the tasks, moved to the output by the event loop
+		std::mutex mutex;
+		std::string replies;
+		size_t completedRequests = 0;
+		bool invalid = false; // A request wasn't well formed
+		bool queued = false; // In the ready connections
+	};
+
+	SharedExpressionCache& cache;
+	ThreadPool& pool;
+
+	int epollFd = -1;
+	int listenFd = -1;
+	int wakeFd = -1; // Wakes the event loop when there are replies or it has to stop
+	std::string unixPath; // Removed when the server ends
+	std::string error;
+	std::atomic<bool> stopping{ false };
+	std::atomic<size_t> runningTasks{ 0 };
+
+	// Only used by the event loop
+	std::unordered_map<Connection*, std::shared_ptr<Connection>> connections;
+	std::vector<std::shared_ptr<Connection>> closedConnections;
+
+	std::mutex readyMutex;
+	std::vector<std::shared_ptr<Connection>> readyConnections; // With replies for the event loop
+
+	bool fail(const std::string& message) {
+		error = message + ": " + std::strerror(errno);
+		return false;
+	}
+
+	bool watch(int fd, void* source, uint32_t events) {
+		epoll_event event{};
+		event.events = events;
+		event.data.ptr = source;
+		return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0 || fail("Can't watch the socket");
+	}
+
+	void acceptConnections() {
+		while (true) {
+			int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) {
+				return; // No more connections or out of descriptors, the rest wait in the backlog
 			}
 
-			int operationPriority = getPriority(operation);
-			if (operationPriority != priority) {
+			// Small replies go out at once, it fails without harm on the Unix sockets
+			int enable = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+			auto connection = std::make_shared<Connection>();
+			connection->fd = fd;
+			if (!watch(fd, connection.get(), connection->events)) {
+				::close(fd);
 				continue;
 			}
+			connections.emplace(connection.get(), std::move(connection));
+		}
+	}
+
+	void closeConnection(Connection& connection) {
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.fd, nullptr);
+		::close(connection.fd);
+		connection.closed = true;
+
+		auto found = connections.find(&connection);
+		closedConnections.push_back(std::move(found->second));
+		connections.erase(found);
+	}
+
+	bool canReceive(const Connection& connection) const {
+		return !connection.inputClosed && connection.pendingRequests < MAX_PENDING_REQUESTS
+			&& connection.output.size() - connection.outputOffset < MAX_PENDING_OUTPUT;
+	}
+
+	// Watches the connection for what it can do now, and closes it once its client is done with it
+	void update(Connection& connection) {
+		if (connection.inputClosed && connection.pendingRequests == 0 && connection.outputOffset == connection.output.size()) {
+			closeConnection(connection);
+			return;
+		}
+
+		uint32_t events = 0;
+		if (canReceive(connection)) {
+			events |= EPOLLIN;
+		}
+		if (connection.outputOffset < connection.output.size()) {
+			events |= EPOLLOUT;
+		}
+		if (events != connection.events) {
+			epoll_event event{};
+			event.events = events;
+			event.data.ptr = &connection;
+			epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+			connection.events = events;
+		}
+	}
+
+	void receive(Connection& connection) {
+		while (canReceive(connection)) {
+			std::string& input = connection.input;
+			size_t size = input.size();
+			input.resize(size + READ_SIZE);
 
-			// Get right and left side of the operation
-			right = expression.substr(i + 1);
-			left = expression.substr(0, i);
+			ssize_t received = ::recv(connection.fd, &input[size], READ_SIZE, 0);
+			input.resize(size + std::max<ssize_t>(received, 0));
+
+			if (received == 0) {
+				connection.inputClosed = true; // The client can still read the replies
+			}
+			else if (received < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					closeConnection(connection);
+					return;
+				}
+				break;
+			}
+
+			if (!submitRequests(connection)) {
+				closeConnection(connection);
+				return;
+			}
+		}
+
+		update(connection);
+	}
+
+	// Submits the whole requests of the input while the connection can take them, false if a frame is too long
+	bool submitRequests(Connection& connection) {
+		std::string& input = connection.input;
+
+		while (connection.pendingRequests < MAX_PENDING_REQUESTS && input.size() - connection.inputOffset >= 4) {
+			uint32_t length = decodeUint32(input.data() + connection.inputOffset);
+			if (length > MAX_FRAME_SIZE) {
+				return false;
+			}
+			if (input.size() - connection.inputOffset - 4 < length) {
+				break;
+			}
+
+			std::string request = input.substr(connection.inputOffset + 4, length);
+			connection.inputOffset += 4 + size_t(length);
+			connection.pendingRequests++;
+			runningTasks.fetch_add(1, std::memory_order_relaxed);
+
+			pool.submit([this, connection = connections.at(&connection), request = std::move(request)] {
+				thread_local std::string reply;
+				reply.clear();
+				bool valid = evaluateRequest(request, cache, reply);
+
+				bool wake = false;
+				{
+					std::lock_guard<std::mutex> lock(connection->mutex);
+					if (valid) {
+						connection->replies += reply;
+					}
+					connection->invalid |= !valid;
+					connection->completedRequests++;
+
+					wake = !connection->queued;
+					connection->queued = true;
+				}
+
+				// The event loop is woken once for all the replies it hasn't seen yet
+				if (wake) {
+					{
+						std::lock_guard<std::mutex> lock(readyMutex);
+						readyConnections.push_back(connection);
+					}
+					uint64_t one = 1;
+					[[maybe_unused]] ssize_t written = ::write(wakeFd, &one, sizeof(one));
+				}
+				runningTasks.fetch_sub(1, std::memory_order_release);
+			});
+		}
 
-			if (left == "" && operation == Operation::MIN) { // If there is a minus sign and there is no left member ignore so it process as negative number
+		// The consumed bytes are removed once they are many, so they aren't moved for every request
+		if (connection.inputOffset == input.size()) {
+			input.clear();
+			connection.inputOffset = 0;
+		}
+		else if (connection.inputOffset >= READ_SIZE) {
+			input.erase(0, connection.inputOffset);
+			connection.inputOffset = 0;
+		}
+		return true;
+	}
+
+	// Moves the replies of the tasks to the outputs and sends them, then the connections that were full take more requests
+	void sendReplies() {
+		std::vector<std::shared_ptr<Connection>> ready;
+		{
+			std::lock_guard<std::mutex> lock(readyMutex);
+			ready.swap(readyConnections);
+		}
+
+		for (const std::shared_ptr<Connection>& connection : ready) {
+			bool invalid;
+			{
+				std::lock_guard<std::mutex> lock(connection->mutex);
+				connection->output += connection->replies;
+				connection->replies.clear();
+				connection->pendingRequests -= connection->completedRequests;
+				connection->completedRequests = 0;
+				connection->queued = false;
+				invalid = connection->invalid;
+			}
+
+			if (connection->closed) {
+				continue;
+			}
+			if (invalid) {
+				closeConnection(*connection);
 				continue;
 			}
 
-			// Parse the right and left side of the operation
-			std::unique_ptr<Token> a = parseToken(left);
-			std::unique_ptr<Token> b = parseToken(right);
+			send(*connection);
+			if (!connection->closed && !submitRequests(*connection)) {
+				closeConnection(*connection);
+			}
+			if (!connection->closed) {
+				update(*connection);
+			}
+		}
+	}
+
+	void send(Connection& connection) {
+		std::string& output = connection.output;
 
-			return std::make_unique<OperationToken>(operation, std::move(a), std::move(b));
+		while (connection.outputOffset < output.size()) {
+			ssize_t sent = ::send(connection.fd, output.data() + connection.outputOffset, output.size() - connection.outputOffset, MSG_NOSIGNAL);
+			if (sent > 0) {
+				connection.outputOffset += sent;
+			}
+			else if (sent < 0 && errno == EINTR) {
+				continue;
+			}
+			else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				break;
+			}
+			else {
+				closeConnection(connection);
+				return;
+			}
 		}
+
+		if (connection.outputOffset == output.size()) {
+			output.clear();
+			connection.outputOffset = 0;
+		}
+		update(connection);
 	}
+};
 
-	// If the token is a number
-	return std::make_unique<NumberToken>(parseNumber(expression));
+// The server that SIGINT and SIGTERM stop
+CalculatorServer* runningServer = nullptr;
+
+extern "C" void stopRunningServer(int) {
+	if (runningServer != nullptr) {
+		runningServer->stop();
+	}
 }
 
-std::unique_ptr<Token> compileExpression(std::string expression) {
-	std::string expressionWithoutSpaces = expression;
-	expressionWithoutSpaces.erase(std::remove(expressionWithoutSpaces.begin(), expressionWithoutSpaces.end(), ' '), expressionWithoutSpaces.end());
+// Serves until it gets SIGINT or SIGTERM, the pool evaluates the requests and the calling thread runs the event loop
+int runServer(const std::string& address, SharedExpressionCache& cache, size_t threadCount) {
+	ThreadPool pool(threadCount);
+	CalculatorServer server(cache, pool);
+
+	if (!server.listen(address)) {
+		std::cerr << server.getError() << std::endl;
+		return 1;
+	}
+
+	runningServer = &server;
+	std::signal(SIGINT, stopRunningServer);
+	std::signal(SIGTERM, stopRunningServer);
+	std::cerr << "Listening on " << address << std::endl;
 
-	return parseToken(expressionWithoutSpaces);
+	bool success = server.run();
+
+	std::signal(SIGINT, SIG_DFL);
+	std::signal(SIGTERM, SIG_DFL);
+	runningServer = nullptr;
+
+	if (!success) {
+		std::cerr << server.getError() << std::endl;
+	}
+	return success ? 0 : 1;
 }
+#else
+int runServer(const std::string&, SharedExpressionCache&, size_t) {
+	std::cerr << "The server isn't available on this system" << std::endl;
+	return 1;
+}
+#endif
 
 // Program functions
 
+// The value of a count argument, only digits. std::stoul took the negative ones as huge counts. It throws
+// invalid_argument for the other values or the ones above the maximum
+size_t parseCount(const char* text, size_t maximum) {
+	size_t value = 0;
+	const char* end = text + std::strlen(text);
+	auto result = std::from_chars(text, end, value);
+	if (result.ec != std::errc() || result.ptr != end || text == end || value > maximum) {
+		throw std::invalid_argument(text);
+	}
+	return value;
+}
+
+// The arguments of the command line
+void usage() {
+	std::cerr << " --cache-size <n>: maximum number of compiled expressions kept in the cache, the server splits it between " << SharedExpressionCache::SHARD_COUNT << " caches that evict their least recently used expressions on their own (default " << ExpressionCache::DEFAULT_CAPACITY << ")\n";
+	std::cerr << " --batch [file]: evaluates one expression per line of the file or the standard input and prints one result per line\n";
+	std::cerr << " --threads <n>: number of threads of the batch mode and the server, up to 4 per core, 0 uses all the cores (default 1)\n";
+	std::cerr << " --jit-threshold <n>: evaluations of an expression before it is compiled to native code, 0 never compiles (default " << DEFAULT_JIT_THRESHOLD << ")\n";
+	std::cerr << " --compile <file>: saves the compiled expressions of the batch input in a program file instead of evaluating them\n";
+	std::cerr << " --preload <file>: adds the expressions of a program file to the cache before starting\n";
+	std::cerr << " --listen <address>: runs as a server on unix:<path> or [host]:port until it gets SIGINT or SIGTERM\n";
+	std::cerr << " --stats: prints counters and latency percentiles of the calculator to the error output when it exits" << std::endl;
+}
+
 void help() {
 	std::cout << "Program created by Electrodiux-pbh (c) https://github.com/Electrodiux-pbh/console-calculator/\n";
 	std::cout << "\nCommands:\n";
 	std::cout << " - (h): prints the help to the console\n";
 	std::cout << " - (q): quits the program\n";
 	std::cout << " - (o): execute a operation\n";
+	std::cout << " - (c): prints the statistics of the expression cache\n";
 	std::cout << "\nAvalaible operations:\n";
 	std::cout << " - Addition (+)\n";
 	std::cout << " - Substraction (-)\n";
 	std::cout << " - Multiplication (*)\n";
 	std::cout << " - Divition (/)\n";
 	std::cout << " - Power (^)\n";
+	std::cout << " - Parentheses ( )\n";
+	std::cout << "\nFunctions:\n";
+	for (const Function& function : FUNCTIONS) {
+		std::cout << " - " << function.description << "\n";
+	}
 	std::cout << "\nConstants:\n";
-	std::cout << " - pi = 3.14159265358979323846\n";
-	std::cout << " - e = 2.71828182845904523536\n";
+	for (const Constant& constant : CONSTANTS) {
+		std::cout << " - " << constant.name << " = " << constant.text << "\n";
+	}
+}
+
+void cacheStatistics(const ExpressionCache& cache) {
+	std::cout << "Cached expressions: " << cache.getSize() << " of " << cache.getCapacity() << "\n";
+	std::cout << "Hits: " << cache.getHits() << ", misses: " << cache.getMisses() << std::endl;
 }
 
 void unrecognizedAction() {
 	std::cout << "Unrecognized action, type h for help" << std::endl;
 }
 
-int main() {
+int main(int argc, char** argv) {
+	// Print the results with the digits that tell every double apart, so they parse back to the same value
+	std::cout << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+	// The interactive operations have no values for variables, so only constants are allowed
+	CompileOptions options;
+	options.allowNewVariables = false;
+
+	size_t cacheCapacity = ExpressionCache::DEFAULT_CAPACITY;
+	bool batch = false;
+	std::string batchFile; // Empty to read from the standard input
+	std::string compileFile; // When set the batch input is saved in this program file instead of evaluated
+	std::string preloadFile;
+	std::string listenAddress; // When set it runs as a server instead
+	size_t threadCount = 1;
+
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+
+		try {
+			if (argument == "--cache-size" && i + 1 < argc) {
+				cacheCapacity = parseCount(argv[++i], std::numeric_limits<uint32_t>::max());
+			}
+			else if (argument == "--threads" && i + 1 < argc) {
+				// More threads than a few for each core only cost memory, and a huge count can't even be allocated
+				constexpr size_t MAX_THREADS_PER_CORE = 4;
+				size_t cores = std::max(1u, std::thread::hardware_concurrency());
+				threadCount = parseCount(argv[++i], cores * MAX_THREADS_PER_CORE);
+				if (threadCount == 0) {
+					threadCount = cores;
+				}
+			}
+			else if (argument == "--stats") {
+				if (STATISTICS_COMPILED) {
+					// Registered after creating the registry, so it is still alive when the report is printed at exit
+					StatisticsRegistry::get();
+					statisticsEnabled = true;
+					std::atexit([] { printStatistics(stderr); });
+				}
+				else {
+					std::cerr << "The statistics aren't available, this build has CALCULATOR_STATS=0" << std::endl;
+				}
+			}
+			else if (argument == "--jit-threshold" && i + 1 < argc) {
+				options.jitThreshold = static_cast<uint32_t>(parseCount(argv[++i], std::numeric_limits<uint32_t>::max()));
+			}
+			else if (argument == "--compile" && i + 1 < argc) {
+				compileFile = argv[++i];
+				batch = true;
+			}
+			else if (argument == "--preload" && i + 1 < argc) {
+				preloadFile = argv[++i];
+			}
+			else if (argument == "--listen" && i + 1 < argc) {
+				listenAddress = argv[++i];
+			}
+			else if (argument == "--batch") {
+				batch = true;
+				if (i + 1 < argc && argv[i + 1][0] != '-') {
+					batchFile = argv[++i];
+				}
+			}
+			else {
+				std::cerr << "Unrecognized argument " << argument << ", the available arguments are:\n";
+				usage();
+				return 1;
+			}
+		}
+		catch (const std::invalid_argument&) {
+			std::cerr << "Invalid value " << argv[i] << " of " << argument << ", the available arguments are:\n";
+			usage();
+			return 1;
+		}
+	}
+
+	ProgramFile programs;
+	if (!preloadFile.empty() && !programs.open(preloadFile.c_str())) {
+		std::cerr << "Can't load " << preloadFile << ": " << programs.getError() << std::endl;
+		return 1;
+	}
+
+	// The cache grows to hold all of them, otherwise the first ones would be evicted by the last ones
+	auto preload = [&](auto& cache) {
+		cache.setCapacity(std::max(cache.getCapacity(), programs.size()));
+		preloadCache(cache, programs);
+	};
+
+	if (!listenAddress.empty()) {
+		// The requests have the values of the variables of their expressions
+		CompileOptions serverOptions = options;
+		serverOptions.allowNewVariables = true;
+
+		SharedExpressionCache sharedCache(cacheCapacity, serverOptions);
+		preload(sharedCache);
+		return runServer(listenAddress, sharedCache, threadCount);
+	}
+
+	ExpressionCache cache(cacheCapacity, options);
+	preload(cache);
+
+	if (batch) {
+		// The batch mode only uses the C streams, the iostreams are only used to report the errors
+		std::ios::sync_with_stdio(false);
+
+		auto run = [&](auto& reader) {
+			if (!compileFile.empty()) {
+				return compileToProgramFile(reader, options, compileFile.c_str());
+			}
+			return threadCount > 1 ? runParallelBatch(reader, cache, threadCount) : runBatch(reader, cache);
+		};
+
+		if (batchFile.empty()) {
+			LineReader reader(stdin);
+			return run(reader);
+		}
+
+		// The files are mapped when the system allows it, so the lines are read straight from the mapped pages
+		MappedLineReader mappedReader;
+		if (mappedReader.open(batchFile.c_str())) {
+			return run(mappedReader);
+		}
+
+		FILE* input = std::fopen(batchFile.c_str(), "rb");
+		if (input == nullptr) {
+			std::cerr << "Can't open " << batchFile << std::endl;
+			return 1;
+		}
+
+		LineReader reader(input);
+		int status = run(reader);
+
+		std::fclose(input);
+		return status;
+	}
+
 	std::cout << "Welcome to calculator, type an acction to do (type h for help)" << std::endl;
 
 	while (true) { // Keep the program alive indefenetly
 		std::string action;
 
-		std::getline(std::cin, action);
+		if (!std::getline(std::cin, action)) {
+			break; // The input was closed
+		}
 
 		if (action == "h") {
 			help();
 			continue;
 		}
+		else if (action == "c") {
+			cacheStatistics(cache);
+		}
 		else if (action == "q") {
 			break; // Break loop to exit the program 
 		}
@@ -249,8 +1337,16 @@ int main() {
 
 			std::cout << std::endl;
 
-			auto expression = compileExpression(expression_str);
-			double result = expression->resolve();
+			CompileError error;
+			auto expression = cache.get(expression_str, error);
+
+			if (!expression) {
+				// Points to the position of the error under the expression
+				std::cout << expression_str << "\n" << std::string(error.offset, ' ') << "^ " << error.getMessage(expression_str) << std::endl;
+				continue;
+			}
+
+			double result = expression->evaluate(nullptr);
 
 			std::cout << expression_str << " = " << result << std::endl;
 		}
@@ -0,0 +1,909 @@
+/*
+ * Differential tests of the calculator. Every engine must give the same result as the others, to the last bit, for
+ * the same random expressions and bindings: the tree, the bytecode with and without the optimizer, the native code,
+ * the batch kernels, the parallel evaluator, the incremental evaluator and the incremental parser, and both modes
+ * of the gradients. The seeds are fixed so a failure can be run again, and every failure prints the expression and
+ * the values that differ. The other suites check the errors of the parser, the output of the batch and interactive
+ * modes, the program files and the caches.
+ *
+ * Run all the suites with ./tests or one of them with ./tests <suite>, ctest runs each one as its own test. The
+ * suites that run the calculator program take its path after the suite, ./calculator by default.
+ */
+
+#include "engine.hpp"
+
+#include<fstream>
+#include<random>
+#include<sstream>
+
+using namespace calculator::engine;
+
+// Results
+
+size_t failures = 0;
+
+// Equal to the last bit, any NaN is equal to any other NaN
+bool same(double a, double b) {
+	return toBits(a) == toBits(b) || (std::isnan(a) && std::isnan(b));
+}
+
+std::string formatNumber(double value) {
+	std::string text;
+	appendNumber(text, value);
+	return text;
+}
+
+std::string formatBindings(const std::vector<double>& bindings) {
+	std::string text;
+	for (double value : bindings) {
+		text += (text.empty() ? "" : ", ") + formatNumber(value);
+	}
+	return "(" + text + ")";
+}
+
+// Only the first failures are printed, the rest are counted
+void fail(const std::string& expression, const char* engine, const std::string& message) {
+	if (++failures <= 20) {
+		std::printf("%s: %s\n  %s\n", engine, message.c_str(), expression.c_str());
+	}
+}
+
+void compare(const std::string& expression, const std::vector<double>& bindings, const char* engine, double expected, double actual) {
+	if (!same(expected, actual)) {
+		fail(expression, engine, "at " + formatBindings(bindings) + " gives " + formatNumber(actual) + " instead of " + formatNumber(expected));
+	}
+}
+
+// Runs of the calculator program
+
+const char* calculatorPath = "./calculator";
+
+struct ProgramRun {
+	int status;
+	std::string output;
+	std::string errors;
+};
+
+std::string readFile(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream text;
+	text << file.rdbuf();
+	return text.str();
+}
+
+// Runs the calculator with the arguments and the input in a file, the files are named after the run so the suites
+// that ctest runs at the same time don't share them
+ProgramRun runCalculator(const std::string& name, const std::string& arguments, const std::string& input) {
+	std::ofstream(name + ".in", std::ios::binary) << input;
+
+	std::string command = std::string("\"") + calculatorPath + "\" " + arguments + " < " + name + ".in > " + name + ".out 2> " + name + ".err";
+	int status = std::system(command.c_str());
+	return { status, readFile(name + ".out"), readFile(name + ".err") };
+}
+
+// Random input
+
+const std::vector<std::string> VARIABLES = { "x", "y", "z" };
+
+// Random expressions over x, y and z with every operation and function of the calculator. The powers mostly have
+// the constant exponents the optimizer specializes, and the subexpressions already generated are repeated now and
+// then so the programs have shared nodes
+class ExpressionGenerator {
+public:
+	explicit ExpressionGenerator(uint64_t seed) : random(seed) {}
+
+	std::string generate(size_t depth) {
+		if (depth == 0 || pick(5) == 0) {
+			return operand();
+		}
+
+		if (!generated.empty() && pick(8) == 0) {
+			return generated[pick(generated.size())];
+		}
+
+		std::string a = generate(depth - 1);
+		std::string expression;
+
+		switch (pick(12)) {
+		case 0:
+			expression = "-" + a;
+			break;
+		case 1:
+			expression = a + "^" + exponent();
+			break;
+		case 2:
+			expression = "(" + a + ")^(" + generate(depth - 1) + ")";
+			break;
+		case 3: {
+			const char* functions[] = { "sqrt", "sin", "cos", "exp", "log", "abs" };
+			expression = std::string(functions[pick(6)]) + "(" + a + ")";
+			break;
+		}
+		case 4:
+			expression = std::string(pick(2) == 0 ? "min(" : "max(") + a + ", " + generate(depth - 1) + ")";
+			break;
+		case 5:
+			expression = "if(" + a + ", " + generate(depth - 1) + ", " + generate(depth - 1) + ")";
+			break;
+		default: {
+			// Without parentheses now and then, so the precedence of the operators is tested too
+			const char operators[] = { '+', '-', '*', '/' };
+			std::string b = generate(depth - 1);
+			expression = pick(3) == 0 ? a + operators[pick(4)] + b : "(" + a + operators[pick(4)] + b + ")";
+			break;
+		}
+		}
+
+		generated.push_back(expression);
+		return expression;
+	}
+
+	// Small values with the special ones: zeros of both signs, integers, and the bounds of the functions
+	double value() {
+		const double special[] = { 0.0, -0.0, 1, -1, 2, -2, 0.5, 3 };
+		if (pick(4) == 0) {
+			return special[pick(8)];
+		}
+		return std::uniform_real_distribution<double>(-4, 4)(random);
+	}
+
+	std::vector<double> bindings() {
+		std::vector<double> values(VARIABLES.size());
+		for (double& value : values) {
+			value = this->value();
+		}
+		return values;
+	}
+
+	size_t pick(size_t count) {
+		return random() % count;
+	}
+
+private:
+	std::mt19937_64 random;
+	std::vector<std::string> generated;
+
+	std::string operand() {
+		switch (pick(6)) {
+		case 0:
+			return pick(2) == 0 ? "pi" : "e";
+		case 1:
+		case 2: {
+			double number = pick(2) == 0 ? double(pick(10)) : pick(1000) / 8.0;
+			return formatNumber(number);
+		}
+		default:
+			return VARIABLES[pick(VARIABLES.size())];
+		}
+	}
+
+	std::string exponent() {
+		const char* exponents[] = { "2", "3", "0", "1", "(-1)", "(-2)", "0.5", "(1/3)", "2.5", "7", "(-0.5)" };
+		return exponents[pick(11)];
+	}
+};
+
+// Suites
+
+// The bytecode is the reference of the engines compiled with the same options. With STRICT precision the optimizer
+// must keep the results exact, so the tree and the bytecode without the optimizer are its reference too. FAST lets
+// the optimizer change the powers, so there it is only compared with the engines of the same program
+void checkEngines() {
+	constexpr size_t EXPRESSIONS = 3000, BINDINGS = 8;
+	ExpressionGenerator generator(20261015);
+	ThreadPool pool(4);
+
+	for (size_t i = 0; i < EXPRESSIONS; i++) {
+		std::string expression = generator.generate(1 + generator.pick(7));
+
+		TokenArena arena;
+		VariableTable table{ VARIABLES };
+		TokenPtr tree = parseToken(expression, &arena, &table);
+
+		for (Precision precision : { Precision::STRICT, Precision::FAST }) {
+			CompileOptions options;
+			options.precision = precision;
+			CompiledExpression compiled = compileExpression(expression, VARIABLES, options);
+
+			options.optimize = false;
+			CompiledExpression unoptimized = compileExpression(expression, VARIABLES, options);
+
+			std::unique_ptr<NativeCode> native = NativeCompiler::compile(compiled.program.view());
+			ParallelEvaluator parallel(compiled.program, pool, 4);
+
+			std::vector<double> columns[3], batch(BINDINGS);
+			for (size_t row = 0; row < BINDINGS; row++) {
+				std::vector<double> bindings = generator.bindings();
+				for (size_t slot = 0; slot < VARIABLES.size(); slot++) {
+					columns[slot].push_back(bindings[slot]);
+				}
+
+				double expected = executeProgram(compiled.program, bindings.data());
+				if (precision == Precision::STRICT) {
+					compare(expression, bindings, "tree", resolveToken(*tree, bindings.data()), expected);
+					compare(expression, bindings, "unoptimized", executeProgram(unoptimized.program, bindings.data()), expected);
+				}
+				compare(expression, bindings, "parallel", parallel.evaluate(bindings.data()), expected);
+				if (native) {
+					compare(expression, bindings, "native", native->getFunction()(bindings.data()), expected);
+				}
+			}
+
+			const double* columnPointers[] = { columns[0].data(), columns[1].data(), columns[2].data() };
+			compiled.evaluateBatch(columnPointers, batch.data(), BINDINGS);
+			for (size_t row = 0; row < BINDINGS; row++) {
+				std::vector<double> bindings = { columns[0][row], columns[1][row], columns[2][row] };
+				compare(expression, bindings, "batch", executeProgram(compiled.program, bindings.data()), batch[row]);
+			}
+		}
+	}
+}
+
+// Random changes of one or a few variables at once, every result must be the one of evaluating the program again
+void checkIncrementalEvaluator() {
+	constexpr size_t EXPRESSIONS = 500, UPDATES = 20;
+	ExpressionGenerator generator(4242);
+
+	for (size_t i = 0; i < EXPRESSIONS; i++) {
+		std::string expression = generator.generate(1 + generator.pick(7));
+		CompiledExpression compiled = compileExpression(expression, VARIABLES);
+
+		std::vector<double> bindings = generator.bindings();
+		IncrementalEvaluator evaluator(compiled, bindings.data());
+		compare(expression, bindings, "incremental evaluator", executeProgram(compiled.program, bindings.data()), evaluator.evaluate());
+
+		for (size_t update = 0; update < UPDATES; update++) {
+			double result;
+			if (generator.pick(2) == 0) {
+				size_t slot = generator.pick(VARIABLES.size());
+				bindings[slot] = generator.value();
+				result = evaluator.update(slot, bindings[slot]);
+			}
+			else {
+				for (size_t changes = 1 + generator.pick(3); changes > 0; changes--) {
+					size_t slot = generator.pick(VARIABLES.size());
+					bindings[slot] = generator.value();
+					evaluator.set(slot, bindings[slot]);
+				}
+				result = evaluator.evaluate();
+			}
+
+			compare(expression, bindings, "incremental evaluator", executeProgram(compiled.program, bindings.data()), result);
+		}
+	}
+}
+
+// Random edits of a text, valid or not in between. After every edit the text, the error and the result must be the
+// ones of parsing the whole text again. Most edits change an operand or add an operation after one, which keeps the
+// text valid, the rest insert or remove any text. An invalid text is mostly taken back to the last valid one by an
+// edit of the characters where they differ
+void checkIncrementalParser() {
+	constexpr size_t DOCUMENTS = 100, EDITS = 300;
+	ExpressionGenerator generator(777);
+	const char* operands[] = { "x", "y", "z", "2", "7" };
+	const char* operations[] = { "+x", "*(y-1)", "^2", "/z", "-sin(x)", "*max(y, 2)" };
+	const char* snippets[] = { "x", "+", "-", "*", "^", "(", ")", ",", " ", "1.5", "sin(", "1e", "q" };
+
+	auto isOperandEnd = [](char c) {
+		return c == 'x' || c == 'y' || c == 'z' || c == ')' || (c >= '0' && c <= '9');
+	};
+
+	for (size_t document = 0; document < DOCUMENTS; document++) {
+		std::string text = generator.generate(4 + generator.pick(5));
+		IncrementalParser parser(VARIABLES);
+		parser.setText(text);
+
+		std::string lastValid = text;
+		bool valid = !parser.getError();
+
+		for (size_t edit = 0; edit < EDITS; edit++) {
+			size_t offset = generator.pick(text.size() + 1);
+			size_t removed = 0;
+			std::string inserted;
+
+			size_t kind = generator.pick(10);
+			if (!valid && generator.pick(4) != 0) {
+				size_t prefix = 0, suffix = 0;
+				while (prefix < text.size() && prefix < lastValid.size() && text[prefix] == lastValid[prefix]) {
+					prefix++;
+				}
+				while (suffix < text.size() - prefix && suffix < lastValid.size() - prefix && text[text.size() - 1 - suffix] == lastValid[lastValid.size() - 1 - suffix]) {
+					suffix++;
+				}
+
+				offset = prefix;
+				removed = text.size() - prefix - suffix;
+				inserted = lastValid.substr(prefix, lastValid.size() - prefix - suffix);
+			}
+			else if (kind < 4 && offset < text.size() && isOperandEnd(text[offset]) && text[offset] != ')') {
+				removed = 1;
+				inserted = operands[generator.pick(5)];
+			}
+			else if (kind < 7 && offset > 0 && isOperandEnd(text[offset - 1])) {
+				inserted = operations[generator.pick(6)];
+			}
+			else {
+				removed = generator.pick(4);
+				inserted = generator.pick(8) == 0 ? generator.generate(2) : snippets[generator.pick(13)];
+			}
+
+			removed = std::min(removed, text.size() - offset);
+			text.replace(offset, removed, inserted);
+			CompileError error = parser.edit(offset, removed, inserted);
+			valid = !error;
+
+			if (parser.getText() != text) {
+				fail(text, "incremental parser", "has the text " + parser.getText());
+				break;
+			}
+
+			// The variables of the parser are never removed, so the full parse starts with them to get the same slots
+			TokenArena arena;
+			VariableTable table = parser.getVariables();
+			CompileError expectedError;
+			TokenPtr tree = parseToken(text, &arena, &table, true, &expectedError);
+
+			if (error.code != expectedError.code || error.offset != expectedError.offset || error.length != expectedError.length) {
+				fail(text, "incremental parser", "fails with " + error.getMessage(text) + " instead of " + expectedError.getMessage(text));
+				continue;
+			}
+			if (error) {
+				continue;
+			}
+			lastValid = text;
+
+			std::vector<double> bindings(table.size());
+			for (double& value : bindings) {
+				value = generator.value();
+			}
+
+			double expected = resolveToken(*tree, bindings.data());
+			compare(text, bindings, "incremental parser", expected, parser.evaluate(bindings.data()));
+
+			CompileOptions options;
+			options.optimize = false;
+			CompiledExpression compiled;
+			parser.compile(compiled, options);
+			compare(text, bindings, "incremental parser compile", expected, executeProgram(compiled.program, bindings.data()));
+		}
+	}
+}
+
+// Both modes of the gradients must agree, also where the side an IF didn't take has an infinite derivative and where
+// the derivative by the exponent of a negative base is NaN. Only the derivative by a variable exponent is NaN there
+void checkGradients() {
+	struct Case {
+		const char* expression;
+		double x, y;
+	};
+	const Case cases[] = {
+		{ "if(x, sqrt(x), 0)", 0, 0 },
+		{ "if(x, x^0.5, 0)", 0, 0 },
+		{ "if(x-1, log(x), 2*x)", 0, 0 },
+		{ "0*sqrt(x)", 0, 0 },
+		{ "if(max(x-1.5, 0), (x+1)^0.5*x^1.5, min(x, 2.5)*abs(x-3))", 2, 0 },
+		{ "x^3", -2, 0 },
+		{ "x^2.5*y", -2, 3 },
+		{ "x^y", -2, 3 },
+		{ "(-2)^y+x", 1, 3 },
+	};
+
+	for (const Case& test : cases) {
+		for (Precision precision : { Precision::STRICT, Precision::FAST }) {
+			CompileOptions options;
+			options.precision = precision;
+			CompiledExpression compiled = compileExpression(test.expression, { "x", "y" }, options);
+
+			std::vector<double> bindings = { test.x, test.y };
+			double forward[2], reverse[2];
+			GradientEvaluator(compiled, DifferentiationMode::FORWARD).evaluate(bindings.data(), forward);
+			GradientEvaluator(compiled, DifferentiationMode::REVERSE).evaluate(bindings.data(), reverse);
+
+			for (size_t slot = 0; slot < 2; slot++) {
+				std::string engine = "derivative by " + VARIABLES[slot];
+				compare(test.expression, bindings, engine.c_str(), forward[slot], reverse[slot]);
+			}
+		}
+	}
+
+	// With a negative base the exponent has no derivative, but the base still has one
+	CompiledExpression power = compileExpression("x^y", { "x", "y" });
+	std::vector<double> bindings = { -2, 3 };
+	for (DifferentiationMode mode : { DifferentiationMode::FORWARD, DifferentiationMode::REVERSE }) {
+		double gradient[2];
+		GradientEvaluator(power, mode).evaluate(bindings.data(), gradient);
+		compare("x^y", bindings, "derivative by x", 12, gradient[0]);
+		compare("x^y", bindings, "derivative by y", std::numeric_limits<double>::quiet_NaN(), gradient[1]);
+	}
+}
+
+// The errors have the code and the offset in bytes of where the text stops being valid, and the batch mode reports
+// the lines that fail with them and goes on with the next ones
+void checkParserErrors() {
+	struct Case {
+		const char* expression;
+		ErrorCode code;
+		size_t offset;
+	};
+	const Case cases[] = {
+		{ "(1+2", ErrorCode::MISSING_PARENTHESIS, 0 },
+		{ "2+*3", ErrorCode::UNEXPECTED_TOKEN, 2 },
+		{ "foo(1)", ErrorCode::UNKNOWN_FUNCTION, 0 },
+		{ "2*x+1", ErrorCode::UNKNOWN_IDENTIFIER, 2 },
+		{ "1+(2*(3)", ErrorCode::MISSING_PARENTHESIS, 2 },
+		{ "1+2)", ErrorCode::UNEXPECTED_PARENTHESIS, 3 },
+		{ "2+", ErrorCode::UNEXPECTED_END, 2 },
+		{ "", ErrorCode::UNEXPECTED_END, 0 },
+		{ "max(1)", ErrorCode::ARGUMENT_COUNT, 0 },
+		{ "2 3", ErrorCode::UNEXPECTED_TOKEN, 2 },
+	};
+
+	CompileOptions options;
+	options.allowNewVariables = false;
+
+	for (const Case& test : cases) {
+		CompiledExpression compiled;
+		CompileError error = tryCompileExpression(test.expression, {}, compiled, options);
+		if (error.code != test.code || error.offset != test.offset) {
+			fail(test.expression, "error", error.getMessage(test.expression) + ", code " + std::to_string(int(error.code))
+				+ " instead of " + std::to_string(int(test.code)) + " at position " + std::to_string(test.offset));
+		}
+	}
+
+	// The lines that fail print "error" and their message goes to the error output, the others are still evaluated
+	const char* lines[] = { "1+2", "(1+2", "2+*3", "", "foo(1)", "2*x+1", "4*5" };
+	std::string input, output, errors;
+	for (size_t i = 0; i < std::size(lines); i++) {
+		std::string_view line = lines[i];
+		input += line;
+		input += '\n';
+
+		CompiledExpression compiled;
+		CompileError error = tryCompileExpression(line, {}, compiled, options);
+		if (line.empty()) {
+			output += "\n";
+		}
+		else if (error) {
+			output += "error\n";
+			errors += "Line " + std::to_string(i + 1) + ": " + error.getMessage(line) + ": " + lines[i] + "\n";
+		}
+		else {
+			output += formatNumber(compiled.evaluate(nullptr)) + "\n";
+		}
+	}
+
+	ProgramRun run = runCalculator("parser-errors", "--batch", input);
+	if (run.status == 0) {
+		fail(input, "batch", "exits with 0 with lines that fail");
+	}
+	if (run.output != output) {
+		fail(input, "batch", "prints\n" + run.output + "instead of\n" + output);
+	}
+	if (run.errors != errors) {
+		fail(input, "batch", "reports\n" + run.errors + "instead of\n" + errors);
+	}
+}
+
+// A program file evaluates from its mapping to the bits of the expressions it was saved from, and the files and the
+// programs that an engine couldn't run safely are rejected when they are opened
+void checkProgramFiles() {
+	constexpr size_t EXPRESSIONS = 300, BINDINGS = 4;
+	ExpressionGenerator generator(5150);
+
+	std::vector<std::string> expressions;
+	std::vector<CompiledExpression> compiled;
+	ProgramFileWriter writer;
+	for (size_t i = 0; i < EXPRESSIONS; i++) {
+		CompileOptions options;
+		options.precision = i % 2 == 0 ? Precision::STRICT : Precision::FAST;
+		options.jitThreshold = 0;
+
+		expressions.push_back(generator.generate(1 + generator.pick(7)));
+		compiled.push_back(compileExpression(expressions.back(), VARIABLES, options));
+		writer.add(expressions.back(), compiled.back());
+	}
+
+	const std::string path = "program-files.bin";
+	ProgramFile file;
+	if (!writer.save(path.c_str()) || !file.open(path.c_str())) {
+		fail(path, "program file", "can't be saved and opened: " + file.getError());
+		return;
+	}
+	if (file.size() != EXPRESSIONS) {
+		fail(path, "program file", "has " + std::to_string(file.size()) + " expressions instead of " + std::to_string(EXPRESSIONS));
+		return;
+	}
+
+	for (size_t i = 0; i < EXPRESSIONS; i++) {
+		if (file.getSource(i) != expressions[i]) {
+			fail(expressions[i], "program file", "has the source " + std::string(file.getSource(i)));
+		}
+
+		CompiledExpression loaded;
+		file.load(i, loaded);
+		for (size_t row = 0; row < BINDINGS; row++) {
+			std::vector<double> bindings = generator.bindings();
+			double expected = compiled[i].evaluate(bindings.data());
+			compare(expressions[i], bindings, "mapped program", expected, file.evaluate(i, bindings.data()));
+			compare(expressions[i], bindings, "loaded program", expected, loaded.evaluate(bindings.data()));
+		}
+	}
+
+	// The damaged files have a single expression with every kind of node: constants, bindings, a lazy IF and a
+	// temporary, so every check of the validator has something to reject
+	const std::string source = "if(x, sin(x+y)*2, y^3) + (x+y)*(x+y)";
+	const Program program = compileExpression(source, { "x", "y" }).program;
+
+	ProgramFileWriter single;
+	single.add(source, compileExpression(source, { "x", "y" }));
+	if (!single.save(path.c_str())) {
+		fail(path, "program file", "can't be saved");
+		return;
+	}
+	const std::string bytes = readFile(path);
+
+	auto checkRejected = [&](const std::string& damaged, const char* what) {
+		std::ofstream(path, std::ios::binary | std::ios::trunc) << damaged;
+		ProgramFile rejected;
+		if (rejected.open(path.c_str())) {
+			fail(source, "program file", std::string("with ") + what + " is opened");
+		}
+	};
+
+	std::string damaged = bytes;
+	damaged[0] ^= 1;
+	checkRejected(damaged, "another magic");
+
+	for (uint32_t version : { PROGRAM_FILE_OLDEST_VERSION - 1, PROGRAM_FILE_VERSION + 1 }) {
+		damaged = bytes;
+		std::memcpy(&damaged[offsetof(ProgramFileHeader, version)], &version, sizeof(version));
+		checkRejected(damaged, "another version");
+	}
+
+	// Any cut before the end of the source of the expression, the rest is the padding of the next one
+	size_t used = bytes.rfind(source) + source.size();
+	for (size_t size : { size_t(0), sizeof(ProgramFileHeader) - 1, sizeof(ProgramFileHeader) + 4, used / 2, used - 1 }) {
+		checkRejected(bytes.substr(0, size), "its end cut");
+	}
+
+	// The same damages of the program in a file and given to the validator
+	auto checkInvalid = [&](const char* what, auto damage) {
+		Program invalid = program;
+		damage(invalid);
+		if (validateProgram(invalid.view(), 2)) {
+			fail(source, "validator", std::string("takes a program with ") + what);
+		}
+
+		ProgramFileWriter writer;
+		CompiledExpression expression = compileExpression(source, { "x", "y" });
+		expression.program = invalid;
+		writer.add(source, expression);
+		ProgramFile rejected;
+		if (writer.save(path.c_str()) && rejected.open(path.c_str())) {
+			fail(source, "program file", std::string("with a program with ") + what + " is opened");
+		}
+	};
+
+	if (!validateProgram(program.view(), 2)) {
+		fail(source, "validator", "rejects the program of the compiler");
+	}
+
+	auto find = [&](OpCode opcode) {
+		return static_cast<size_t>(std::find(program.opcodes.begin(), program.opcodes.end(), opcode) - program.opcodes.begin());
+	};
+	size_t push = find(OpCode::PUSH), load = find(OpCode::LOAD), sum = find(OpCode::SUM), recall = find(OpCode::RECALL);
+	size_t branch = find(OpCode::BRANCH), jump = find(OpCode::JUMP), save = find(OpCode::SAVE);
+	uint32_t size = static_cast<uint32_t>(program.size());
+
+	checkInvalid("a constant out of range", [&](Program& p) { p.a[push] = static_cast<uint32_t>(p.constants.size()); });
+	checkInvalid("a binding out of range", [&](Program& p) { p.a[load] = 2; });
+	checkInvalid("a first child out of range", [&](Program& p) { p.a[sum] = size; });
+	checkInvalid("a second child out of range", [&](Program& p) { p.b[sum] = size; });
+	checkInvalid("a child that isn't on the stack", [&](Program& p) { p.b[sum] = p.a[sum]; });
+	checkInvalid("a temporary out of range", [&](Program& p) { p.b[save] = static_cast<uint32_t>(p.temporaryCount); });
+	checkInvalid("a temporary recalled before it is saved", [&](Program& p) { std::swap(p.opcodes[save], p.opcodes[recall]); });
+	checkInvalid("another stack size", [&](Program& p) { p.stackSize++; });
+	checkInvalid("two values left on the stack", [&](Program& p) { p.addNode(OpCode::PUSH, 0); });
+	checkInvalid("its last node missing", [&](Program& p) {
+		p.opcodes.pop_back();
+		p.a.pop_back();
+		p.b.pop_back();
+	});
+	checkInvalid("a BRANCH to a node that isn't after its JUMP", [&](Program& p) { p.b[branch]++; });
+	checkInvalid("a JUMP backwards", [&](Program& p) { p.b[jump] = static_cast<uint32_t>(branch); });
+	checkInvalid("a JUMP past the end", [&](Program& p) { p.b[jump] = size; });
+	checkInvalid("a JUMP to a node that isn't its JOIN", [&](Program& p) { p.b[jump]--; });
+}
+
+// The numbers printed by the calculator parse back to the same bits, in the batch mode and in the interactive one
+void checkNumberOutput() {
+	std::mt19937_64 random(1108);
+
+	auto checkParsed = [](const std::string& expression, const std::string& text, double expected) {
+		double parsed = std::strtod(text.c_str(), nullptr);
+		if (!same(parsed, expected)) {
+			fail(expression, "output", "prints " + text + ", which parses to another number");
+		}
+	};
+
+	// Any bits, also the subnormal numbers, the infinities and NaN
+	for (size_t i = 0; i < 100000; i++) {
+		uint64_t bits = random();
+		double value;
+		std::memcpy(&value, &bits, sizeof(value));
+		checkParsed(std::to_string(bits), formatNumber(value), value);
+	}
+	for (double value : { 0.0, -0.0, 5e-324, std::numeric_limits<double>::max(), std::numeric_limits<double>::infinity() }) {
+		checkParsed("", formatNumber(value), value);
+	}
+
+	std::vector<std::string> expressions = { "0.1+0.2", "1/3", "-2/3", "1e300*1e10", "0/0", "2^-1074", "100", "1e21+1" };
+	for (size_t i = 0; i < 500; i++) {
+		const char* functions[] = { "sin", "cos", "exp", "log", "sqrt" };
+		expressions.push_back(std::string(functions[random() % 5]) + "(" + std::to_string(random() % 1000) + "/7)");
+	}
+
+	std::string input;
+	for (const std::string& expression : expressions) {
+		input += expression + "\n";
+	}
+
+	ProgramRun run = runCalculator("number-output", "--batch", input);
+	std::istringstream lines(run.output);
+	std::string line;
+	for (const std::string& expression : expressions) {
+		if (!std::getline(lines, line)) {
+			fail(expression, "batch", "has no result");
+			break;
+		}
+		checkParsed(expression, line, compileExpression(expression, {}).evaluate(nullptr));
+	}
+	if (run.output.find("0.30000000000000004\n") == std::string::npos) {
+		fail("0.1+0.2", "batch", "doesn't print 0.30000000000000004");
+	}
+
+	// The interactive mode prints the expression and its result after the prompt
+	run = runCalculator("number-output", "", "o\n0.1+0.2\no\n1/3\nq\n");
+	for (const char* expression : { "0.1+0.2", "1/3" }) {
+		std::string prefix = std::string(expression) + " = ";
+		size_t start = run.output.find(prefix);
+		if (start == std::string::npos) {
+			fail(expression, "interactive", "doesn't print the result");
+			continue;
+		}
+		start += prefix.size();
+		checkParsed(expression, run.output.substr(start, run.output.find('\n', start) - start), compileExpression(expression, {}).evaluate(nullptr));
+	}
+}
+
+// The cache hits the expressions it has, whatever their spaces, and evicts the least recently used one when it is
+// full. The failed expressions aren't kept
+void checkCaches() {
+	ExpressionCache cache(3);
+	auto get = [&](const char* expression) {
+		return cache.get(expression);
+	};
+	auto check = [&](bool condition, const char* what) {
+		if (!condition) {
+			fail(what, "cache", "has " + std::to_string(cache.getSize()) + " expressions, " + std::to_string(cache.getHits())
+				+ " hits and " + std::to_string(cache.getMisses()) + " misses");
+		}
+	};
+
+	auto a = get("1+2"), b = get("3*4"), c = get("5-6");
+	check(cache.getSize() == 3 && cache.getMisses() == 3 && cache.getHits() == 0, "after the first 3 expressions");
+	check(get(" 1 + 2 ") == a && cache.getHits() == 1, "after 1+2 with spaces");
+
+	// 3*4 is the least recently used now, it goes for 7/8, and then 5-6 goes for 3*4
+	auto d = get("7/8");
+	check(cache.getSize() == 3 && cache.getMisses() == 4, "after adding 7/8");
+	check(get("3*4") != b && cache.getMisses() == 5, "after 3*4 was evicted");
+	check(get("1+2") == a && get("7/8") == d && cache.getHits() == 3, "after adding 3*4 again");
+	auto e = get("5-6");
+	check(e != c && cache.getMisses() == 6, "after 5-6 was evicted");
+
+	CompileError error;
+	check(cache.get("2+*3", error) == nullptr && error.code == ErrorCode::UNEXPECTED_TOKEN && error.offset == 2, "after 2+*3");
+	check(cache.get("2 +*3", error) == nullptr && error.offset == 3 && cache.getSize() == 3, "after 2 +*3");
+
+	// Only the most recently used one stays
+	cache.setCapacity(1);
+	check(cache.getSize() == 1 && get("5-6") == e, "with room for 1");
+}
+
+// Threads that miss the same expressions at once get the same compiled expression, compiled once, whatever the
+// spaces of their texts. An expression that fails gives every thread the error with the offset in its own text
+void checkSharedCache() {
+	constexpr size_t THREADS = 8, EXPRESSIONS = 200, ROUNDS = 10;
+	ExpressionGenerator generator(4858);
+
+	std::vector<std::string> expressions = { "2+*3" };
+	for (size_t i = 1; i < EXPRESSIONS; i++) {
+		expressions.push_back(generator.generate(1 + generator.pick(7)));
+	}
+
+	for (size_t round = 0; round < ROUNDS; round++) {
+		SharedExpressionCache cache(2 * EXPRESSIONS * SharedExpressionCache::SHARD_COUNT);
+		std::vector<std::vector<const CompiledExpression*>> results(THREADS, std::vector<const CompiledExpression*>(EXPRESSIONS));
+		std::vector<std::vector<size_t>> offsets(THREADS, std::vector<size_t>(EXPRESSIONS));
+		std::atomic<bool> start{ false };
+
+		// Half of the threads have the texts with spaces around them
+		std::vector<std::thread> threads;
+		for (size_t thread = 0; thread < THREADS; thread++) {
+			threads.emplace_back([&, thread] {
+				while (!start.load(std::memory_order_acquire)) {}
+
+				for (size_t i = 0; i < EXPRESSIONS; i++) {
+					std::string text = thread % 2 == 0 ? expressions[i] : "  " + expressions[i] + " ";
+					CompileError error;
+					results[thread][i] = cache.get(text, error).get();
+					offsets[thread][i] = error.offset;
+				}
+			});
+		}
+		start.store(true, std::memory_order_release);
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+
+		for (size_t i = 0; i < EXPRESSIONS; i++) {
+			for (size_t thread = 1; thread < THREADS; thread++) {
+				if (results[thread][i] != results[0][i]) {
+					fail(expressions[i], "shared cache", "gives threads 0 and " + std::to_string(thread) + " other compiled expressions");
+				}
+			}
+		}
+
+		for (size_t thread = 0; thread < THREADS; thread++) {
+			if (results[thread][0] != nullptr || offsets[thread][0] != (thread % 2 == 0 ? 2 : 4)) {
+				fail(expressions[0], "shared cache", "gives the thread " + std::to_string(thread) + " the error at " + std::to_string(offsets[thread][0]));
+			}
+		}
+	}
+}
+
+// The batch mode prints the same results and errors, in the same order, with any number of threads. The lines
+// repeat so the caches of the threads hit and evict, some of them come preloaded and all of them are compiled to
+// native code on their first evaluation
+void checkParallelBatch() {
+	constexpr size_t EXPRESSIONS = 1500, LINES = 20000;
+	ExpressionGenerator generator(313);
+
+	// The batch mode has no values for the variables, so they are numbers, and some lines are cut so they fail
+	std::vector<std::string> expressions;
+	for (size_t i = 0; i < EXPRESSIONS; i++) {
+		std::string generated = generator.generate(1 + generator.pick(7)), expression;
+		for (size_t j = 0; j < generated.size(); j++) {
+			bool alone = (j == 0 || !std::isalnum(static_cast<unsigned char>(generated[j - 1])))
+				&& (j + 1 == generated.size() || !std::isalnum(static_cast<unsigned char>(generated[j + 1])));
+			expression += alone && std::strchr("xyz", generated[j]) ? formatNumber(generator.value()) : std::string(1, generated[j]);
+		}
+		expressions.push_back(i % 10 == 0 ? expression.substr(0, expression.size() / 2) : expression);
+	}
+
+	std::string input, preloaded;
+	for (size_t i = 0; i < LINES; i++) {
+		input += (generator.pick(50) == 0 ? "" : expressions[generator.pick(EXPRESSIONS)]) + "\n";
+	}
+	for (size_t i = 0; i < EXPRESSIONS; i += 3) {
+		preloaded += expressions[i] + "\n";
+	}
+
+	runCalculator("parallel-batch", "--batch --compile parallel-batch.bin", preloaded);
+	std::string arguments = "--batch --preload parallel-batch.bin --jit-threshold 1 --cache-size 512 --threads ";
+	ProgramRun expected = runCalculator("parallel-batch", arguments + "1", input);
+	for (const char* threads : { "2", "4", "0" }) {
+		ProgramRun run = runCalculator("parallel-batch", arguments + threads, input);
+		std::string engine = std::string("--threads ") + threads;
+		if (run.status != expected.status) {
+			fail("the batch", engine.c_str(), "exits with " + std::to_string(run.status) + " instead of " + std::to_string(expected.status));
+		}
+
+		std::istringstream lines(run.output + run.errors), expectedLines(expected.output + expected.errors);
+		std::string line, expectedLine;
+		for (size_t number = 1; std::getline(expectedLines, expectedLine); number++) {
+			if (!std::getline(lines, line) || line != expectedLine) {
+				fail("the batch", engine.c_str(), "prints at line " + std::to_string(number) + "\n  " + line + "\ninstead of\n  " + expectedLine);
+				break;
+			}
+		}
+		if (std::getline(lines, line)) {
+			fail("the batch", engine.c_str(), "prints more lines than with --threads 1");
+		}
+	}
+	if (expected.errors.empty() || expected.output.size() < LINES) {
+		fail("the batch", "--threads 1", "doesn't print a line for every line or has no errors");
+	}
+}
+
+// Formulas parsed by the compiler. The ones of only literals are folded to the constant that the run time compiler
+// gives, and the rest must give its results to the last bit
+static constexpr auto STATIC_ARITHMETIC = parseStaticExpression("(1+2)*3-4/8");
+static constexpr auto STATIC_POWERS = parseStaticExpression("-(3^2)+2^-1*4+5^0+7^1");
+static constexpr auto STATIC_FUNCTIONS = parseStaticExpression("max(1, -2)*pi + min(e, 0) + abs(-1.5)");
+static constexpr auto STATIC_IF = parseStaticExpression("if(0, 1/0, 7) + if(2, 1e3, x) + .5");
+static constexpr auto STATIC_INFINITIES = parseStaticExpression("1/0 + 0^-1 + 1e300*1e300 + (1e200)^2");
+static constexpr auto STATIC_VARIABLES = parseStaticExpression("x*y+sin(x)/(1+y^2)");
+static constexpr auto STATIC_BRANCHES = parseStaticExpression("if(x-y, sqrt(abs(x)), min(x, y)^3)");
+static constexpr auto STATIC_ELEMENTARY = parseStaticExpression("exp(-x^2/2)*cos(y)-log(1+abs(x))+x^2.5");
+
+static_assert(StaticFormula<STATIC_ARITHMETIC>::IS_CONSTANT && StaticFormula<STATIC_ARITHMETIC>::evaluate() == 8.5);
+static_assert(StaticFormula<STATIC_POWERS>::IS_CONSTANT && StaticFormula<STATIC_POWERS>::evaluate() == 1);
+static_assert(StaticFormula<STATIC_FUNCTIONS>::IS_CONSTANT && StaticFormula<STATIC_FUNCTIONS>::evaluate() == 3.14159265358979323846 + 0 + 1.5);
+static_assert(StaticFormula<STATIC_IF>::IS_CONSTANT && StaticFormula<STATIC_IF>::evaluate() == 1007.5);
+static_assert(!StaticFormula<STATIC_INFINITIES>::IS_CONSTANT && StaticFormula<STATIC_INFINITIES>::VARIABLE_COUNT == 0);
+static_assert(!StaticFormula<STATIC_VARIABLES>::IS_CONSTANT && StaticFormula<STATIC_VARIABLES>::VARIABLE_COUNT == 2);
+static_assert(!StaticFormula<STATIC_BRANCHES>::IS_CONSTANT && StaticFormula<STATIC_BRANCHES>::VARIABLE_COUNT == 2);
+
+#ifdef CALCULATOR_STATIC_ERROR
+// A number without digits isn't a formula, the static-error test builds this and expects it to fail
+static constexpr auto STATIC_INVALID = parseStaticExpression("2*.");
+static_assert(StaticFormula<STATIC_INVALID>::IS_CONSTANT);
+#endif
+
+template<const auto& Expression>
+void compareStatic(const char* expression, ExpressionGenerator& generator) {
+	CompiledExpression compiled = compileExpression(expression, { "x", "y" });
+	for (size_t row = 0; row < 20; row++) {
+		std::vector<double> bindings = generator.bindings();
+		bindings.resize(2);
+		compare(expression, bindings, "static formula", executeProgram(compiled.program, bindings.data()), StaticFormula<Expression>::evaluate(bindings.data()));
+	}
+}
+
+void checkStaticFormulas() {
+	ExpressionGenerator generator(2553);
+	compareStatic<STATIC_ARITHMETIC>("(1+2)*3-4/8", generator);
+	compareStatic<STATIC_POWERS>("-(3^2)+2^-1*4+5^0+7^1", generator);
+	compareStatic<STATIC_FUNCTIONS>("max(1, -2)*pi + min(e, 0) + abs(-1.5)", generator);
+	compareStatic<STATIC_IF>("if(0, 1/0, 7) + if(2, 1e3, x) + .5", generator);
+	compareStatic<STATIC_INFINITIES>("1/0 + 0^-1 + 1e300*1e300 + (1e200)^2", generator);
+	compareStatic<STATIC_VARIABLES>("x*y+sin(x)/(1+y^2)", generator);
+	compareStatic<STATIC_BRANCHES>("if(x-y, sqrt(abs(x)), min(x, y)^3)", generator);
+	compareStatic<STATIC_ELEMENTARY>("exp(-x^2/2)*cos(y)-log(1+abs(x))+x^2.5", generator);
+}
+
+struct Suite {
+	const char* name;
+	void (*run)();
+};
+
+const Suite SUITES[] = {
+	{ "engines", checkEngines },
+	{ "incremental-evaluator", checkIncrementalEvaluator },
+	{ "incremental-parser", checkIncrementalParser },
+	{ "gradients", checkGradients },
+	{ "parser-errors", checkParserErrors },
+	{ "number-output", checkNumberOutput },
+	{ "program-files", checkProgramFiles },
+	{ "caches", checkCaches },
+	{ "shared-cache", checkSharedCache },
+	{ "parallel-batch", checkParallelBatch },
+	{ "static-formulas", checkStaticFormulas },
+};
+
+int main(int argc, char** argv) {
+	if (argc > 2) {
+		calculatorPath = argv[2];
+	}
+
+	bool found = false;
+	for (const Suite& suite : SUITES) {
+		if (argc < 2 || std::strcmp(argv[1], suite.name) == 0) {
+			found = true;
+			size_t before = failures;
+			suite.run();
+			std::printf("%-24s %s\n", suite.name, failures == before ? "passed" : "FAILED");
+		}
+	}
+
+	if (!found) {
+		std::printf("Unknown suite %s\n", argv[1]);
+		return 1;
+	}
+	if (failures > 20) {
+		std::printf("%zu failures, only the first 20 are printed\n", failures);
+	}
+	return failures == 0 ? 0 : 1;
+}